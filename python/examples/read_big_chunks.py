@@ -0,0 +1,25 @@
+
+import time
+import os
+import numpy as np
+
+from textreader import TextReader
+
+
+filename = 'data/big.csv'
+if not os.path.exists(filename):
+    print "{name} does not exist. Run the script generate_big.py to generate {name}.".format(name=filename)
+else:
+    dt = np.float32
+
+    # Sum the columns of the file, 100000 rows at a time, reusing one array.
+    t0 = time.time()
+    total = 0
+    nrows = 0
+    for a in TextReader(filename, dtype=dt, delimiter=',', chunksize=100000, reuse=True):
+        total = total + a.sum(axis=0, dtype=np.float64)
+        nrows += len(a)
+    t1 = time.time()
+    print t1 - t0, "seconds"
+    print nrows, "rows"
+    print "Column sums:", total
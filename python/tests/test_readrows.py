@@ -1,9 +1,10 @@
 
 from datetime import datetime
 import os
+import threading
 import numpy as np
-from numpy.testing import assert_array_equal, assert_equal
-from textreader import readrows
+from numpy.testing import assert_array_equal, assert_equal, assert_raises
+from textreader import readrows, countrows, build_index, TextReader
 
 
 filename = 'tmp.txt'
@@ -136,3 +137,699 @@ def test6():
 
     f.close()
     os.remove(filename)
+
+
+def test7():
+    """Tests the single pass read, with more rows than the initial allocation."""
+    nrows = 10000
+    dt = np.dtype([('x', np.int32), ('y', np.float64)])
+    a = np.empty(nrows, dtype=dt)
+    a['x'] = np.arange(nrows)
+    a['y'] = 0.5 * np.arange(nrows)
+    np.savetxt(filename, a, delimiter=',', fmt=['%d', '%.1f'])
+
+    b = readrows(filename, dt, delimiter=',')
+    assert_array_equal(a, b)
+
+    b = readrows(filename, dt, delimiter=',', skiprows=9990)
+    assert_array_equal(a[9990:], b)
+
+    b = readrows(filename, dt, delimiter=',', skiprows=nrows)
+    assert_equal(b.shape, (0,))
+
+    os.remove(filename)
+
+
+def test8():
+    """Tests num_threads, with quoted fields that contain newlines."""
+    nrows = 100000
+    f = open(filename, 'w')
+    for k in range(nrows):
+        if k % 7 == 0:
+            f.write('%d,"line 1\nline ""2""",%d.5\n' % (k, k))
+        else:
+            f.write('%d,"abc",%d.5\n' % (k, k))
+    f.close()
+
+    dt = np.dtype([('k', np.int32), ('s', 'S16'), ('x', np.float64)])
+    a = readrows(filename, dt, delimiter=',')
+    assert_equal(a.shape, (nrows,))
+    assert_array_equal(a['k'], np.arange(nrows))
+    assert_equal(a['s'][0], 'line 1\nline "2"')
+    for num_threads in [0, 2, 3, 4]:
+        b = readrows(filename, dt, delimiter=',', num_threads=num_threads)
+        assert_array_equal(a, b)
+        b = readrows(filename, dt, delimiter=',', num_threads=num_threads,
+                     numrows=nrows - 10)
+        assert_array_equal(a[:nrows - 10], b)
+
+    os.remove(filename)
+
+
+def test9():
+    """Tests fields that can't be used in place (quotes removed, '\\r\\n')."""
+    f = open(filename, 'wb')
+    f.write('1,"ab""c",ab"c,d"e,"1.5"\r\n')
+    f.write('2,"x\r\ny", 12 ,2.5e1\r\n')
+    f.write(' 3 ,"","",-3.25')
+    f.close()
+
+    dt = np.dtype([('k', np.int32), ('s', 'S8'), ('t', 'S8'), ('x', np.float64)])
+    a = readrows(filename, dt, delimiter=',')
+    assert_array_equal(a['k'], [1, 2, 3])
+    assert_array_equal(a['s'], ['ab"c', 'x\ny', ''])
+    assert_array_equal(a['t'], ['abc,de', ' 12 ', ''])
+    assert_array_equal(a['x'], [1.5, 25.0, -3.25])
+
+    os.remove(filename)
+
+
+def test10():
+    """Tests ISO 8601 datetimes with fractional seconds and datetime64 units."""
+    f = open(filename, 'w')
+    f.write('2011-01-02T00:30:00.25,1\n')
+    f.write('1969-12-31T23:59:59.5,2\n')
+    f.write(',3\n')
+    f.close()
+
+    dt = np.dtype([('t', 'M8[ms]'), ('k', np.int32)])
+    a = readrows(filename, dt, delimiter=',', datetime_fmt="%Y-%m-%dT%H:%M:%S")
+    assert_array_equal(a['t'].view(np.int64), [1293928200250, -500, 0])
+
+    dt = np.dtype([('t', 'M8[D]'), ('k', np.int32)])
+    a = readrows(filename, dt, delimiter=',', datetime_fmt="%Y-%m-%dT%H:%M:%S")
+    assert_array_equal(a['t'].view(np.int64), [14976, -1, 0])
+
+    dt = np.dtype([('t', 'M8[s]'), ('k', np.int32)])
+    a = readrows(filename, dt, delimiter=',', datetime_fmt="%Y-%m-%dT%H:%M:%S",
+                 tzoffset=3600)
+    assert_array_equal(a['t'].view(np.int64), [1293924600, -3601, 0])
+
+    os.remove(filename)
+
+
+def test11():
+    """Tests reading a file in chunks with TextReader."""
+    f = open(filename, 'w')
+    f.write('# header\n')
+    for k in range(10):
+        f.write('%d,%d.5,x%d\n' % (k, k, k))
+    f.close()
+
+    dt = np.dtype([('k', np.int32), ('x', np.float64), ('s', 'S3')])
+    a = readrows(filename, dt, delimiter=',')
+
+    chunks = list(TextReader(filename, dt, delimiter=',', chunksize=4))
+    assert_equal([len(c) for c in chunks], [4, 4, 2])
+    assert_array_equal(np.concatenate(chunks), a)
+
+    dt2 = np.dtype([('k', np.int32), ('x', np.float64)])
+    r = TextReader(filename, dt2, delimiter=',', usecols=(0, 1), chunksize=4, reuse=True)
+    ks = [c['k'].copy() for c in r]
+    assert_array_equal(np.concatenate(ks), np.arange(10))
+    assert_equal(r.num_allocations, 0)
+
+    out = np.zeros(6, dtype=dt)
+    r = TextReader(filename, dt, delimiter=',', skiprows=3)
+    b = r.read(out=out)
+    assert_array_equal(b, a[3:9])
+    b = r.read(out=out)
+    assert_array_equal(b, a[9:])
+    assert_equal(len(r.read()), 0)
+    r.close()
+
+    # A row larger than all the previous ones grows the memory that the
+    # rows are tokenized into.
+    f = open(filename, 'a')
+    f.write('10,10.5,"x""%s"\n' % ('y' * 10000))
+    f.close()
+    r = TextReader(filename, dt, delimiter=',', chunksize=4, reuse=True)
+    ss = [c['s'].copy() for c in r]
+    assert_array_equal(np.concatenate(ss)[-1], 'x"y')
+    assert_equal(r.num_allocations > 0, True)
+
+    os.remove(filename)
+
+
+def test12():
+    """Tests countrows and skiprows with quoted newlines and comments."""
+    nrows = 1000
+    f = open(filename, 'w')
+    f.write('# header\n')
+    for k in range(nrows):
+        if k % 10 == 0:
+            f.write('%d,"a\nb"\n' % k)
+        elif k % 10 == 5:
+            f.write('# comment\n%d,x\n' % k)
+        else:
+            f.write('%d,y\n' % k)
+    f.close()
+
+    f = open(filename, 'r')
+    assert_equal(countrows(f, delimiter=','), nrows)
+    f.close()
+
+    dt = np.dtype([('k', np.int32), ('s', 'S4')])
+    a = readrows(filename, dt, delimiter=',', skiprows=nrows - 11)
+    assert_array_equal(a['k'], np.arange(nrows - 11, nrows))
+    assert_equal(a['s'][1], 'a\nb')
+
+    os.remove(filename)
+
+
+def test13():
+    """Tests skiprows and countrows with a row index file."""
+    index_file = filename + '.idx'
+    nrows = 1000
+    f = open(filename, 'w')
+    for k in range(nrows):
+        if k % 10 == 0:
+            f.write('%d,"a\nb"\n' % k)
+        else:
+            f.write('%d,y\n' % k)
+    f.close()
+
+    assert_equal(build_index(filename, index_file, delimiter=',', step=64), nrows)
+
+    dt = np.dtype([('k', np.int32), ('s', 'S4')])
+    for skip in [0, 63, 64, 65, 555, nrows - 1]:
+        a = readrows(filename, dt, delimiter=',', skiprows=skip, index=index_file)
+        assert_array_equal(a['k'], np.arange(skip, nrows))
+    a = readrows(filename, dt, delimiter=',', skiprows=nrows + 5, index=index_file)
+    assert_equal(a.shape, (0,))
+
+    f = open(filename, 'r')
+    assert_equal(countrows(f, delimiter=',', index=index_file), nrows)
+    f.close()
+
+    # The index is not used after the file has changed.
+    f = open(filename, 'a')
+    f.write('%d,z\n' % nrows)
+    f.close()
+    f = open(filename, 'r')
+    assert_equal(countrows(f, delimiter=',', index=index_file), nrows + 1)
+    f.close()
+
+    # With the default delimiter.  The file is then changed without
+    # changing its size or modification time, so the count of the index
+    # (and not that of the rows) shows that the index was used.
+    f = open(filename, 'w')
+    for k in range(nrows):
+        f.write('%d y\n' % k)
+    f.close()
+    assert_equal(build_index(filename, index_file, step=64), nrows)
+    f = open(filename, 'r')
+    assert_equal(countrows(f, index=index_file), nrows)
+    f.close()
+    st = os.stat(filename)
+    f = open(filename, 'r+')
+    # Join the rows '1 y' and '2 y'.
+    f.seek(len('0 y\n1 y'))
+    f.write(' ')
+    f.close()
+    os.utime(filename, (st.st_atime, st.st_mtime))
+    f = open(filename, 'r')
+    assert_equal(countrows(f, index=index_file), nrows)
+    f.close()
+    f = open(filename, 'r')
+    assert_equal(countrows(f), nrows - 1)
+    f.close()
+
+    os.remove(index_file)
+    os.remove(filename)
+
+
+def test14():
+    """Tests rows with many fields and long quoted fields."""
+    ncols = 5000
+    nrows = 3
+    f = open(filename, 'w')
+    for k in range(nrows):
+        f.write(','.join(str(k * ncols + j) for j in range(ncols)) + '\n')
+    f.close()
+
+    dt = np.dtype([('f%d' % j, np.int32) for j in range(ncols)])
+    a = readrows(filename, dt, delimiter=',')
+    assert_equal(a.shape, (nrows,))
+    assert_equal(a['f0'][2], 2 * ncols)
+    assert_equal(a['f%d' % (ncols - 1)][1], 2 * ncols - 1)
+
+    # The doubled quotes make the tokenizer copy the field.
+    s = 'ab""c' * 3000
+    f = open(filename, 'w')
+    for k in range(nrows):
+        f.write('%d,"%s"\n' % (k, s))
+    f.close()
+
+    dt = np.dtype([('k', np.int32), ('s', 'S12000')])
+    a = readrows(filename, dt, delimiter=',')
+    assert_array_equal(a['k'], np.arange(nrows))
+    assert_equal(a['s'][2], 'ab"c' * 3000)
+
+    os.remove(filename)
+
+
+def test15():
+    """Tests usecols with quoted fields in the other fields."""
+    ncols = 300
+    nrows = 20
+    f = open(filename, 'w')
+    for k in range(nrows):
+        fields = [str(k * ncols + j) for j in range(ncols)]
+        fields[1] = '"x,\ny"'
+        fields[200] = '"a""b"'
+        if k % 3 == 0:
+            f.write('# comment\n')
+        f.write(','.join(fields) + '\n')
+    f.close()
+
+    dt = np.dtype([('a', np.int32), ('b', np.int32), ('c', np.int32)])
+    a = readrows(filename, dt, delimiter=',', usecols=(2, 150, -1))
+    assert_array_equal(a['a'], np.arange(nrows) * ncols + 2)
+    assert_array_equal(a['b'], np.arange(nrows) * ncols + 150)
+    assert_array_equal(a['c'], np.arange(nrows) * ncols + ncols - 1)
+
+    os.remove(filename)
+
+
+def test16():
+    """Tests the limits of the integer types."""
+    types = [np.int8, np.int16, np.int32, np.int64,
+             np.uint8, np.uint16, np.uint32, np.uint64]
+    dt = np.dtype([('f%d' % j, t) for j, t in enumerate(types)])
+    lo = [np.iinfo(t).min for t in types]
+    hi = [np.iinfo(t).max for t in types]
+    f = open(filename, 'w')
+    f.write(','.join(str(v) for v in lo) + '\n')
+    f.write(','.join(str(v) for v in hi) + '\n')
+    # Leading zeros and spaces.
+    f.write(','.join(' 000000000%d ' % v for v in hi) + '\n')
+    f.close()
+
+    a = readrows(filename, dt, delimiter=',')
+    for j in range(len(types)):
+        assert_equal(a['f%d' % j][0], lo[j])
+        assert_equal(a['f%d' % j][1], hi[j])
+        assert_equal(a['f%d' % j][2], hi[j])
+
+    os.remove(filename)
+
+
+def test17():
+    """Tests reading files in several threads at once."""
+    nrows = 20000
+    names = ['tmp%d.txt' % k for k in range(4)]
+    for k, name in enumerate(names):
+        f = open(name, 'w')
+        f.write('k,x\n')
+        for j in range(nrows):
+            f.write('%d,%.2f\n' % (j, k * j + 0.25))
+        f.close()
+
+    dt = np.dtype([('k', np.int32), ('x', float)])
+    results = {}
+
+    def read(k):
+        # The missing index file leaves errno set when the floats are read.
+        results[k] = readrows(names[k], dt, delimiter=',', skiprows=1,
+                              index='no_such_index')
+
+    def read_chunks(k):
+        chunks = TextReader(names[k], dt, delimiter=',', skiprows=1, chunksize=1000)
+        results[k + len(names)] = np.concatenate(list(chunks))
+
+    threads = [threading.Thread(target=read, args=(k,)) for k in range(len(names))]
+    threads += [threading.Thread(target=read_chunks, args=(k,)) for k in range(len(names))]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+
+    for k in range(2 * len(names)):
+        a = results[k]
+        assert_array_equal(a['k'], np.arange(nrows))
+        assert_array_equal(a['x'], (k % len(names)) * np.arange(nrows) + 0.25)
+
+    for name in names:
+        os.remove(name)
+
+
+def test18():
+    """Tests reading the columns into separate arrays."""
+    dt = np.dtype([('x', float), ('n', np.int16), ('s', 'S3')])
+    a = np.array([(1.5, 10, 'abc'), (-2.0, -3, 'd'), (0.25, 7, '')], dtype=dt)
+    f = open(filename, 'w')
+    f.write('x,n,s\n')
+    for row in a:
+        f.write('%r,%d,%s\n' % (row['x'], row['n'], row['s']))
+    f.close()
+
+    for numrows in [None, 2, 10]:
+        c = readrows(filename, dt, delimiter=',', skiprows=1, numrows=numrows,
+                     columnar=True)
+        n = len(a) if numrows is None else min(numrows, len(a))
+        assert_equal(sorted(c.keys()), sorted(dt.names))
+        for name in dt.names:
+            assert_equal(c[name].dtype, dt[name])
+            assert_equal(c[name].ndim, 1)
+            assert_array_equal(c[name], a[name][:n])
+
+    # A dtype that is not a structured array; the keys are the columns.
+    b = np.arange(12).reshape(4, 3)
+    np.savetxt(filename, b, delimiter=',', fmt='%d')
+    c = readrows(filename, np.int32, delimiter=',', usecols=[1, -1], columnar=True)
+    assert_equal(sorted(c.keys()), [-1, 1])
+    assert_array_equal(c[1], b[:, 1])
+    assert_array_equal(c[-1], b[:, 2])
+
+    os.remove(filename)
+
+
+def test19():
+    """Tests categorical string fields."""
+    dt = np.dtype([('sym', 'S4'), ('n', np.int32)])
+    syms = ['AAPL', 'MSFT', 'AAPL', 'IBM', 'MSFT', 'GOOG', 'AAPL', '']
+    f = open(filename, 'w')
+    for k, sym in enumerate(syms):
+        f.write('%s,%d\n' % (sym, k))
+    f.close()
+
+    a, cats = readrows(filename, dt, delimiter=',', categorical=['sym'])
+    assert_equal(a.dtype['sym'], np.int16)
+    assert_array_equal(a['sym'], [0, 1, 0, 2, 1, 3, 0, 4])
+    assert_array_equal(a['n'], np.arange(len(syms)))
+    assert_array_equal(cats['sym'], ['AAPL', 'MSFT', 'IBM', 'GOOG', ''])
+    assert_array_equal(cats['sym'][a['sym']], syms)
+
+    c, cats = readrows(filename, dt, delimiter=',', categorical=['sym'],
+                       max_categories=100, columnar=True)
+    assert_equal(c['sym'].dtype, np.int8)
+    assert_array_equal(cats['sym'][c['sym']], syms)
+
+    # Too many distinct strings: the field is read as strings.
+    a, cats = readrows(filename, dt, delimiter=',', categorical=['sym'],
+                       max_categories=3)
+    assert_equal(a.dtype, dt)
+    assert_array_equal(a['sym'], syms)
+    assert_equal(cats, {})
+    assert_raises(ValueError, readrows, filename, dt, delimiter=',',
+                  categorical=['sym'], max_categories=3, category_overflow='raise')
+    assert_raises(ValueError, readrows, filename, dt, delimiter=',',
+                  categorical=['n'])
+
+    os.remove(filename)
+
+
+def test20():
+    """Tests variable-length string fields."""
+    dt = np.dtype([('n', np.int32), ('text', 'S1')])
+    texts = ['short', 'a much longer string, with a comma', '', 'x' * 1000]
+    f = open(filename, 'w')
+    for k, text in enumerate(texts):
+        f.write('%d,"%s"\n' % (k, text))
+    f.close()
+
+    for columnar in [False, True]:
+        a, strings = readrows(filename, dt, delimiter=',', varstrings=['text'],
+                              columnar=columnar)
+        offsets, data = strings['text']
+        assert_equal(a['text'].dtype, np.int64)
+        assert_array_equal(a['n'], np.arange(len(texts)))
+        assert_array_equal(offsets[:-1], a['text'])
+        assert_equal(offsets[-1], sum(len(text) for text in texts))
+        assert_equal(data.dtype, np.uint8)
+        for k, text in enumerate(texts):
+            assert_equal(data[offsets[k]:offsets[k + 1]].tostring(), text)
+
+    a, strings = readrows(filename, dt, delimiter=',', varstrings=['text'], numrows=2)
+    offsets, data = strings['text']
+    assert_equal(len(offsets), 3)
+    assert_equal(data.tostring(), texts[0] + texts[1])
+
+    os.remove(filename)
+
+
+def test21():
+    """Tests the inferred dtype, with fields promoted after the sample."""
+    f = open(filename, 'w')
+    f.write('1,1.5,x,2012-01-01,1\n')
+    f.write('2,2,yy,2012-01-02,2\n')
+    f.write('3,,zzz,2012-01-03,3\n')
+    f.write('70000,4e3,a longer string,2012-01-04,abc\n')
+    f.close()
+
+    for columnar in [False, True]:
+        a = readrows(filename, delimiter=',', datetime_fmt='%Y-%m-%d',
+                     sample_rows=2, columnar=columnar)
+        assert_equal(a['f0'].dtype, np.int32)
+        assert_equal(a['f1'].dtype, np.float64)
+        assert_equal(a['f2'].dtype.kind, 'S')
+        assert_equal(a['f3'].dtype, np.dtype('M8[D]'))
+        assert_equal(a['f4'].dtype.kind, 'S')
+        assert_array_equal(a['f0'], [1, 2, 3, 70000])
+        assert_array_equal(a['f1'], [1.5, 2.0, np.nan, 4000.0])
+        assert_array_equal(a['f2'], ['x', 'yy', 'zzz', 'a longer string'])
+        assert_array_equal(a['f3'], np.arange('2012-01-01', '2012-01-05', dtype='M8[D]'))
+        assert_array_equal(a['f4'], ['1', '2', '3', 'abc'])
+
+    a = readrows(filename, delimiter=',', usecols=[4, 0], sample_rows=2)
+    assert_equal(a.dtype.names, ('f4', 'f0'))
+    assert_array_equal(a['f0'], [1, 2, 3, 70000])
+    assert_array_equal(a['f4'], ['1', '2', '3', 'abc'])
+
+    a = readrows(filename, delimiter=',', numrows=2)
+    assert_equal(a.dtype, np.dtype([('f0', 'i4'), ('f1', 'f8'), ('f2', 'S15'),
+                                    ('f3', 'S10'), ('f4', 'S4')]))
+    assert_array_equal(a['f4'], ['1', '2'])
+
+    os.remove(filename)
+
+
+def test22():
+    """Tests masked arrays of the missing values."""
+    dt = np.dtype([('n', np.int32), ('x', np.float64), ('s', 'S4')])
+    f = open(filename, 'w')
+    f.write('1,1.5,a\n')
+    f.write(',NA,\n')
+    f.write('0,0,NA\n')
+    f.write('null,3,bb\n')
+    f.close()
+
+    a = readrows(filename, dt, delimiter=',', na_values=['NA', 'null'])
+    assert_equal(a.dtype, dt)
+    assert_array_equal(a['n'].data, [1, 0, 0, 0])
+    assert_array_equal(a['n'].mask, [False, True, False, True])
+    assert_array_equal(a['x'].mask, [False, True, False, False])
+    assert_array_equal(a['s'].mask, [False, True, True, False])
+    assert_array_equal(a['s'].data, ['a', '', '', 'bb'])
+
+    for columnar in [False, True]:
+        a = readrows(filename, dt, delimiter=',', masked=['n'], na_values=['null'],
+                     columnar=columnar)
+        assert_array_equal(a['n'].mask, [False, True, False, True])
+        assert_equal(np.ma.getmask(a['s']).any(), False)
+
+    # Only the empty fields are missing without na_values.
+    a = readrows(filename, dt, delimiter=',', masked=True)
+    assert_array_equal(a['s'].mask, [False, True, False, False])
+    assert_array_equal(a['s'].data, ['a', '', 'NA', 'bb'])
+
+    # The NA tokens don't change the inferred dtype.
+    a = readrows(filename, delimiter=',', na_values=['NA', 'null'])
+    assert_equal(a.dtype, np.dtype([('f0', 'i1'), ('f1', 'f8'), ('f2', 'S2')]))
+    assert_array_equal(a['f0'].mask, [False, True, False, True])
+
+    assert_raises(ValueError, readrows, filename, dt, delimiter=',', masked=['m'])
+
+    os.remove(filename)
+
+
+def test23():
+    """Tests the error log of the bad rows."""
+    dt = np.dtype([('n', np.int32), ('x', np.float64), ('s', 'S2')])
+    f = open(filename, 'w')
+    f.write('1,1.5,a\n')
+    f.write('2,bad,b\n')
+    f.write('3,3.5\n')
+    f.write('4x,4.5,d\n')
+    f.write('5,5.5,e\n')
+    f.close()
+
+    # Without on_error, the read stops at the row with two fields.
+    a = readrows(filename, dt, delimiter=',')
+    assert_equal(len(a), 2)
+
+    a, errors = readrows(filename, dt, delimiter=',', on_error='skip')
+    assert_array_equal(a['n'], [1, 5])
+    assert_equal(errors['count'], 3)
+    assert_equal(errors['skipped'], 3)
+    records = errors['records']
+    assert_array_equal(records['row'], [1, 2, 3])
+    assert_array_equal(records['column'], [1, -1, 0])
+    assert_array_equal(records['line'], [2, 3, 4])
+    assert_array_equal(records['offset'], [8, 16, 22])
+
+    for columnar in [False, True]:
+        a, errors = readrows(filename, dt, delimiter=',', on_error='record',
+                             columnar=columnar, num_threads=0)
+        assert_array_equal(a['n'], [1, 2, 0, 5])
+        assert_equal(np.isnan(a['x'][1]), True)
+        assert_equal(errors['skipped'], 1)
+
+    # Only the last max_errors errors are kept.
+    a, errors = readrows(filename, dt, delimiter=',', on_error='record', max_errors=2)
+    assert_equal(errors['count'], 3)
+    assert_array_equal(errors['records']['row'], [2, 3])
+
+    assert_raises(ValueError, readrows, filename, dt, delimiter=',', on_error='raise')
+    assert_raises(ValueError, readrows, filename, dt, delimiter=',', on_error='ignore')
+
+    os.remove(filename)
+
+
+def test24():
+    """Tests the converters, called for a block of rows at a time."""
+    dt = np.dtype([('n', np.int32), ('x', np.float64), ('s', 'S3')])
+    f = open(filename, 'w')
+    f.write('1,0x10,ab\n')
+    f.write('2,0x1f,cd\n')
+    f.write('3,,ef\n')
+    f.close()
+
+    calls = []
+
+    def hex_float(data, offsets):
+        calls.append(len(offsets) - 1)
+        text = data.tostring()
+        return [float(int(text[offsets[k]:offsets[k+1]] or '0', 16))
+                for k in range(len(offsets) - 1)]
+
+    def upper(data, offsets):
+        return [data[offsets[k]:offsets[k+1]].tostring().upper()
+                for k in range(len(offsets) - 1)]
+
+    for columnar in [False, True]:
+        del calls[:]
+        a = readrows(filename, dt, delimiter=',', columnar=columnar,
+                     converters={'x': hex_float, 's': upper})
+        assert_array_equal(a['n'], [1, 2, 3])
+        assert_array_equal(a['x'], [16.0, 31.0, 0.0])
+        assert_array_equal(a['s'], ['AB', 'CD', 'EF'])
+        assert_equal(calls, [3])
+
+    # The empty field is given to the converter, and masked.
+    a = readrows(filename, dt, delimiter=',', masked=['x'], converters={'x': hex_float})
+    assert_array_equal(a['x'].mask, [False, False, True])
+
+    def fail(data, offsets):
+        raise KeyError('fail')
+
+    assert_raises(KeyError, readrows, filename, dt, delimiter=',', converters={'x': fail})
+    assert_raises(ValueError, readrows, filename, dt, delimiter=',',
+                  converters={'x': lambda data, offsets: [1.0]})
+    assert_raises(ValueError, readrows, filename, dt, delimiter=',',
+                  converters={'y': hex_float})
+
+    os.remove(filename)
+
+
+def test25():
+    """Tests the filters, which select the rows before they are converted."""
+    dt = np.dtype([('n', np.int32), ('sym', 'S4'), ('x', np.float64),
+                   ('t', 'M8[s]')])
+    f = open(filename, 'w')
+    f.write('1,AAPL,10.5,2020-01-01 10:00:00\n')
+    f.write('2,MSFT,20.0,2020-01-02 10:00:00\n')
+    f.write('3,AAPL,30.25,2020-01-03 10:00:00\n')
+    f.write('4,GOOG,,2020-01-04 10:00:00\n')
+    f.write('5,"AAPL",15,2020-01-05 10:00:00\n')
+    f.write('6,MSFT,x,2020-01-06 10:00:00\n')
+    f.close()
+
+    for columnar in [False, True]:
+        a = readrows(filename, dt, delimiter=',', columnar=columnar,
+                     filters={'sym': 'AAPL'})
+        assert_array_equal(a['n'], [1, 3, 5])
+        a = readrows(filename, dt, delimiter=',', columnar=columnar,
+                     filters={'sym': ['MSFT', 'GOOG'], 'x': (None, 25)})
+        assert_array_equal(a['n'], [2])
+
+    # The bad value of row 6 is not converted.
+    a, errors = readrows(filename, dt, delimiter=',', on_error='record',
+                         filters={'x': (12, 100)})
+    assert_array_equal(a['n'], [2, 3, 5])
+    assert_equal(errors['count'], 0)
+
+    # A datetime range, on a column that is not read.
+    t0 = np.datetime64('2020-01-02T00:00:00')
+    t1 = np.datetime64('2020-01-04')
+    a = readrows(filename, [('n', np.int32)], delimiter=',', usecols=[0],
+                 filters={3: (t0, t1)})
+    assert_array_equal(a['n'], [2, 3])
+    a = readrows(filename, [('n', np.int32)], delimiter=',', usecols=[0],
+                 filters={-1: (t0, None), 1: set(['AAPL'])}, numrows=1)
+    assert_array_equal(a['n'], [3])
+
+    assert_raises(ValueError, readrows, filename, dt, delimiter=',', filters={9: 'AAPL'})
+    assert_raises(ValueError, readrows, filename, dt, delimiter=',', filters={'y': 'AAPL'})
+
+    os.remove(filename)
+
+
+def test26():
+    """Tests the rounding of floating point values."""
+    doubles = [
+        # Halfway between two doubles: rounded to even.
+        ('9007199254740993', 2.0**53),
+        ('9007199254740995', 2.0**53 + 4),
+        # More than 19 digits.
+        ('9007199254740993.00000000000000000000000', 2.0**53),
+        ('9007199254740993.0000000000000000000000000000001', 2.0**53 + 2),
+        ('0.1000000000000000055511151231257827021181583404541015625', 0.1),
+        # Subnormals, and underflow to 0.
+        ('4.9406564584124654e-324', 2.0**-1074),
+        ('2.4703282292062328e-324', 2.0**-1074),
+        ('2.4703282292062327e-324', 0.0),
+        ('2.2250738585072011e-308', 2.0**-1022 - 2.0**-1074),
+        ('1e-400', 0.0),
+        ('1.7976931348623157e308', np.finfo(np.float64).max),
+    ]
+    floats = [
+        # Rounded to a double first, this would be halfway, and 1.0.
+        ('1.00000005960464477539062501', 1 + 2.0**-23),
+        ('1.000000059604644775390625', 1.0),
+        ('1.4e-45', 2.0**-149),
+        ('1e-46', 0.0),
+        ('3.4028235e38', np.finfo(np.float32).max),
+    ]
+    for values, t in [(doubles, np.float64), (floats, np.float32)]:
+        f = open(filename, 'w')
+        for s, x in values:
+            f.write(s + '\n')
+        f.close()
+        a = readrows(filename, [('x', t)])
+        assert_array_equal(a['x'], np.array([x for s, x in values], dtype=t))
+
+    # Overflow is a bad value.
+    dt = np.dtype([('x', np.float64), ('y', np.float32)])
+    f = open(filename, 'w')
+    f.write('1.5,2.5\n')
+    f.write('1e309,1\n')
+    f.write('1,3.5e38\n')
+    f.write('-1.7976931348623159e308,1\n')
+    f.close()
+    a, errors = readrows(filename, dt, delimiter=',', on_error='record')
+    assert_array_equal(a['x'][[0, 2]], [1.5, 1])
+    assert_equal(np.isnan(a['x'][[1, 3]]).all(), True)
+    assert_equal(np.isnan(a['y'][2]), True)
+    assert_array_equal(errors['records']['row'], [1, 2, 3])
+    assert_array_equal(errors['records']['column'], [0, 1, 0])
+
+    f = open(filename, 'w')
+    f.write('1,5D3;-2,5d-1\n')
+    f.close()
+    a = readrows(filename, dt, delimiter=';', decimal=',', sci='D')
+    assert_array_equal(a['x'], [1500.0])
+    assert_array_equal(a['y'], [-0.25])
+
+    os.remove(filename)
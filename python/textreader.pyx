@@ -1,18 +1,121 @@
 
-import time
+import re
+import sys
 import numpy
 cimport numpy
 
+numpy.import_array()
+
 cdef extern from "Python.h":
     ctypedef struct FILE
     FILE* PyFile_AsFile(object)
+    void Py_INCREF(object)
+
+cdef extern from "stdlib.h":
+    void free(void *ptr)
+
+cdef extern from "string.h":
+    void *memcpy(void *dest, void *src, size_t n)
+
+cdef extern from "stdint.h":
+    ctypedef long long int64_t
+
+cdef extern from "numpy/arrayobject.h":
+    object PyArray_NewFromDescr(object subtype, numpy.dtype descr, int nd,
+                                numpy.npy_intp *dims, numpy.npy_intp *strides,
+                                void *data, int flags, object obj)
+    enum:
+        NPY_DEFAULT
 
 # Enter the builtin file class into the namespace:
 cdef extern from "fileobject.h":
     ctypedef class __builtin__.file [object PyFileObject]:
         pass
+    # Between these calls, f.close() raises an IOError instead of closing
+    # the FILE that the C code is reading with the GIL released.
+    void PyFile_IncUseCount(file f)
+    void PyFile_DecUseCount(file f)
+
+cdef extern from "error_types.h":
+    enum:
+        ERROR_OUT_OF_MEMORY
+        ERROR_CHANGED_NUMBER_OF_FIELDS
+        ERROR_BATCH_FAILED
+        ERROR_INVALID_FILTER_COLUMN
+        ERROR_NO_DATA
+        ERROR_INVALID_INTEGER
+        ERROR_INTEGER_OVERFLOW
+        ERROR_INVALID_FLOAT
+        ERROR_INVALID_COMPLEX
+        ERROR_INVALID_DATETIME
+        ERROR_TOO_MANY_CATEGORIES
+
+cdef extern from "categories.h" nogil:
+    ctypedef struct categories:
+        int width
+        int count
+        int overflow
+    categories *new_categories(int width, int max_count)
+    char *category_string(categories *c, int code, int *p_length)
+    void del_categories(categories *c)
+
+cdef extern from "arena.h" nogil:
+    ctypedef struct string_arena:
+        long long used
+    string_arena *new_string_arena(long long size)
+    char *release_string_arena(string_arena *a)
+    void del_string_arena(string_arena *a)
+
+cdef extern from "validity.h" nogil:
+    ctypedef struct na_set:
+        int count
+    ctypedef struct validity:
+        long long null_count
+    na_set *new_na_set(char **tokens, int count)
+    void del_na_set(na_set *s)
+    validity *new_validity(na_set *na, long long first_row)
+    unsigned char *release_validity(validity *v, long long num_rows)
+    void del_validity(validity *v)
+
+cdef extern from "batch.h" nogil:
+    ctypedef int (*batch_func)(void *context, int64_t first_row, int count,
+                               char *chars, int64_t *offsets,
+                               char *dst, int stride)
+    ctypedef struct field_batch:
+        int count
+    field_batch *new_field_batch(batch_func func, void *context, int capacity)
+    void del_field_batch(field_batch *b)
 
-cdef extern from "rows.h":
+cdef extern from "row_filter.h" nogil:
+    ctypedef struct row_filter:
+        int num_terms
+    row_filter *new_row_filter()
+    int filter_in(row_filter *f, int column, char **values, int *lengths, int count)
+    int filter_range(row_filter *f, int column, double low, double high)
+    int filter_int_range(row_filter *f, int column, char typechar,
+                         int64_t low, int64_t high)
+    void del_row_filter(row_filter *f)
+
+cdef extern from "error_log.h" nogil:
+    enum:
+        ERROR_POLICY_RAISE
+        ERROR_POLICY_SKIP
+        ERROR_POLICY_RECORD
+    ctypedef struct error_entry:
+        long long row
+        long long offset
+        int column
+        int line
+        int code
+    ctypedef struct error_log:
+        long long count
+        long long num_skipped
+    error_log *new_error_log(int policy, int capacity)
+    int num_logged(error_log *log)
+    error_entry *logged_error(error_log *log, int k)
+    void del_error_log(error_log *log)
+
+cdef extern from "rows.h" nogil:
     int count_rows(FILE *f, char delimiter, char quote, char comment,
                    int allow_embedded_newline)
     int count_fields(FILE *f, char delimiter, char quote, char comment,
@@ -24,19 +127,105 @@ cdef extern from "rows.h":
                     char *datetime_fmt,
                     int tz_offset,
                     void *usecols, int num_usecols,
-                    int skiprows,
-                    void *data_array,
+                    int skiprows, int num_threads, int buffer_size,
+                    char *index_path, categories **cats,
+                    string_arena **arenas, validity **masks,
+                    field_batch **batches, error_log *errors,
+                    row_filter *filter, void *data_array, char **p_fmt,
+                    int *p_error_type, int *p_error_lineno)
+    char **read_columns(FILE *f, int *nrows, char *fmt,
+                        char delimiter, char quote, char comment,
+                        char sci, char decimal,
+                        int allow_embedded_newline,
+                        char *datetime_fmt,
+                        int tz_offset,
+                        void *usecols, int num_usecols,
+                        int skiprows, int num_threads, int buffer_size,
+                        char *index_path, categories **cats,
+                        string_arena **arenas, validity **masks,
+                        field_batch **batches, error_log *errors,
+                        row_filter *filter, char **columns, char **p_fmt,
+                        int *p_error_type, int *p_error_lineno)
+
+cdef extern from "infer.h" nogil:
+    char *infer_format(FILE *f, char delimiter, char quote, char comment,
+                       char sci, char decimal,
+                       int allow_embedded_newline,
+                       char *datetime_fmt,
+                       int tz_offset,
+                       int skiprows, int sample_rows, na_set *na,
+                       int *p_error_type)
+
+cdef extern from "file_buffer.h" nogil:
+    enum:
+        RESTORE_NOT
+        RESTORE_FINAL
+    double read_wait_time(void *fb)
+
+cdef extern from "reader.h" nogil:
+    ctypedef struct reader:
+        void *fb
+        int row_size
+        int num_allocations
+    reader *new_reader(FILE *f, char *fmt,
+                       char delimiter, char quote, char comment,
+                       char sci, char decimal,
+                       int allow_embedded_newline,
+                       char *datetime_fmt,
+                       int tz_offset,
+                       void *usecols, int num_usecols,
+                       int skiprows, int buffer_size, char *index_path,
+                       categories **cats, string_arena **arenas, validity **masks,
+                       field_batch **batches, row_filter *filter,
+                       int *p_error_type, int *p_error_lineno)
+    int reader_read(reader *r, int max_rows, int can_grow,
+                    char **p_data, int row_count, int *p_row_capacity,
                     int *p_error_type, int *p_error_lineno)
+    void del_reader(reader *r, int restore)
+
+cdef extern from "row_index.h" nogil:
+    ctypedef struct row_index:
+        long long num_rows
+    int build_row_index(FILE *f, char *path,
+                        char delimiter, char quote, char comment, int step)
+    row_index *load_row_index(char *path, FILE *f,
+                              char delimiter, char quote, char comment)
+    void del_row_index(row_index *ri)
 
 
 def countrows(file f, delimiter=None, quote='"', comment='#',
-                    allow_embedded_newline=True):
+                    allow_embedded_newline=True, index=None):
+    """
+    Count the rows of f from its current position.  If `index` is the
+    name of a row index file made by build_index() for f (with the same
+    delimiter, quote and comment), and f is at the start of the file,
+    the count is taken from the index.
+    """
     cdef int count
+    cdef row_index *ri
+    cdef FILE *fp = PyFile_AsFile(f)
+    cdef char c_delimiter, c_index_delimiter, c_quote, c_comment
+    cdef int c_allow_embedded_newline = allow_embedded_newline
+    # The delimiter of an index built by build_index() with the default
+    # delimiter is '\x00'.
+    c_index_delimiter = 0 if delimiter is None else ord(delimiter[0])
     if delimiter is None:
         delimiter = ' '
+    c_delimiter = ord(delimiter[0])
+    c_quote = ord(quote[0])
+    c_comment = ord(comment[0])
 
-    count = count_rows(PyFile_AsFile(f), ord(delimiter[0]), ord(quote[0]), ord(comment[0]),
-                       allow_embedded_newline)
+    if index is not None and f.tell() == 0:
+        ri = load_row_index(index, fp, c_index_delimiter, c_quote, c_comment)
+        if ri != NULL:
+            count = ri.num_rows
+            del_row_index(ri)
+            return count
+
+    PyFile_IncUseCount(f)
+    with nogil:
+        count = count_rows(fp, c_delimiter, c_quote, c_comment, c_allow_embedded_newline)
+    PyFile_DecUseCount(f)
     return count
 
 
@@ -51,14 +240,511 @@ def countfields(file f, delimiter=None, quote='"', comment='#',
     return count
 
 
+def build_index(f, index, delimiter=None, quote='"', comment='#', step=10000):
+    """
+    build_index(f, index, delimiter=None, quote='"', comment='#', step=10000)
+
+    Find the start of every `step`-th row of the file f (a file or the
+    name of a file), and save them in the row index file `index`.  The
+    index also holds the number of rows, and the size and modification
+    time of f.  Pass the name of the index file as the `index` argument
+    of readrows(), TextReader or countrows() to go directly to the row
+    given by `skiprows`, or to get the number of rows, without reading
+    the rows before it.  If f has changed since the index was built, the
+    index is not used.
+
+    `delimiter`, `quote` and `comment` must be the same as those used to
+    read the file.  This needs the memory mapped file buffer.
+
+    Returns the number of rows in the file.
+    """
+    cdef int count
+    cdef int opened_here = False
+    cdef file pyfile
+    cdef FILE *fp
+    cdef char *c_index = index
+    cdef char c_delimiter, c_quote, c_comment
+    cdef int c_step = step
+
+    if delimiter is None:
+        delimiter = '\x00'
+    c_delimiter = ord(delimiter[0])
+    c_quote = ord(quote[0])
+    c_comment = ord(comment[0])
+
+    if isinstance(f, basestring):
+        opened_here = True
+        f = open(f, 'r')
+    pyfile = f
+    fp = PyFile_AsFile(pyfile)
+
+    PyFile_IncUseCount(pyfile)
+    with nogil:
+        count = build_row_index(fp, c_index, c_delimiter, c_quote, c_comment, c_step)
+    PyFile_DecUseCount(pyfile)
+    if opened_here:
+        f.close()
+    if count < 0:
+        raise RuntimeError("The row index could not be built.")
+    return count
+
+
+cdef class _DataOwner:
+    """
+    Owns the memory allocated by read_rows() when it is called with
+    data_array=NULL.  An instance is used as the base of the array that
+    wraps that memory, so the memory is freed when the array is deleted.
+    """
+    cdef void *data
+
+    def __dealloc__(self):
+        free(self.data)
+
+
+cdef _array_from_data(void *data, numpy.npy_intp nrows, dtype, int num_fields, int simple_dtype):
+    cdef numpy.ndarray a
+    cdef numpy.npy_intp dims[2]
+    cdef _DataOwner owner
+    cdef int nd
+
+    owner = _DataOwner()
+    owner.data = data
+    dims[0] = nrows
+    dims[1] = num_fields
+    if simple_dtype:
+        nd = 2
+    else:
+        nd = 1
+    # PyArray_NewFromDescr steals a reference to dtype.
+    Py_INCREF(dtype)
+    a = PyArray_NewFromDescr(numpy.ndarray, dtype, nd, dims, NULL,
+                             data, NPY_DEFAULT, None)
+    numpy.set_array_base(a, owner)
+    return a
+
+
+def _column_dtypes(dtype, simple_dtype, usecols_array):
+    """
+    Returns (names, dtypes) of the columns that readrows() returns when
+    columnar is True.
+    """
+    if simple_dtype:
+        return [int(k) for k in usecols_array], [dtype] * usecols_array.size
+    for name in dtype.names:
+        if dtype[name].names is not None or dtype[name].subdtype is not None:
+            raise ValueError("With columnar=True, the fields of the dtype must not "
+                             "be arrays or structures (field '%s')." % (name,))
+    return list(dtype.names), [dtype[name] for name in dtype.names]
+
+
+cdef _columns_dict(names, dtypes, arrays, numpy.ndarray column_ptrs, int nrows):
+    """
+    Returns the dict of the columns read by read_columns().  If arrays is
+    None, the columns (in column_ptrs) were allocated by read_columns().
+    """
+    cdef char **columns = <char **> column_ptrs.data
+    cdef int j
+
+    result = {}
+    for j in range(len(names)):
+        if arrays is not None:
+            result[names[j]] = arrays[j][:nrows]
+        elif nrows == 0:
+            free(columns[j])
+            result[names[j]] = numpy.empty((0,), dtype=dtypes[j])
+        else:
+            result[names[j]] = _array_from_data(columns[j], nrows, dtypes[j], 1, False)
+    return result
+
+
+def _string_fields_format(dtype, categorical, varstrings, max_categories):
+    """
+    Returns (dtype, fmt, category_fields, varstring_fields) for reading
+    the fields named in `categorical` as categorical ('k') fields, and
+    the fields named in `varstrings` as variable-length string ('v')
+    fields.  The returned dtype is dtype with those fields replaced by
+    their codes or offsets, and category_fields and varstring_fields map
+    each of the names to the index of its field in fmt.
+    """
+    if dtype.names is None:
+        raise ValueError("categorical and varstrings require a structured dtype.")
+    if max_categories < 1:
+        raise ValueError("max_categories must be at least 1.")
+    elif max_categories <= 127:
+        code_dtype = numpy.dtype(numpy.int8)
+    elif max_categories <= 32767:
+        code_dtype = numpy.dtype(numpy.int16)
+    elif max_categories <= 2147483647:
+        code_dtype = numpy.dtype(numpy.int32)
+    else:
+        raise ValueError("max_categories must be at most 2147483647.")
+    for name in list(categorical) + list(varstrings):
+        if name not in dtype.names or dtype[name].kind != 'S':
+            raise ValueError("Field '%s' is not a string field of the dtype." % (name,))
+        if name in categorical and name in varstrings:
+            raise ValueError("Field '%s' can't be both categorical and in varstrings." %
+                             (name,))
+
+    fmt = ''
+    category_fields = {}
+    varstring_fields = {}
+    descr = []
+    k = 0
+    for name in dtype.names:
+        if name in categorical:
+            category_fields[name] = k
+            fmt += '%dk' % (code_dtype.itemsize,)
+            descr.append((name, code_dtype))
+            k += 1
+        elif name in varstrings:
+            varstring_fields[name] = k
+            fmt += 'v'
+            descr.append((name, numpy.int64))
+            k += 1
+        else:
+            field_fmt = flatten_dtype(dtype[name])
+            fmt += field_fmt
+            descr.append((name, dtype[name]))
+            k += sum(c not in "0123456789" for c in field_fmt)
+    return numpy.dtype(descr), fmt, category_fields, varstring_fields
+
+
+cdef _category_strings(categories *c):
+    """
+    Returns the strings of the codes of c in an array, so that the
+    string of code k is element k.
+    """
+    cdef numpy.ndarray a
+    cdef char *data
+    cdef char *s
+    cdef int k, length
+    cdef int width = max(c.width, 1)
+
+    a = numpy.zeros((c.count,), dtype='S%d' % (width,))
+    data = a.data
+    for k in range(c.count):
+        s = category_string(c, k, &length)
+        memcpy(data + k * width, s, length)
+    return a
+
+
+cdef _del_string_fields(categories **c_cats, string_arena **c_arenas, int n):
+    cdef int j
+
+    for j in range(n):
+        del_categories(c_cats[j])
+        del_string_arena(c_arenas[j])
+
+
+cdef _del_masks(validity **c_masks, na_set *c_na, int n):
+    cdef int j
+
+    if c_masks != NULL:
+        for j in range(n):
+            del_validity(c_masks[j])
+    del_na_set(c_na)
+
+
+def _masked_fields(dtype, simple_dtype, usecols_array, masked):
+    """
+    Returns a dict that maps the fields to mask to the indices of their
+    fields in the format: the names in `masked` (all the fields that are
+    not arrays or structures, if `masked` is True), or the column indices
+    in usecols if dtype is not a structured array.
+    """
+    if simple_dtype:
+        if masked is not True:
+            raise ValueError("masked must be True or False if the dtype is not "
+                             "a structured array.")
+        return dict([(int(k), j) for j, k in enumerate(usecols_array)])
+    if masked is True:
+        names = [name for name in dtype.names
+                 if dtype[name].names is None and dtype[name].subdtype is None]
+    else:
+        names = list(masked)
+    return _field_indices(dtype, names, 'masked')
+
+
+def _field_indices(dtype, names, what):
+    """
+    Returns a dict that maps the names (of fields of the structured dtype
+    that are not arrays or structures) to the indices of their fields in
+    the format.  `what` says what the fields are for, in the error
+    messages.
+    """
+    for name in names:
+        if name not in dtype.names:
+            raise ValueError("Field '%s' is not a field of the dtype." % (name,))
+    fields = {}
+    k = 0
+    for name in dtype.names:
+        n = sum(c not in "0123456789" for c in flatten_dtype(dtype[name]))
+        if name in names:
+            if n != 1:
+                raise ValueError("Field '%s' can't be %s: it is an array or a "
+                                 "structure." % (name, what))
+            fields[name] = k
+        k += n
+    return fields
+
+
+cdef na_set *_new_na_set(na_values):
+    """
+    Returns a new set of the NA tokens in na_values, or NULL if out of
+    memory.
+    """
+    cdef numpy.ndarray token_ptrs
+    cdef char **c_tokens
+    cdef int j
+
+    tokens = [str(token) for token in na_values]
+    token_ptrs = numpy.zeros(max(len(tokens), 1), dtype=numpy.intp)
+    c_tokens = <char **> token_ptrs.data
+    for j in range(len(tokens)):
+        c_tokens[j] = tokens[j]
+    return new_na_set(c_tokens, len(tokens))
+
+
+def _unpack_mask(bits, nrows):
+    """
+    Returns the boolean mask (True where the value is missing) of the
+    first nrows rows of a validity bitmap (see validity.h).
+    """
+    mask = ((bits[:, numpy.newaxis] >> numpy.arange(8, dtype=numpy.uint8)) & 1) == 0
+    return mask.ravel()[:nrows]
+
+
+def _masked_result(out, bitmaps, mask_fields, simple_dtype, columnar):
+    """
+    Returns out (the array or dict of readrows()) with the fields in
+    mask_fields as masked arrays.  bitmaps maps the fields that have
+    missing values to their validity bitmaps.
+    """
+    if columnar:
+        for key in mask_fields:
+            if key in bitmaps:
+                mask = _unpack_mask(bitmaps[key], len(out[key]))
+            else:
+                mask = numpy.ma.nomask
+            out[key] = numpy.ma.masked_array(out[key], mask=mask)
+        return out
+    if len(bitmaps) == 0:
+        return numpy.ma.masked_array(out)
+    if simple_dtype:
+        mask = numpy.zeros(out.shape, dtype=bool)
+        for key, j in mask_fields.items():
+            if key in bitmaps:
+                mask[:, j] = _unpack_mask(bitmaps[key], len(out))
+    else:
+        mask = numpy.zeros(out.shape, dtype=numpy.ma.make_mask_descr(out.dtype))
+        for key in bitmaps:
+            mask[key] = _unpack_mask(bitmaps[key], len(out))
+    return numpy.ma.masked_array(out, mask=mask)
+
+
+_error_policies = {'raise': ERROR_POLICY_RAISE,
+                   'skip': ERROR_POLICY_SKIP,
+                   'record': ERROR_POLICY_RECORD}
+
+_error_dtype = numpy.dtype([('row', numpy.int64), ('column', numpy.int32),
+                            ('line', numpy.int32), ('offset', numpy.int64),
+                            ('code', numpy.int32)])
+
+_error_descriptions = {
+    ERROR_OUT_OF_MEMORY: "out of memory",
+    ERROR_CHANGED_NUMBER_OF_FIELDS: "wrong number of fields",
+    ERROR_INVALID_INTEGER: "invalid integer",
+    ERROR_INTEGER_OVERFLOW: "integer overflow",
+    ERROR_INVALID_FLOAT: "invalid float",
+    ERROR_INVALID_COMPLEX: "invalid complex number",
+    ERROR_INVALID_DATETIME: "invalid datetime",
+    ERROR_TOO_MANY_CATEGORIES: "too many categories",
+}
+
+
+cdef _error_records(error_log *log):
+    """
+    Returns the errors kept in log, from the oldest to the most recent,
+    in an array of _error_dtype.
+    """
+    cdef error_entry *e
+    cdef int k
+
+    records = numpy.empty((num_logged(log),), dtype=_error_dtype)
+    for k in range(records.size):
+        e = logged_error(log, k)
+        records[k] = (e.row, e.column, e.line, e.offset, e.code)
+    return records
+
+
+def _error_message(record):
+    """
+    Returns the message of the ValueError raised by readrows() with
+    on_error='raise' for an error record.
+    """
+    row, column, line, offset, code = record
+    what = _error_descriptions.get(code, "error type %d" % (code,))
+    if column >= 0:
+        what += " in column %d" % (column,)
+    return "Bad row %d (line %d, byte offset %d): %s." % (row, line, offset, what)
+
+
+# The number of values given to a converter at a time.
+_CONVERTER_BLOCK_SIZE = 65536
+
+
+cdef class _BatchConverter:
+    """
+    The context of the batch function of a field with a converter: the
+    function, the dtype of the field, and the exception raised by the
+    function (if any).
+    """
+    cdef object name
+    cdef object func
+    cdef object dtype
+    cdef public object error
+
+    def __init__(self, name, func, dtype):
+        self.name = name
+        self.func = func
+        self.dtype = dtype
+        self.error = None
+
+
+cdef int _convert_batch(void *context, int64_t first_row, int count,
+                        char *chars, int64_t *offsets,
+                        char *dst, int stride) with gil:
+    """
+    The batch function (see batch.h) of the fields with a converter: the
+    text of the values is given to the converter as a uint8 array and an
+    int64 array of count + 1 offsets, and the count values it returns are
+    copied into the rows.  Returns -1 if the converter fails.
+    """
+    cdef _BatchConverter conv = <_BatchConverter> context
+    cdef numpy.ndarray data, offs, values
+    cdef int k, itemsize
+
+    try:
+        data = numpy.empty((offsets[count],), dtype=numpy.uint8)
+        memcpy(data.data, chars, offsets[count])
+        offs = numpy.empty((count + 1,), dtype=numpy.int64)
+        memcpy(offs.data, offsets, (count + 1) * sizeof(int64_t))
+        values = numpy.ascontiguousarray(conv.func(data, offs), dtype=conv.dtype)
+        if values.ndim != 1 or values.shape[0] != count:
+            raise ValueError("The converter of field '%s' returned %d values for %d rows." %
+                             (conv.name, values.size, count))
+        itemsize = values.itemsize
+        for k in range(count):
+            memcpy(dst + k * stride, values.data + k * itemsize, itemsize)
+    except:
+        conv.error = sys.exc_info()[1]
+        return -1
+    return 0
+
+
+cdef _del_batches(field_batch **c_batches, int n):
+    cdef int j
+
+    if c_batches != NULL:
+        for j in range(n):
+            del_field_batch(c_batches[j])
+
+
+def _filter_terms(filters, dtype, simple_dtype, usecols_array):
+    """
+    Returns the terms of the row filter given by `filters` (see
+    readrows()): (column, strings) for a set of strings, and (column,
+    typechar, low, high) for a range, where column is the index of the
+    column in the file and typechar is 'd' or a datetime format character.
+    """
+    names = [key for key in filters if not isinstance(key, (int, long))]
+    if len(names) > 0 and simple_dtype:
+        raise ValueError("filters on field names require a structured dtype.")
+    fields = _field_indices(dtype, names, 'filtered')
+    terms = []
+    for key, cond in filters.items():
+        if isinstance(key, (int, long)):
+            column = key
+        else:
+            column = int(usecols_array[fields[key]])
+        if isinstance(cond, basestring):
+            terms.append((column, [cond]))
+        elif isinstance(cond, tuple):
+            if len(cond) != 2:
+                raise ValueError("The range of the filter on %r must be (low, high)." % (key,))
+            low, high = cond
+            dts = [b.dtype for b in cond if isinstance(b, numpy.datetime64)]
+            if len(dts) > 0:
+                # A range of datetimes, in the finer unit of the bounds.
+                dt = reduce(numpy.promote_types, dts)
+                unit = numpy.datetime_data(dt)[0]
+                typechar = _datetime_unit_map.get(unit)
+                if typechar is None:
+                    raise ValueError("Unsupported datetime64 unit in the filter on %r: %s" %
+                                     (key, unit))
+                int64_info = numpy.iinfo(numpy.int64)
+                low = int64_info.min if low is None else \
+                    int(numpy.datetime64(low).astype(dt).astype(numpy.int64))
+                high = int64_info.max if high is None else \
+                    int(numpy.datetime64(high).astype(dt).astype(numpy.int64))
+            else:
+                typechar = 'd'
+                low = -numpy.inf if low is None else float(low)
+                high = numpy.inf if high is None else float(high)
+            terms.append((column, typechar, low, high))
+        else:
+            terms.append((column, [str(value) for value in cond]))
+    return terms
+
+
+cdef row_filter *_new_row_filter(terms):
+    """
+    Returns a new row filter with the terms from _filter_terms(), or NULL
+    if out of memory.
+    """
+    cdef row_filter *c_filter
+    cdef numpy.ndarray value_ptrs
+    cdef numpy.ndarray lengths
+    cdef char **c_values
+    cdef int k, status
+
+    c_filter = new_row_filter()
+    if c_filter == NULL:
+        return NULL
+    for term in terms:
+        if len(term) == 2:
+            column, values = term
+            value_ptrs = numpy.zeros(max(len(values), 1), dtype=numpy.intp)
+            lengths = numpy.zeros(max(len(values), 1), dtype=numpy.intc)
+            c_values = <char **> value_ptrs.data
+            for k in range(len(values)):
+                c_values[k] = values[k]
+                lengths[k] = len(values[k])
+            status = filter_in(c_filter, column, c_values, <int *> lengths.data, len(values))
+        else:
+            column, typechar, low, high = term
+            if typechar == 'd':
+                status = filter_range(c_filter, column, low, high)
+            else:
+                status = filter_int_range(c_filter, column, ord(typechar), low, high)
+        if status != 0:
+            del_row_filter(c_filter)
+            return NULL
+    return c_filter
+
+
 _dtype_str_map = dict(i1='b', u1='B', i2='h', u2='H', i4='i', u4='I',
                     i8='q', u8='Q', f4='f', f8='d', c8='c', c16='z')
 
+_datetime_unit_map = dict(D='D', s='T', ms='M', us='U', ns='N')
+
 def dtypestr2fmt(st):
     fmt = _dtype_str_map.get(st)
     if fmt is None:
-        if st == "M8[us]":
-            fmt = 'U'  # Temporary experiment
+        if st.startswith("M8["):
+            fmt = _datetime_unit_map.get(st[3:-1])
+            if fmt is None:
+                raise ValueError('dtypestr2fmt: unsupported datetime64 unit: %s' % (st,))
         elif st.startswith('S'):
             fmt = st[1:] + 's'
         else:
@@ -89,29 +775,143 @@ def flatten_dtype(dt):
     return fmt
 
 
-def readrows(f, dtype, delimiter=None, quote='"', comment='#',
+def _row_format(f, dtype, usecols, delimiter, quote, comment, allow_embedded_newline):
+    """
+    Returns (dtype, fmt, simple_dtype, num_fields, usecols_array) for
+    reading the rows of f with the given dtype and usecols.  If dtype
+    is not a structured array (simple_dtype is True), each row of the
+    result has num_fields fields; otherwise num_fields is 1.
+    """
+    if not isinstance(dtype, numpy.dtype):
+        dtype = numpy.dtype(dtype)
+    simple_dtype = False
+    if dtype.names is None and dtype.subdtype is None:
+        # Not a structured array or other complex dtype.
+        simple_dtype = True
+        num_file_fields = countfields(f, delimiter, quote, comment, allow_embedded_newline)
+        fmt = dtypestr2fmt(dtype.str[1:])
+    else:
+        fmt = flatten_dtype(dtype)
+
+    if simple_dtype:
+        if usecols is None:
+            num_fields = num_file_fields
+            usecols_array = numpy.arange(num_fields, dtype=numpy.int32)
+        else:
+            usecols_array = numpy.asarray(usecols, dtype=numpy.int32)
+            num_fields = usecols_array.size
+        fmt = fmt * num_fields
+    else:
+        num_fields = 1
+        if usecols is None:
+            usecols_array = numpy.arange(sum(c not in "0123456789" for c in fmt),
+                                         dtype=numpy.int32)
+        else:
+            usecols_array = numpy.asarray(usecols, dtype=numpy.int32)
+            #if usecols_array.size > num_fields:
+            #    raise ValueError("Length of the 'usecols' sequence exceeds the number of fields in the dtype.")
+    return dtype, fmt, simple_dtype, num_fields, usecols_array
+
+
+_fmt_dtype_map = dict([(c, st) for st, c in _dtype_str_map.items()] +
+                      [(c, 'M8[%s]' % unit) for unit, c in _datetime_unit_map.items()])
+
+def _format_dtype(fmt, usecols_array):
+    """
+    Returns the structured dtype of the format fmt (one character, or a
+    count and 's', per field), with the field of column j named 'fj'.
+    """
+    fields = re.findall(r'(\d*)([a-zA-Z])', fmt)
+    return numpy.dtype([('f%d' % j, 'S' + count if c == 's' else _fmt_dtype_map[c])
+                        for j, (count, c) in zip(usecols_array, fields)])
+
+
+cdef _inferred_format(file f, delimiter, quote, comment, sci, decimal,
+                      allow_embedded_newline, char *dt_fmt, int tz_offset,
+                      usecols, int skiprows, int sample_rows, na_set *na):
+    """
+    Returns (dtype, fmt, usecols_array) for reading the rows of f with the
+    dtype guessed by infer_format() from a sample of sample_rows rows,
+    ignoring the NA tokens in na (which may be NULL).
+    """
+    cdef FILE *fp = PyFile_AsFile(f)
+    cdef char *c_fmt
+    cdef char c_delimiter = ord(delimiter[0])
+    cdef char c_quote = ord(quote[0])
+    cdef char c_comment = ord(comment[0])
+    cdef char c_sci = ord(sci[0])
+    cdef char c_decimal = ord(decimal[0])
+    cdef int c_allow_embedded_newline = allow_embedded_newline
+    cdef int error_type
+
+    PyFile_IncUseCount(f)
+    with nogil:
+        c_fmt = infer_format(fp, c_delimiter, c_quote, c_comment, c_sci, c_decimal,
+                             c_allow_embedded_newline, dt_fmt, tz_offset,
+                             skiprows, sample_rows, na, &error_type)
+    PyFile_DecUseCount(f)
+    if c_fmt == NULL:
+        if error_type == ERROR_NO_DATA:
+            raise ValueError("The file has no rows to infer the dtype from.")
+        raise MemoryError("Out of memory while reading the file.")
+    file_fmt = c_fmt
+    free(c_fmt)
+
+    fields = re.findall(r'\d*[a-zA-Z]', file_fmt)
+    if usecols is None:
+        usecols_array = numpy.arange(len(fields), dtype=numpy.int32)
+    else:
+        usecols_array = numpy.asarray(usecols, dtype=numpy.int32)
+        for j in usecols_array:
+            if j < 0 or j >= len(fields):
+                raise ValueError("Invalid column index %d in usecols (the file has %d fields)." %
+                                 (j, len(fields)))
+    fmt = ''.join([fields[j] for j in usecols_array])
+    return _format_dtype(fmt, usecols_array), fmt, usecols_array
+
+
+def readrows(f, dtype=None, delimiter=None, quote='"', comment='#',
              sci='E', decimal='.',
              allow_embedded_newline=True, datetime_fmt=None,
              tzoffset=0,
-             usecols=None, skiprows=None, numrows=None):
+             usecols=None, skiprows=None, numrows=None, num_threads=1,
+             buffer_size=None, index=None, columnar=False,
+             categorical=None, max_categories=32767, category_overflow='string',
+             varstrings=None, sample_rows=1000, masked=None, na_values=None,
+             on_error=None, max_errors=1000, converters=None, filters=None):
     """
-    readrows(f, dtype, delimiter=None, quote='"', comment='#',
+    readrows(f, dtype=None, delimiter=None, quote='"', comment='#',
              sci='E', decimal='.',
              allow_embedded_newline=True, datetime_fmt=None,
              tzoffset=0,
-             usecols=None, skiprows=None, numrows=None)
+             usecols=None, skiprows=None, numrows=None, num_threads=1,
+             buffer_size=None, index=None, columnar=False,
+             categorical=None, max_categories=32767, category_overflow='string',
+             varstrings=None, sample_rows=1000, masked=None, na_values=None,
+             on_error=None, max_errors=1000, converters=None, filters=None)
 
-    Read a CSV (or similar) text file and return a numpy array.
+    Read a CSV (or similar) text file and return a numpy array (or a
+    dict of arrays, if `columnar` is True).  If `categorical` or
+    `varstrings` is given, a tuple (array, strings) is returned; see
+    below.  If `on_error` is 'skip' or 'record', the errors are added
+    at the end of the result: (array, errors) or (array, strings,
+    errors).
 
     Parameters
     ----------
     f : file or str
         File or name of file to read.
-    dtype : numpy dtype
-        Numpy dtype of the data to read.  This must be a structured
-        array.
-        XXX Eventually this will be optional, and the code will figure
-            it out automatically if the dtype is not given.
+    dtype : numpy dtype or None, optional
+        Numpy dtype of the data to read.  If None, the dtype is inferred
+        from a sample of the rows (see `sample_rows`): a structured
+        dtype with a field 'fj' for column j, each of which is the
+        smallest of int8, int16, int32, int64, float64, complex128,
+        datetime64 (in `datetime_fmt`) and a string that holds the
+        values of the sample.  A value after the sample that doesn't fit
+        its field promotes the field (and the values already read) to a
+        wider type while the rows are read, so the file is not read
+        twice.  Fields that are empty in the sample are float64.
+        Default is None.
     delimiter : str with length 1 or None, optional
         The character that separates fields in the text file.  If
         None, fields are separates by white space.
@@ -137,10 +937,15 @@ def readrows(f, dtype, delimiter=None, quote='"', comment='#',
         Default is True.
     datetime_fmt : str or None, optional
         If not None, this must be a string that can be used by
-        strptime to parse a datetime string.
+        strptime to parse a datetime string.  The ISO 8601 formats
+        "%Y-%m-%d", "%Y-%m-%d %H:%M" and "%Y-%m-%d %H:%M:%S" (also
+        with 'T' instead of the space) are parsed without strptime,
+        and the seconds may have a fraction (e.g. "12:30:05.25").
+        Default is "%Y-%m-%d %H:%M:%S".
     tzoffset : int or None, optional
-        Offset in seconds from UTC of date/time values in the file.
-        Default is time.timezone.
+        Offset in seconds from UTC of date/time values in the file
+        (e.g. 3600 for UTC+01:00).  None is the same as 0.
+        Default is 0.
     usecols : sequence of ints, optional
         If given, this is the set of column indices (starting
         at 0) of the columns to keep.  The data type given in
@@ -150,11 +955,150 @@ def readrows(f, dtype, delimiter=None, quote='"', comment='#',
         Default is None (don't skip any rows).  
     numrows : int or None, optional
         If given, at most this number of rows of data will be read
-        (not including `skiprows`).
-        In this case, the first pass throught the file that counts
-        the number of rows is skipped.  Instead an array of length
-        `numrows` is created, and is filled in with data from the
-        file.
+        (not including `skiprows`).  An array of length `numrows` is
+        created, and is filled in with data from the file.
+        If None, all the rows are read.  The file is read in a single
+        pass; the memory for the array grows as the rows are read.
+    num_threads : int, optional
+        Number of threads to use to read the rows.  If 0, one thread
+        per processor is used.  Multiple threads are only used with
+        the memory mapped file buffer, and only when the file is large
+        enough (at least 1 MB of data per thread).
+        Default is 1.
+    buffer_size : int or None, optional
+        Number of bytes of the file to hold in memory at a time.  If
+        None, the memory mapped file buffer maps the rest of the file
+        (releasing the pages that have been read as it goes), and the
+        other file buffer uses 16 MB.  If given, the memory mapped file
+        buffer maps a window of this size that moves along the file;
+        the fields are then copied out of the window, and only one
+        thread is used.
+        Default is None.
+    index : str or None, optional
+        Name of a row index file made by build_index() for this file.
+        If it is given and applies to the file, the rows before
+        `skiprows` are not read; the reader goes directly to the
+        nearest indexed row before it.
+        Default is None.
+    columnar : bool, optional
+        If True, each column is read into its own 1-D array, and a dict
+        is returned that maps the field names of `dtype` (or the column
+        indices in `usecols`, if `dtype` is not a structured array) to
+        the arrays.  The values are written directly into the arrays,
+        so this avoids copying the columns out of a structured array.
+        The fields of `dtype` must not be arrays or structures.
+        Default is False.
+    categorical : sequence of str or None, optional
+        Names of string fields of `dtype` to read as categorical
+        fields.  Each distinct string in such a field gets an integer
+        code (0, 1, 2, ... in the order in which the strings are first
+        seen), and the field of the returned array holds the codes
+        instead of the strings.  The result is then a tuple (array,
+        strings), where strings maps each of the names to an array of
+        the distinct strings, so that strings[name][code] is the string
+        of code.  This needs a structured dtype.
+        Default is None.
+    max_categories : int, optional
+        Maximum number of distinct strings in a categorical field.
+        The codes are int8 if this is at most 127, int16 if it is at
+        most 32767, and int32 otherwise.
+        Default is 32767.
+    category_overflow : str, optional
+        What to do if a categorical field has more than
+        `max_categories` distinct strings: 'string' reads the file
+        again, with that field as a string field (it is then not in
+        strings), and 'raise' raises a ValueError.  With 'string', f
+        must be the name of a file, or a file that can seek back to
+        where the read started.
+        Default is 'string'.
+    varstrings : sequence of str or None, optional
+        Names of string fields of `dtype` to read as variable-length
+        strings (the width of their dtype is ignored).  The strings of
+        such a field are stored one after the other in a single uint8
+        array, and the field of the returned array holds the int64
+        offset of each string.  As with `categorical`, a tuple (array,
+        strings) is returned; strings[name] is (offsets, data), where
+        offsets has one more element than the array (the size of data),
+        so the string of row i is data[offsets[i]:offsets[i+1]].  This
+        needs a structured dtype.
+        Default is None.
+    sample_rows : int, optional
+        If dtype is None, the number of rows from which the dtype is
+        inferred.  Half of them are the first rows of the data; with the
+        memory mapped file buffer, the others are taken from a few
+        positions spread across the file.
+        Default is 1000.
+    masked : bool, sequence of str or None, optional
+        If True, the result is a numpy masked array (with columnar=True,
+        the columns are masked arrays) in which the missing values are
+        masked: the empty fields, and the fields equal to one of
+        `na_values`.  A sequence of field names masks only those fields
+        (which must not be arrays or structures).  The missing values are
+        recorded in a validity bitmap per field while the rows are read,
+        so no second pass is needed, and a field with no missing values
+        gets no mask (numpy.ma.nomask).  None is the same as True if
+        `na_values` is given, and False otherwise.
+        Default is None.
+    na_values : sequence of str or None, optional
+        Strings (such as 'NA' or 'null') that are missing values in the
+        masked fields, in addition to empty fields.  They are stored like
+        empty fields (see below).  If dtype is None, they are also
+        ignored when the dtype is inferred.
+        Default is None.
+    on_error : str or None, optional
+        What to do with a bad row: a row with a value that can't be
+        converted to its field, or with a different number of fields
+        than the first row.  'raise' stops the read at the first bad row
+        and raises a ValueError that gives its row, line and byte offset
+        in the file.  'skip' leaves the bad rows out of the result, and
+        'record' keeps the rows with values that can't be converted (the
+        values are stored as empty fields) and leaves out the rows with
+        the wrong number of fields.  With 'skip' and 'record', the read
+        continues after a bad row, and errors is a dict: errors['count']
+        is the number of errors, errors['skipped'] is the number of rows
+        left out, and errors['records'] is an array of the last
+        `max_errors` errors, with the fields 'row' (the index the row
+        has, or would have had, counting the rows left out), 'column'
+        (the column index in the file, or -1 for the wrong number of
+        fields), 'line', 'offset' (the byte offset in the file where the
+        row starts) and 'code' (the error type).  None keeps the values
+        that can't be converted without reporting them, and stops the
+        read at a row with the wrong number of fields.
+        Default is None.
+    max_errors : int, optional
+        Maximum number of errors kept in errors['records'] (see
+        `on_error`); only the most recent errors are kept.
+        Default is 1000.
+    converters : dict or None, optional
+        Maps names of fields of `dtype` to functions that convert the
+        text of the fields, for values that the reader can't parse.  A
+        function is called for a block of up to 65536 rows at a time,
+        not for each value: it is given (data, offsets), where data is a
+        uint8 array holding the text of the values one after the other,
+        and offsets is an int64 array with one more element than the
+        number of values, so the text of value k is
+        data[offsets[k]:offsets[k+1]].  It must return a sequence of
+        that many values, which are converted to the dtype of the field.
+        An exception raised by a function stops the read, and is raised
+        by readrows().  This needs a structured dtype, and the fields
+        must not be arrays, structures, categorical or varstrings.
+        Default is None.
+    filters : dict or None, optional
+        If given, only the rows that match all the conditions in the dict
+        are read.  Each key is a field name of `dtype` or a column index
+        in the file (which need not be in `usecols`), and each condition
+        is a string (the field must be equal to it), a list or set of
+        strings (the field must be one of them), or a tuple (low, high)
+        (the field must be a number, or a datetime if a bound is a
+        numpy.datetime64, between low and high inclusive; None is an
+        open bound).  Strings are compared with the text of the field,
+        and datetimes are parsed with `datetime_fmt`.  The conditions
+        are checked before any field of the row is converted, so the
+        rows that don't match cost little more than finding their
+        fields, and they take no space in the result.  `numrows` counts
+        only the rows that match, as do the rows of the errors.  A read
+        with filters uses one thread.
+        Default is None.
 
     Notes
     -----
@@ -165,15 +1109,49 @@ def readrows(f, dtype, delimiter=None, quote='"', comment='#',
        string:   '' (empty string)
        datetime: 0
 
+    With `masked`, these values are masked.
+
     """
     cdef numpy.ndarray a
     cdef numpy.ndarray usecols_array
+    cdef void *result
     cdef char *dt_fmt
+    cdef char *index_path = NULL
     cdef int opened_here = False
     cdef int nrows
     cdef int error_type, error_lineno
     cdef int tz_offset
     cdef int num_filed_fields
+    cdef file pyfile
+    cdef FILE *fp
+    cdef void *data_array
+    cdef char *c_fmt
+    cdef char c_delimiter, c_quote, c_comment, c_sci, c_decimal
+    cdef int c_allow_embedded_newline
+    cdef int *c_usecols
+    cdef int c_num_usecols, c_skiprows, c_num_threads, c_buffer_size
+    cdef int c_columnar = columnar
+    cdef numpy.ndarray column_ptrs
+    cdef char **c_columns = NULL
+    cdef numpy.ndarray cats_ptrs
+    cdef categories **c_cats = NULL
+    cdef numpy.ndarray arena_ptrs
+    cdef string_arena **c_arenas = NULL
+    cdef char *chars
+    cdef long long used
+    cdef int j
+    cdef char *c_promoted_fmt = NULL
+    cdef char **p_fmt = NULL
+    cdef numpy.ndarray mask_ptrs
+    cdef validity **c_masks = NULL
+    cdef na_set *c_na = NULL
+    cdef unsigned char *bits
+    cdef long long null_count
+    cdef error_log *c_errors = NULL
+    cdef int c_policy = 0
+    cdef numpy.ndarray batch_ptrs
+    cdef field_batch **c_batches = NULL
+    cdef row_filter *c_filter = NULL
 
     if datetime_fmt is None:
         dt_fmt = ''
@@ -181,7 +1159,7 @@ def readrows(f, dtype, delimiter=None, quote='"', comment='#',
         dt_fmt = datetime_fmt
 
     if tzoffset is None:
-        tz_offset = time.timezone
+        tz_offset = 0
     else:
         tz_offset = tzoffset
 
@@ -198,65 +1176,664 @@ def readrows(f, dtype, delimiter=None, quote='"', comment='#',
     if skiprows is None:
         skiprows = 0
 
+    if buffer_size is None:
+        buffer_size = -1
+
+    if index is not None:
+        index_path = index
+
+    if on_error is not None:
+        if on_error not in _error_policies:
+            raise ValueError("on_error must be 'raise', 'skip', 'record' or None.")
+        if max_errors < 1:
+            raise ValueError("max_errors must be at least 1.")
+        c_policy = _error_policies[on_error]
+
+    infer = dtype is None
+    if masked is None:
+        masked = na_values is not None
+    string_fields = categorical is not None or varstrings is not None
+    if infer and string_fields:
+        raise ValueError("categorical and varstrings require a dtype.")
+    if infer and converters is not None:
+        raise ValueError("converters require a dtype.")
+    if string_fields:
+        if category_overflow not in ('string', 'raise'):
+            raise ValueError("category_overflow must be 'string' or 'raise'.")
+        categorical = [] if categorical is None else list(categorical)
+        varstrings = [] if varstrings is None else list(varstrings)
+
     if isinstance(f, basestring):
         opened_here = True
         filename = f
         f = open(f, 'r')
+    elif string_fields:
+        # Where to read the file again from, if a categorical field
+        # overflows.
+        start_pos = f.tell()
+    pyfile = f
 
-    if not isinstance(dtype, numpy.dtype):
-        dtype = numpy.dtype(dtype)
-    simple_dtype = False
-    if dtype.names is None and dtype.subdtype is None:
-        # Not a structured array or other complex dtype.
-        simple_dtype = True
-        num_file_fields = countfields(f, delimiter, quote, comment, allow_embedded_newline)
-        fmt = dtypestr2fmt(dtype.str[1:])
+    if infer:
+        # The fields are promoted while the rows are read (see
+        # read_rows()), so read_rows() allocates the memory for the data,
+        # and returns the final format in c_promoted_fmt.
+        if na_values is not None:
+            c_na = _new_na_set(na_values)
+            if c_na == NULL:
+                raise MemoryError("Out of memory while reading the file.")
+        try:
+            dtype, fmt, usecols_array = \
+                _inferred_format(f, delimiter, quote, comment, sci, decimal,
+                                 allow_embedded_newline, dt_fmt, tz_offset,
+                                 usecols, skiprows, sample_rows, c_na)
+        except:
+            del_na_set(c_na)
+            raise
+        simple_dtype = False
+        num_fields = 1
+        p_fmt = &c_promoted_fmt
     else:
-        fmt = flatten_dtype(dtype)
+        dtype, fmt, simple_dtype, num_fields, usecols_array = \
+            _row_format(f, dtype, usecols, delimiter, quote, comment, allow_embedded_newline)
 
-    if numrows is None:
-        numrows = countrows(f, delimiter, quote, comment, allow_embedded_newline)
-        if numrows == -1:
-            raise RuntimeError("An error occurred while counting the number of rows in the file.")
-        # XXX What if the following makes numrows negative?
-        numrows -= skiprows
+    if string_fields:
+        string_dtype = dtype
+        dtype, fmt, category_fields, varstring_fields = \
+            _string_fields_format(dtype, categorical, varstrings, max_categories)
 
-    # XXX Remove this print eventually.  For now, it helps to show
-    # how long countrows() takes.
-    print "readrows: numrows =", numrows
+    converter_error = None
+    if converters is not None:
+        if simple_dtype:
+            raise ValueError("converters require a structured dtype.")
+        for name in converters:
+            if string_fields and (name in category_fields or name in varstring_fields):
+                raise ValueError("Field '%s' can't have a converter: it is categorical or "
+                                 "in varstrings." % (name,))
+        converter_fields = _field_indices(dtype, list(converters), 'converted')
 
-    if simple_dtype:
-        if usecols is None:
-            num_fields = num_file_fields
-            usecols_array = numpy.arange(num_fields, dtype=numpy.int32)
-        else:
-            usecols_array = numpy.asarray(usecols, dtype=numpy.int32)
-            num_fields = usecols_array.size
-        fmt = fmt * num_fields
-        shape = (numrows, num_fields)
+    if filters is not None:
+        filter_terms = _filter_terms(filters, dtype, simple_dtype, usecols_array)
+
+    if masked is not False:
+        try:
+            mask_fields = _masked_fields(dtype, simple_dtype, usecols_array, masked)
+        except:
+            del_na_set(c_na)
+            raise
+        if c_na == NULL and na_values is not None:
+            c_na = _new_na_set(na_values)
+            if c_na == NULL:
+                raise MemoryError("Out of memory while reading the file.")
+        # One validity bitmap per masked field, given to read_rows() or
+        # read_columns() in masks (indexed like usecols).
+        mask_ptrs = numpy.zeros(max(usecols_array.size, 1), dtype=numpy.intp)
+        c_masks = <validity **> mask_ptrs.data
+        for key, j in mask_fields.items():
+            if j < usecols_array.size:
+                c_masks[j] = new_validity(c_na, 0)
+                if c_masks[j] == NULL:
+                    _del_masks(c_masks, c_na, usecols_array.size)
+                    raise MemoryError("Out of memory while reading the file.")
+
+    if string_fields:
+        # One dictionary per categorical field and one arena per
+        # variable-length string field, given to read_rows() or
+        # read_columns() in cats and arenas (indexed like usecols).
+        cats_ptrs = numpy.zeros(max(usecols_array.size, 1), dtype=numpy.intp)
+        c_cats = <categories **> cats_ptrs.data
+        arena_ptrs = numpy.zeros(max(usecols_array.size, 1), dtype=numpy.intp)
+        c_arenas = <string_arena **> arena_ptrs.data
+        for name, j in category_fields.items():
+            if j < usecols_array.size:
+                c_cats[j] = new_categories(string_dtype[name].itemsize, max_categories)
+                if c_cats[j] == NULL:
+                    _del_string_fields(c_cats, c_arenas, usecols_array.size)
+                    _del_masks(c_masks, c_na, usecols_array.size)
+                    raise MemoryError("Out of memory while reading the file.")
+        for name, j in varstring_fields.items():
+            if j < usecols_array.size:
+                c_arenas[j] = new_string_arena(0)
+                if c_arenas[j] == NULL:
+                    _del_string_fields(c_cats, c_arenas, usecols_array.size)
+                    _del_masks(c_masks, c_na, usecols_array.size)
+                    raise MemoryError("Out of memory while reading the file.")
+
+    if converters is not None:
+        # One batch per field with a converter, given to read_rows() or
+        # read_columns() in batches (indexed like usecols).  The batches
+        # point to the _BatchConverter objects in batch_contexts.
+        batch_ptrs = numpy.zeros(max(usecols_array.size, 1), dtype=numpy.intp)
+        c_batches = <field_batch **> batch_ptrs.data
+        batch_contexts = []
+        for name, j in converter_fields.items():
+            if j < usecols_array.size:
+                conv = _BatchConverter(name, converters[name], dtype[name])
+                batch_contexts.append(conv)
+                c_batches[j] = new_field_batch(<batch_func> _convert_batch,
+                                               <void *> conv,
+                                               _CONVERTER_BLOCK_SIZE)
+                if c_batches[j] == NULL:
+                    _del_batches(c_batches, usecols_array.size)
+                    if string_fields:
+                        _del_string_fields(c_cats, c_arenas, usecols_array.size)
+                    _del_masks(c_masks, c_na, usecols_array.size)
+                    raise MemoryError("Out of memory while reading the file.")
+
+    if columnar:
+        names, column_dtypes = _column_dtypes(dtype, simple_dtype, usecols_array)
+        # The column pointers for read_columns().
+        column_ptrs = numpy.zeros(len(names), dtype=numpy.intp)
+        c_columns = <char **> column_ptrs.data
+        arrays = None
+        if numrows is not None and not infer:
+            arrays = [numpy.empty((numrows,), dtype=dt) for dt in column_dtypes]
+            for j in range(len(arrays)):
+                c_columns[j] = (<numpy.ndarray> arrays[j]).data
+
+    if numrows is None:
+        # Single pass: read_rows() allocates the memory for the data,
+        # and grows it as the rows are read.
+        nrows = -1
+        data_array = NULL
+    elif columnar or infer:
+        nrows = numrows
+        data_array = NULL
     else:
-        if usecols is None:
-            num_fields = sum(c not in "0123456789" for c in fmt)
-            usecols_array = numpy.arange(num_fields, dtype=numpy.int32)
+        if simple_dtype:
+            shape = (numrows, num_fields)
         else:
-            usecols_array = numpy.asarray(usecols, dtype=numpy.int32)
-            #if usecols_array.size > num_fields:
-            #    raise ValueError("Length of the 'usecols' sequence exceeds the number of fields in the dtype.")
-        shape = (numrows,)
+            shape = (numrows,)
+        a = numpy.empty(shape, dtype=dtype)
+        nrows = numrows
+        data_array = a.data
+
+    # The GIL is released while the rows are read, so everything passed
+    # to read_rows() or read_columns() is converted to C values first.
+    fp = PyFile_AsFile(pyfile)
+    c_fmt = fmt
+    c_delimiter = ord(delimiter[0])
+    c_quote = ord(quote[0])
+    c_comment = ord(comment[0])
+    c_sci = ord(sci[0])
+    c_decimal = ord(decimal[0])
+    c_allow_embedded_newline = allow_embedded_newline
+    c_usecols = <int *>usecols_array.data
+    c_num_usecols = usecols_array.size
+    c_skiprows = skiprows
+    c_num_threads = num_threads
+    c_buffer_size = buffer_size
 
-    a = numpy.empty(shape, dtype=dtype)
+    if c_policy != 0:
+        c_errors = new_error_log(c_policy, max_errors)
+        if c_errors == NULL:
+            _del_batches(c_batches, usecols_array.size)
+            if string_fields:
+                _del_string_fields(c_cats, c_arenas, usecols_array.size)
+            _del_masks(c_masks, c_na, usecols_array.size)
+            raise MemoryError("Out of memory while reading the file.")
 
-    nrows = numrows
-    result = read_rows(PyFile_AsFile(f), &nrows, fmt, ord(delimiter[0]), ord(quote[0]),
-                         ord(comment[0]), ord(sci[0]), ord(decimal[0]), allow_embedded_newline,
-                         dt_fmt, tz_offset,
-                         <int *>usecols_array.data, usecols_array.size, skiprows, a.data,
-                         &error_type, &error_lineno)
+    if filters is not None:
+        c_filter = _new_row_filter(filter_terms)
+        if c_filter == NULL:
+            del_error_log(c_errors)
+            _del_batches(c_batches, usecols_array.size)
+            if string_fields:
+                _del_string_fields(c_cats, c_arenas, usecols_array.size)
+            _del_masks(c_masks, c_na, usecols_array.size)
+            raise MemoryError("Out of memory while reading the file.")
+
+    PyFile_IncUseCount(pyfile)
+    with nogil:
+        if c_columnar:
+            result = <void *> read_columns(fp, &nrows, c_fmt, c_delimiter, c_quote, c_comment,
+                                           c_sci, c_decimal, c_allow_embedded_newline,
+                                           dt_fmt, tz_offset,
+                                           c_usecols, c_num_usecols, c_skiprows, c_num_threads,
+                                           c_buffer_size, index_path, c_cats, c_arenas, c_masks,
+                                           c_batches, c_errors, c_filter, c_columns, p_fmt,
+                                           &error_type, &error_lineno)
+        else:
+            result = read_rows(fp, &nrows, c_fmt, c_delimiter, c_quote, c_comment,
+                               c_sci, c_decimal, c_allow_embedded_newline,
+                               dt_fmt, tz_offset,
+                               c_usecols, c_num_usecols, c_skiprows, c_num_threads,
+                               c_buffer_size, index_path, c_cats, c_arenas, c_masks,
+                               c_batches, c_errors, c_filter, data_array, p_fmt,
+                               &error_type, &error_lineno)
+    PyFile_DecUseCount(pyfile)
 
     if opened_here:
         f.close()
 
-    if nrows < numrows:
-        a = a[:nrows]
+    del_row_filter(c_filter)
 
-    return a
+    if error_type == ERROR_INVALID_FILTER_COLUMN:
+        # Nothing was read: release what was given to the read (and any
+        # memory it allocated for the data) before raising.
+        del_error_log(c_errors)
+        _del_batches(c_batches, usecols_array.size)
+        if string_fields:
+            _del_string_fields(c_cats, c_arenas, usecols_array.size)
+        _del_masks(c_masks, c_na, usecols_array.size)
+        free(c_promoted_fmt)
+        if columnar:
+            if arrays is None:
+                for j in range(len(names)):
+                    free(c_columns[j])
+        elif data_array == NULL:
+            free(result)
+        raise ValueError("The column of the filter on %r is not in the file." %
+                         (list(filters)[error_lineno],))
+
+    if c_errors != NULL:
+        errors = {'count': c_errors.count, 'skipped': c_errors.num_skipped,
+                  'records': _error_records(c_errors)}
+        del_error_log(c_errors)
+
+    if c_batches != NULL:
+        _del_batches(c_batches, usecols_array.size)
+        for conv in batch_contexts:
+            if converter_error is None:
+                converter_error = conv.error
+
+    if c_masks != NULL:
+        # The bitmaps of the fields with missing values become arrays.
+        bitmaps = {}
+        out_of_memory = False
+        for key, j in mask_fields.items():
+            if j >= usecols_array.size:
+                continue
+            null_count = c_masks[j].null_count
+            bits = release_validity(c_masks[j], max(nrows, 0))
+            if null_count == 0:
+                continue
+            if bits == NULL:
+                out_of_memory = True
+            else:
+                bitmaps[key] = _array_from_data(bits, (max(nrows, 0) + 7) // 8,
+                                                numpy.dtype(numpy.uint8), 1, False)
+    del_na_set(c_na)
+
+    if c_promoted_fmt != NULL:
+        fmt = c_promoted_fmt
+        free(c_promoted_fmt)
+        dtype = _format_dtype(fmt, usecols_array)
+        if columnar:
+            names, column_dtypes = _column_dtypes(dtype, simple_dtype, usecols_array)
+
+    if string_fields:
+        strings = {}
+        overflowed = []
+        for name, j in category_fields.items():
+            if j >= usecols_array.size:
+                continue
+            if c_cats[j].overflow > 0:
+                overflowed.append(name)
+            else:
+                strings[name] = _category_strings(c_cats[j])
+            del_categories(c_cats[j])
+        for name, j in varstring_fields.items():
+            if j >= usecols_array.size:
+                continue
+            # The characters of the arena become the data array.
+            used = c_arenas[j].used
+            chars = release_string_arena(c_arenas[j])
+            if chars == NULL:
+                strings[name] = numpy.empty((0,), dtype=numpy.uint8)
+            else:
+                strings[name] = _array_from_data(chars, used, numpy.dtype(numpy.uint8),
+                                                 1, False)
+
+    if numrows is not None and not infer:
+        if columnar:
+            out = _columns_dict(names, column_dtypes, arrays, column_ptrs, nrows)
+        elif nrows < numrows:
+            out = a[:nrows]
+        else:
+            out = a
+    else:
+        if result == NULL:
+            if error_type == ERROR_NO_DATA:
+                nrows = 0
+            elif error_type == ERROR_OUT_OF_MEMORY:
+                raise MemoryError("Out of memory while reading the file.")
+            else:
+                raise RuntimeError("An error occurred while reading the file (error type %d)." %
+                                   (error_type,))
+
+        if columnar:
+            out = _columns_dict(names, column_dtypes, None, column_ptrs, nrows)
+        elif nrows == 0:
+            free(result)
+            if simple_dtype:
+                out = numpy.empty((0, num_fields), dtype=dtype)
+            else:
+                out = numpy.empty((0,), dtype=dtype)
+        else:
+            out = _array_from_data(result, nrows, dtype, num_fields, simple_dtype)
+
+    if c_masks != NULL:
+        if out_of_memory:
+            raise MemoryError("Out of memory while reading the file.")
+        out = _masked_result(out, bitmaps, mask_fields, simple_dtype, columnar)
+
+    if converter_error is not None:
+        raise converter_error
+
+    if string_fields and len(overflowed) > 0:
+        if category_overflow == 'raise':
+            raise ValueError("The categorical field '%s' has more than %d distinct values." %
+                             (overflowed[0], max_categories))
+        # Read the rows again, with the fields that overflowed as strings.
+        del out
+        if opened_here:
+            f = filename
+        else:
+            f.seek(start_pos)
+        return readrows(f, string_dtype, delimiter=delimiter, quote=quote, comment=comment,
+                        sci=sci, decimal=decimal,
+                        allow_embedded_newline=allow_embedded_newline,
+                        datetime_fmt=datetime_fmt, tzoffset=tzoffset,
+                        usecols=usecols, skiprows=skiprows, numrows=numrows,
+                        num_threads=num_threads, buffer_size=buffer_size, index=index,
+                        columnar=columnar,
+                        categorical=[name for name in categorical if name not in overflowed],
+                        max_categories=max_categories, category_overflow=category_overflow,
+                        varstrings=varstrings, masked=masked, na_values=na_values,
+                        on_error=on_error, max_errors=max_errors, converters=converters,
+                        filters=filters)
+
+    if on_error == 'raise' and errors['count'] > 0:
+        raise ValueError(_error_message(errors['records'][0]))
+
+    if not string_fields:
+        if on_error in ('skip', 'record'):
+            return out, errors
+        return out
+
+    for name in varstring_fields:
+        if name in strings:
+            data = strings[name]
+            offsets = numpy.empty((len(out[name]) + 1,), dtype=numpy.int64)
+            offsets[:-1] = out[name]
+            offsets[-1] = data.size
+            strings[name] = (offsets, data)
+
+    if on_error in ('skip', 'record'):
+        return out, strings, errors
+    return out, strings
+
+
+cdef class TextReader:
+    """
+    TextReader(f, dtype, delimiter=None, quote='"', comment='#',
+               sci='E', decimal='.',
+               allow_embedded_newline=True, datetime_fmt=None,
+               tzoffset=0,
+               usecols=None, skiprows=None, buffer_size=None, index=None,
+               chunksize=65536, reuse=False)
+
+    Read a CSV (or similar) text file in pieces.
+
+    The arguments up to `index` are the same as those of readrows().
+    The file is opened, the format is set up and `usecols` is checked
+    once, when the TextReader is created.  Then read() returns the next
+    rows of the file, and iterating over the TextReader gives arrays of
+    `chunksize` rows (the last one may be shorter) until the end of the
+    file.  The memory used doesn't depend on the size of the file.
+
+    If `reuse` is True, the iterator fills the same array for each
+    chunk, so each array returned by the iterator is only valid until
+    the next chunk is read.
+
+    The position of `f` is not defined until close() is called; then it
+    is left at the start of the unread data.  The file is not read in the
+    background between calls, so it may be closed before the TextReader
+    (read() then raises a ValueError).
+
+    The GIL is released while the rows are read, so several TextReaders
+    can be read at the same time by different threads.  A TextReader
+    can't be read by two threads at once; read() raises a RuntimeError
+    if another thread is reading it.
+
+    Example::
+
+        for a in TextReader('data.csv', dtype, delimiter=',', chunksize=10000):
+            total += a['x'].sum()
+    """
+    cdef reader *r
+    cdef file f
+    cdef int opened_here
+    cdef int reading
+    cdef object dtype
+    cdef int simple_dtype
+    cdef int num_fields
+    cdef object dt_fmt
+    cdef public int chunksize
+    cdef object buffer
+    cdef double wait_time
+    cdef int allocations
+
+    def __cinit__(self):
+        self.r = NULL
+        self.reading = False
+        self.wait_time = 0.0
+        self.allocations = 0
+
+    def __init__(self, f, dtype, delimiter=None, quote='"', comment='#',
+                 sci='E', decimal='.',
+                 allow_embedded_newline=True, datetime_fmt=None,
+                 tzoffset=0,
+                 usecols=None, skiprows=None, buffer_size=None, index=None,
+                 chunksize=65536, reuse=False):
+        cdef numpy.ndarray usecols_array
+        cdef char *index_path = NULL
+        cdef int tz_offset
+        cdef int error_type = 0, error_lineno = 0
+        cdef reader *r
+        cdef FILE *fp
+        cdef char *c_fmt
+        cdef char *c_dt_fmt
+        cdef char c_delimiter, c_quote, c_comment, c_sci, c_decimal
+        cdef int c_allow_embedded_newline
+        cdef int *c_usecols
+        cdef int c_num_usecols, c_skiprows, c_buffer_size
+
+        if datetime_fmt is None:
+            datetime_fmt = ''
+        # The reader keeps a pointer to this string.
+        self.dt_fmt = datetime_fmt
+
+        if tzoffset is None:
+            tz_offset = 0
+        else:
+            tz_offset = tzoffset
+
+        if delimiter is None:
+            delimiter = '\x00'
+
+        sci = sci.upper()
+        if sci != 'E' and sci != 'D':
+            raise ValueError("sci must be 'D' or 'E'.")
+
+        if len(decimal) != 1:
+            raise ValueError("'%s' is not a valid value for decimal." % decimal)
+
+        if skiprows is None:
+            skiprows = 0
+
+        if buffer_size is None:
+            buffer_size = -1
+
+        if index is not None:
+            index_path = index
+
+        if chunksize < 1:
+            raise ValueError("chunksize must be at least 1.")
+        self.chunksize = chunksize
+
+        self.opened_here = False
+        if isinstance(f, basestring):
+            self.opened_here = True
+            f = open(f, 'r')
+        self.f = f
+
+        self.dtype, fmt, self.simple_dtype, self.num_fields, usecols_array = \
+            _row_format(f, dtype, usecols, delimiter, quote, comment, allow_embedded_newline)
+
+        # new_reader() skips the first `skiprows` rows, so it is also
+        # called with the GIL released.
+        fp = PyFile_AsFile(self.f)
+        c_fmt = fmt
+        c_dt_fmt = self.dt_fmt
+        c_delimiter = ord(delimiter[0])
+        c_quote = ord(quote[0])
+        c_comment = ord(comment[0])
+        c_sci = ord(sci[0])
+        c_decimal = ord(decimal[0])
+        c_allow_embedded_newline = allow_embedded_newline
+        c_usecols = <int *>usecols_array.data
+        c_num_usecols = usecols_array.size
+        c_skiprows = skiprows
+        c_buffer_size = buffer_size
+
+        PyFile_IncUseCount(self.f)
+        with nogil:
+            r = new_reader(fp, c_fmt, c_delimiter, c_quote, c_comment,
+                           c_sci, c_decimal, c_allow_embedded_newline,
+                           c_dt_fmt, tz_offset,
+                           c_usecols, c_num_usecols, c_skiprows,
+                           c_buffer_size, index_path, NULL, NULL, NULL, NULL, NULL,
+                           &error_type, &error_lineno)
+        PyFile_DecUseCount(self.f)
+        self.r = r
+        if self.r == NULL and error_type != ERROR_NO_DATA:
+            self.close()
+            if error_type == ERROR_OUT_OF_MEMORY:
+                raise MemoryError("Out of memory while reading the file.")
+            raise RuntimeError("An error occurred while reading the file (error type %d)." %
+                               (error_type,))
+
+        self.buffer = None
+        if reuse:
+            self.buffer = self._empty(chunksize)
+
+    def __dealloc__(self):
+        if self.r != NULL:
+            del_reader(self.r, self._restore())
+
+    cdef int _restore(self):
+        # The file is not read between calls (see new_reader()), so the
+        # user may have closed it; then its position is not restored.
+        if self.f is None or self.f.closed:
+            return RESTORE_NOT
+        return RESTORE_FINAL
+
+    def _empty(self, numrows):
+        if self.simple_dtype:
+            return numpy.empty((numrows, self.num_fields), dtype=self.dtype)
+        else:
+            return numpy.empty((numrows,), dtype=self.dtype)
+
+    def read(self, numrows=None, out=None):
+        """
+        read(numrows=None, out=None)
+
+        Read the next `numrows` rows (fewer at the end of the file), and
+        return them in an array.  If `out` is given, the rows are stored
+        in `out`, which must be a C contiguous array of the dtype of the
+        TextReader with room for `numrows` rows, and the returned array
+        is a view of `out`.  If `numrows` is None, it is the length of
+        `out`, or `chunksize` if `out` is not given.
+        """
+        cdef numpy.ndarray a
+        cdef char *data
+        cdef int nrows, capacity, max_rows
+        cdef int error_type = 0, error_lineno = 0
+        cdef reader *r
+
+        if numrows is None:
+            numrows = self.chunksize if out is None else len(out)
+        if out is None:
+            a = self._empty(numrows)
+        else:
+            a = out
+            if a.dtype != self.dtype or not a.flags.c_contiguous or len(a) < numrows:
+                raise ValueError("out must be a C contiguous array of dtype %s with at least %d rows." %
+                                 (self.dtype, numrows))
+            if self.simple_dtype and (a.ndim != 2 or a.shape[1] != self.num_fields):
+                raise ValueError("out must have shape (n, %d)." % (self.num_fields,))
+
+        if self.reading:
+            raise RuntimeError("The TextReader is being read by another thread.")
+
+        nrows = 0
+        if self.r != NULL:
+            if self.f.closed:
+                raise ValueError("I/O operation on closed file.")
+            data = a.data
+            max_rows = numrows
+            capacity = max_rows
+            r = self.r
+            self.reading = True
+            PyFile_IncUseCount(self.f)
+            with nogil:
+                nrows = reader_read(r, max_rows, False, &data, 0, &capacity,
+                                    &error_type, &error_lineno)
+            PyFile_DecUseCount(self.f)
+            self.reading = False
+            if error_type == ERROR_OUT_OF_MEMORY:
+                raise MemoryError("Out of memory while reading the file.")
+
+        if nrows < len(a):
+            a = a[:nrows]
+        return a
+
+    def __iter__(self):
+        return self
+
+    def __next__(self):
+        a = self.read(self.chunksize, self.buffer)
+        if len(a) == 0:
+            raise StopIteration
+        return a
+
+    property read_wait_time:
+        """
+        Time, in seconds, spent waiting for data from the file, when the
+        file is read by a background thread (see file_buffer.h).
+        """
+        def __get__(self):
+            if self.r != NULL:
+                return read_wait_time(self.r.fb)
+            return self.wait_time
+
+    property num_allocations:
+        """
+        Number of memory allocations made by the C reader while reading
+        rows: to grow the data, and to grow the memory the rows are
+        tokenized into.  (That memory is owned by the reader and reused
+        for every row, and only grows for a row larger than all the
+        previous ones, so this doesn't grow with the number of rows.)
+        """
+        def __get__(self):
+            if self.r != NULL:
+                return self.r.num_allocations
+            return self.allocations
+
+    def close(self):
+        """
+        Delete the reader, leaving the position of the file at the start
+        of the unread data, and close the file if it was opened by the
+        TextReader.
+        """
+        if self.reading:
+            raise RuntimeError("The TextReader is being read by another thread.")
+        if self.r != NULL:
+            self.wait_time = read_wait_time(self.r.fb)
+            self.allocations = self.r.num_allocations
+            del_reader(self.r, self._restore())
+            self.r = NULL
+        if self.opened_here and self.f is not None:
+            self.f.close()
+        self.f = None
@@ -9,10 +9,22 @@ import numpy
 src_files = [
         "python/textreader.pyx",
         "src/rows.c",
+        "src/reader.c",
+        "src/row_index.c",
+        "src/categories.c",
+        "src/arena.c",
+        "src/infer.c",
+        "src/validity.c",
+        "src/error_log.c",
+        "src/batch.c",
+        "src/row_filter.c",
         "src/tokenize.c",
+        "src/scan.c",
         "src/fields.c",
+        "src/parallel.c",
         "src/conversions.c",
-        "src/xstrtod.c",
+        "src/datetime.c",
+        "src/str_to_float.c",
         "src/str_to.c",
         ]
 
@@ -25,6 +37,11 @@ else:
     src_files.append('src/file_buffer.c')
 
 define_macros = []
+libraries = []
+if sys.platform != 'win32':
+    # parallel.c uses POSIX threads.
+    libraries.append('pthread')
+
 if sys.platform.startswith('linux'):
     # XXX Is the condition for this too broad?  Should it be only for linux and gcc?
     define_macros.extend([('_FILE_OFFSET_BITS', '64'),
@@ -32,7 +49,8 @@ if sys.platform.startswith('linux'):
 
 ext = Extension("textreader", src_files,
                 include_dirs = ['src', numpy.get_include()],
-                define_macros=define_macros)
+                define_macros=define_macros,
+                libraries=libraries)
 
 setup(
     name='textreader',
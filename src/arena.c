@@ -0,0 +1,109 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+
+#define MIN_ARENA_SIZE 4096
+
+
+/*
+ *  string_arena *new_string_arena(int64_t size)
+ *
+ *  Create an empty arena with room for size bytes (at least
+ *  MIN_ARENA_SIZE); it grows as strings are added.  Returns NULL if out
+ *  of memory.
+ */
+
+string_arena *new_string_arena(int64_t size)
+{
+    string_arena *a;
+
+    if (size < MIN_ARENA_SIZE) {
+        size = MIN_ARENA_SIZE;
+    }
+    a = (string_arena *) malloc(sizeof(string_arena));
+    if (a == NULL) {
+        return NULL;
+    }
+    a->chars = (char *) malloc(size);
+    if (a->chars == NULL) {
+        free(a);
+        return NULL;
+    }
+    a->used = 0;
+    a->size = size;
+    return a;
+}
+
+
+/*
+ *  int64_t arena_append(string_arena *a, const char *s, int length)
+ *
+ *  Add the length characters at s to the arena.  The memory is doubled
+ *  when it is full, so the strings are copied O(1) times on average.
+ *
+ *  Returns the offset of the string in a->chars, or -1 if out of memory.
+ */
+
+int64_t arena_append(string_arena *a, const char *s, int length)
+{
+    int64_t start = a->used;
+
+    if (a->used + length > a->size) {
+        char *chars;
+        int64_t size = 2 * a->size;
+        while (a->used + length > size) {
+            size *= 2;
+        }
+        chars = (char *) realloc(a->chars, size);
+        if (chars == NULL) {
+            return -1;
+        }
+        a->chars = chars;
+        a->size = size;
+    }
+    memcpy(a->chars + start, s, length);
+    a->used += length;
+    return start;
+}
+
+
+/*
+ *  char *release_string_arena(string_arena *a)
+ *
+ *  Delete the arena, except for its characters, which are returned
+ *  (trimmed to a->used bytes).  The caller must free() them.  Returns
+ *  NULL if the arena is empty.
+ */
+
+char *release_string_arena(string_arena *a)
+{
+    char *chars = a->chars;
+
+    if (a->used == 0) {
+        free(chars);
+        chars = NULL;
+    }
+    else if (a->used < a->size) {
+        chars = (char *) realloc(a->chars, a->used);
+        if (chars == NULL) {
+            /* Keep the untrimmed memory. */
+            chars = a->chars;
+        }
+    }
+    free(a);
+    return chars;
+}
+
+
+void del_string_arena(string_arena *a)
+{
+    if (a == NULL) {
+        return;
+    }
+    free(a->chars);
+    free(a);
+}
@@ -0,0 +1,35 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ *  The strings of a variable-length string ('v') field: the strings are
+ *  stored one after the other in chars, and the field holds the offset
+ *  of its string in chars (as an int64).  The string of a row ends where
+ *  the string of the next row starts (or at used, for the last row), as
+ *  in an Arrow string column.  See arena.c.
+ */
+
+typedef struct _string_arena {
+    char *chars;
+
+    /* Number of bytes of chars holding strings. */
+    int64_t used;
+
+    /* Number of bytes allocated for chars. */
+    int64_t size;
+
+} string_arena;
+
+
+string_arena *new_string_arena(int64_t size);
+
+int64_t arena_append(string_arena *a, const char *s, int length);
+
+char *release_string_arena(string_arena *a);
+
+void del_string_arena(string_arena *a);
+
+#endif
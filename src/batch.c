@@ -0,0 +1,125 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "error_types.h"
+#include "batch.h"
+
+
+/*
+ *  Batch converters.  A converter that is not written in C (e.g. a
+ *  Python function) is far too slow to call once per value.  Instead,
+ *  the converter of a field with a batch (convert_batched()) only copies
+ *  the text of the value into the batch, and the reader calls the batch
+ *  function for each block of capacity rows (see reader_read()), which
+ *  stores the values in the rows of the block.  The memory of a batch is
+ *  reused for every block.
+ */
+
+
+/*
+ *  field_batch *new_field_batch(batch_func func, void *context, int capacity)
+ *
+ *  Create an empty batch of capacity values (at least 1), which are
+ *  converted by func (see batch.h).  Returns NULL if out of memory.
+ */
+
+field_batch *new_field_batch(batch_func func, void *context, int capacity)
+{
+    field_batch *b;
+
+    if (capacity < 1) {
+        capacity = 1;
+    }
+    b = (field_batch *) malloc(sizeof(field_batch));
+    if (b == NULL) {
+        return NULL;
+    }
+    b->chars = new_string_arena(0);
+    b->offsets = (int64_t *) malloc((capacity + 1) * sizeof(int64_t));
+    if (b->chars == NULL || b->offsets == NULL) {
+        del_string_arena(b->chars);
+        free(b->offsets);
+        free(b);
+        return NULL;
+    }
+    b->func = func;
+    b->context = context;
+    b->capacity = capacity;
+    b->count = 0;
+    b->offsets[0] = 0;
+    return b;
+}
+
+
+/*
+ *  int convert_batched(char *start, int length, field_type *ft,
+ *                      conversion_options *options, char *data_ptr)
+ *
+ *  The converter of a field with a batch (ft->batch): the value is added
+ *  to the batch, and is stored as 0 until the batch is flushed.  The
+ *  caller must flush the batch before it has more than capacity values.
+ */
+
+int convert_batched(char *start, int length, field_type *ft,
+                    conversion_options *options, char *data_ptr)
+{
+    field_batch *b = ft->batch;
+
+    memset(data_ptr, 0, ft->size);
+    if (arena_append(b->chars, start, length) < 0) {
+        return ERROR_OUT_OF_MEMORY;
+    }
+    ++(b->count);
+    b->offsets[b->count] = b->chars->used;
+    return 0;
+}
+
+
+/*
+ *  void batch_drop_last(field_batch *b)
+ *
+ *  Remove the last value added to b (for a row that is left out).
+ */
+
+void batch_drop_last(field_batch *b)
+{
+    if (b->count > 0) {
+        --(b->count);
+        b->chars->used = b->offsets[b->count];
+    }
+}
+
+
+/*
+ *  int flush_batch(field_batch *b, int64_t first_row, char *dst, int stride)
+ *
+ *  Convert the values in b with its batch function, which stores them at
+ *  dst, dst + stride, ... (see batch.h), and empty b.  Returns the result
+ *  of the batch function (0 if b is empty).
+ */
+
+int flush_batch(field_batch *b, int64_t first_row, char *dst, int stride)
+{
+    int status = 0;
+
+    if (b->count > 0) {
+        status = b->func(b->context, first_row, b->count,
+                         b->chars->chars, b->offsets, dst, stride);
+    }
+    b->count = 0;
+    b->chars->used = 0;
+    return status;
+}
+
+
+void del_field_batch(field_batch *b)
+{
+    if (b == NULL) {
+        return;
+    }
+    del_string_arena(b->chars);
+    free(b->offsets);
+    free(b);
+}
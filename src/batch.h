@@ -0,0 +1,59 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdint.h>
+
+#include "field_type.h"
+#include "arena.h"
+
+/*
+ *  A batch function converts the values of a field in a block of count
+ *  rows at once.  The text of value k is chars[offsets[k]:offsets[k+1]]
+ *  (offsets has count + 1 entries), and the value must be stored at
+ *  dst + k * stride (in the type and size of the field).  first_row is
+ *  the index of the first row of the block in the data.  context is the
+ *  pointer given to new_field_batch().  The function returns 0, or
+ *  nonzero if the values could not be converted.
+ */
+
+typedef int (*batch_func)(void *context, int64_t first_row, int count,
+                          char *chars, int64_t *offsets,
+                          char *dst, int stride);
+
+
+/*
+ *  The values of a field with a batch function, collected until there
+ *  are capacity of them (or the read ends), and then converted together
+ *  by flush_batch().  See batch.c.
+ */
+
+typedef struct _field_batch {
+
+    batch_func func;
+    void *context;
+
+    /* Number of values in a full batch. */
+    int capacity;
+
+    /* Number of values collected. */
+    int count;
+
+    /* The text of the values, and where each one starts in it. */
+    string_arena *chars;
+    int64_t *offsets;
+
+} field_batch;
+
+
+field_batch *new_field_batch(batch_func func, void *context, int capacity);
+
+int convert_batched(char *start, int length, field_type *ft,
+                    conversion_options *options, char *data_ptr);
+
+void batch_drop_last(field_batch *b);
+
+int flush_batch(field_batch *b, int64_t first_row, char *dst, int stride);
+
+void del_field_batch(field_batch *b);
+
+#endif
@@ -0,0 +1,244 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "categories.h"
+
+
+/*
+ *  A categories dictionary is a hash table of codes, plus the strings of
+ *  the codes, which are stored one after the other in a single buffer
+ *  (chars).  A field that repeats a few hundred values over many rows
+ *  costs one hash and one memcmp() per row, and nothing is allocated
+ *  after the first occurrence of each value.
+ */
+
+#define INITIAL_TABLE_SIZE   64
+#define INITIAL_CHARS_SIZE 1024
+
+
+/* FNV-1a. */
+static uint32_t hash_string(const char *s, int length)
+{
+    uint32_t h = 2166136261u;
+    int k;
+
+    for (k = 0; k < length; ++k) {
+        h ^= (unsigned char) s[k];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+
+/*
+ *  categories *new_categories(int width, int max_count)
+ *
+ *  Create an empty dictionary for a field whose strings are truncated
+ *  to width characters, and that can hold up to max_count codes.  The
+ *  codes must fit in the size of the field (e.g. max_count must be at
+ *  most 32767 for a '2k' field).  Returns NULL if out of memory.
+ */
+
+categories *new_categories(int width, int max_count)
+{
+    categories *c;
+    int k;
+
+    c = (categories *) malloc(sizeof(categories));
+    if (c == NULL) {
+        return NULL;
+    }
+    c->width = width;
+    c->max_count = max_count;
+    c->count = 0;
+    c->overflow = 0;
+    c->entries_size = INITIAL_TABLE_SIZE / 2;
+    c->entries = (category_entry *) malloc(c->entries_size * sizeof(category_entry));
+    c->chars_used = 0;
+    c->chars_size = INITIAL_CHARS_SIZE;
+    c->chars = (char *) malloc(c->chars_size);
+    c->table_size = INITIAL_TABLE_SIZE;
+    c->table = (int32_t *) malloc(c->table_size * sizeof(int32_t));
+    if (c->entries == NULL || c->chars == NULL || c->table == NULL) {
+        del_categories(c);
+        return NULL;
+    }
+    for (k = 0; k < c->table_size; ++k) {
+        c->table[k] = -1;
+    }
+    return c;
+}
+
+
+/*
+ *  Double the size of the hash table.  Returns 0, or -1 if out of memory.
+ */
+
+static int grow_table(categories *c)
+{
+    int32_t *table;
+    int size = 2 * c->table_size;
+    int code, k;
+
+    table = (int32_t *) malloc(size * sizeof(int32_t));
+    if (table == NULL) {
+        return -1;
+    }
+    for (k = 0; k < size; ++k) {
+        table[k] = -1;
+    }
+    for (code = 0; code < c->count; ++code) {
+        k = c->entries[code].hash & (size - 1);
+        while (table[k] >= 0) {
+            k = (k + 1) & (size - 1);
+        }
+        table[k] = code;
+    }
+    free(c->table);
+    c->table = table;
+    c->table_size = size;
+    return 0;
+}
+
+
+/*
+ *  int category_code(categories *c, const char *s, int length)
+ *
+ *  Returns the code of the string s (length characters, truncated to
+ *  c->width), adding it to the dictionary if it is new.  Returns -1 if
+ *  the string is new and the dictionary already has c->max_count codes
+ *  (c->overflow is then incremented), or -2 if out of memory.
+ */
+
+int category_code(categories *c, const char *s, int length)
+{
+    uint32_t h;
+    int k;
+    int32_t code;
+    category_entry *e;
+
+    if (length > c->width) {
+        length = c->width;
+    }
+    h = hash_string(s, length);
+    k = h & (c->table_size - 1);
+    while ((code = c->table[k]) >= 0) {
+        e = &(c->entries[code]);
+        if (e->hash == h && e->length == length &&
+                memcmp(c->chars + e->start, s, length) == 0) {
+            return code;
+        }
+        k = (k + 1) & (c->table_size - 1);
+    }
+
+    /* A new string; k is the empty slot for it. */
+    if (c->count >= c->max_count) {
+        c->overflow++;
+        return -1;
+    }
+    if (2 * (c->count + 1) > c->table_size) {
+        /* Keep the table at most half full. */
+        if (grow_table(c) != 0) {
+            return -2;
+        }
+        k = h & (c->table_size - 1);
+        while (c->table[k] >= 0) {
+            k = (k + 1) & (c->table_size - 1);
+        }
+    }
+    if (c->count == c->entries_size) {
+        category_entry *entries;
+        entries = (category_entry *) realloc(c->entries,
+                                             2 * c->entries_size * sizeof(category_entry));
+        if (entries == NULL) {
+            return -2;
+        }
+        c->entries = entries;
+        c->entries_size *= 2;
+    }
+    if (c->chars_used + length > c->chars_size) {
+        char *chars;
+        size_t size = 2 * c->chars_size;
+        while (c->chars_used + length > size) {
+            size *= 2;
+        }
+        chars = (char *) realloc(c->chars, size);
+        if (chars == NULL) {
+            return -2;
+        }
+        c->chars = chars;
+        c->chars_size = size;
+    }
+
+    code = c->count;
+    e = &(c->entries[code]);
+    e->hash = h;
+    e->length = length;
+    e->start = c->chars_used;
+    memcpy(c->chars + c->chars_used, s, length);
+    c->chars_used += length;
+    c->table[k] = code;
+    c->count++;
+    return code;
+}
+
+
+/*
+ *  int find_category(categories *c, const char *s, int length)
+ *
+ *  Returns the code of the string s (length characters, truncated to
+ *  c->width), or -1 if it is not in the dictionary.  Unlike
+ *  category_code(), the dictionary is not changed, so a dictionary can
+ *  be used as a set of strings.
+ */
+
+int find_category(categories *c, const char *s, int length)
+{
+    uint32_t h;
+    int k;
+    int32_t code;
+    category_entry *e;
+
+    if (length > c->width) {
+        length = c->width;
+    }
+    h = hash_string(s, length);
+    k = h & (c->table_size - 1);
+    while ((code = c->table[k]) >= 0) {
+        e = &(c->entries[code]);
+        if (e->hash == h && e->length == length &&
+                memcmp(c->chars + e->start, s, length) == 0) {
+            return code;
+        }
+        k = (k + 1) & (c->table_size - 1);
+    }
+    return -1;
+}
+
+
+/*
+ *  const char *category_string(categories *c, int code, int *p_length)
+ *
+ *  Returns the string of the code, and puts its length in *p_length.
+ *  (The string is not nul-terminated.)
+ */
+
+const char *category_string(categories *c, int code, int *p_length)
+{
+    *p_length = c->entries[code].length;
+    return c->chars + c->entries[code].start;
+}
+
+
+void del_categories(categories *c)
+{
+    if (c == NULL) {
+        return;
+    }
+    free(c->entries);
+    free(c->chars);
+    free(c->table);
+    free(c);
+}
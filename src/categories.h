@@ -0,0 +1,64 @@
+#ifndef CATEGORIES_H
+#define CATEGORIES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ *  The dictionary of a categorical ('k') field: each distinct string in
+ *  the field gets a code (0, 1, 2, ... in the order in which the strings
+ *  are first seen), and the field is stored as its code.  See
+ *  categories.c.
+ */
+
+typedef struct _category_entry {
+    uint32_t hash;
+    int length;
+    size_t start;
+} category_entry;
+
+typedef struct _categories {
+
+    /* Strings are truncated to this length (as they are in 's' fields). */
+    int width;
+
+    /* The maximum number of codes. */
+    int max_count;
+
+    /* Number of codes. */
+    int count;
+
+    /*
+     *  Number of fields that did not get a code because there were
+     *  already max_count codes.
+     */
+    int overflow;
+
+    /* entries[code] is the string with that code, in chars. */
+    category_entry *entries;
+    int entries_size;
+    char *chars;
+    size_t chars_used;
+    size_t chars_size;
+
+    /*
+     *  Hash table of the codes (open addressing; -1 is an empty slot).
+     *  table_size is a power of 2.
+     */
+    int32_t *table;
+    int table_size;
+
+} categories;
+
+
+categories *new_categories(int width, int max_count);
+
+int category_code(categories *c, const char *s, int length);
+
+int find_category(categories *c, const char *s, int length);
+
+const char *category_string(categories *c, int code, int *p_length);
+
+void del_categories(categories *c);
+
+#endif
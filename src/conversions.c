@@ -5,15 +5,28 @@
 #include <errno.h>
 #include <ctype.h>
 
+#include <stdint.h>
+#include <time.h>
+
 #include "sizes.h"
 #include "constants.h"
+#include "field_type.h"
+#include "conversions.h"
+#include "error_types.h"
+#include "str_to.h"
+#include "datetime.h"
+#include "categories.h"
+#include "arena.h"
 
-double xstrtod(char *p, char **q, int decimal, int sci, int skip_trailing);
+double str_to_double(const char *str, int length, char **endptr,
+                     char decimal, char sci, int skip_trailing);
+float str_to_float(const char *str, int length, char **endptr,
+                   char decimal, char sci, int skip_trailing);
 
 
 /*
- *  `item` must be the nul-terminated string that is to be
- *  converted to a double.
+ *  `item` points to the `length` characters that are to be
+ *  converted to a double.  They need not be nul-terminated.
  *
  *  To be successful, to_double() must use *all* the characters
  *  in `item`.  E.g. "1.q25" will fail.  Leading and trailing 
@@ -27,22 +40,42 @@ double xstrtod(char *p, char **q, int decimal, int sci, int skip_trailing);
  *
  */
 
-int to_double(char *item, double *p_value, char sci, char decimal)
+int to_double(char *item, int length, double *p_value, char sci, char decimal)
 {
     char *p_end;
 
-    *p_value = xstrtod(item, &p_end, decimal, sci, TRUE);
+    // str_to_double() only sets errno on an error, so it must be cleared
+    // first; otherwise one bad field would fail every conversion after it.
+    errno = 0;
+    *p_value = str_to_double(item, length, &p_end, decimal, sci, TRUE);
 
-    return (errno == 0) && (!*p_end);
+    return (errno == 0) && (p_end == item + length);
 }
 
 
-int to_complex(char *item, double *p_real, double *p_imag, char sci, char decimal)
+/*
+ *  Like to_double(), but the result is rounded directly to float.
+ */
+
+int to_float(char *item, int length, float *p_value, char sci, char decimal)
 {
     char *p_end;
 
-    *p_real = xstrtod(item, &p_end, decimal, sci, FALSE);
-    if (*p_end == '\0') {
+    errno = 0;
+    *p_value = str_to_float(item, length, &p_end, decimal, sci, TRUE);
+
+    return (errno == 0) && (p_end == item + length);
+}
+
+
+int to_complex(char *item, int length, double *p_real, double *p_imag, char sci, char decimal)
+{
+    char *p_end;
+    char *item_end = item + length;
+
+    errno = 0;
+    *p_real = str_to_double(item, length, &p_end, decimal, sci, FALSE);
+    if (p_end == item_end) {
         *p_imag = 0.0;
         return errno == 0;
     }
@@ -55,16 +88,16 @@ int to_complex(char *item, double *p_real, double *p_imag, char sci, char decima
         if (*p_end == '+') {
             ++p_end;
         }
-        *p_imag = xstrtod(p_end, &p_end, decimal, sci, FALSE);
-        if (errno || ((*p_end != 'i') && (*p_end != 'j'))) {
+        *p_imag = str_to_double(p_end, item_end - p_end, &p_end, decimal, sci, FALSE);
+        if (errno || p_end == item_end || ((*p_end != 'i') && (*p_end != 'j'))) {
             return FALSE;
         }
         ++p_end;
     }
-    while(*p_end == ' ') {
+    while (p_end < item_end && *p_end == ' ') {
         ++p_end;
     }
-    return *p_end == '\0';
+    return p_end == item_end;
 }
 
 
@@ -76,6 +109,7 @@ int to_longlong(char *item, long long *p_value)
     // we used 0, strtoll() would convert '012' to 10, because the leading 0 in
     // '012' signals an octal number in C.  For a general purpose reader, that
     // would be a bug, not a feature.
+    errno = 0;
     *p_value = strtoll(item, &p_end, 10);
 
     // Allow trailing spaces.
@@ -85,6 +119,332 @@ int to_longlong(char *item, long long *p_value)
 }
 
 
+/*
+ *  Converters for the fields of a row (see convert_func in field_type.h).
+ *  An empty field is a missing value, and is not an error: it is
+ *  converted to 0 (NaN for floating point fields).
+ */
+
+static int int_error(int error)
+{
+    if (error == ERROR_OK) {
+        return 0;
+    }
+    return (error == ERROR_OVERFLOW) ? ERROR_INTEGER_OVERFLOW : ERROR_INVALID_INTEGER;
+}
+
+
+static int convert_int8(char *start, int length, field_type *ft,
+                        conversion_options *options, char *data_ptr)
+{
+    int error;
+    *(int8_t *) data_ptr = str_to_int8(start, length, &error);
+    return length ? int_error(error) : 0;
+}
+
+
+static int convert_uint8(char *start, int length, field_type *ft,
+                         conversion_options *options, char *data_ptr)
+{
+    int error;
+    *(uint8_t *) data_ptr = str_to_uint8(start, length, &error);
+    return length ? int_error(error) : 0;
+}
+
+
+static int convert_int16(char *start, int length, field_type *ft,
+                         conversion_options *options, char *data_ptr)
+{
+    int error;
+    *(int16_t *) data_ptr = str_to_int16(start, length, &error);
+    return length ? int_error(error) : 0;
+}
+
+
+static int convert_uint16(char *start, int length, field_type *ft,
+                          conversion_options *options, char *data_ptr)
+{
+    int error;
+    *(uint16_t *) data_ptr = str_to_uint16(start, length, &error);
+    return length ? int_error(error) : 0;
+}
+
+
+static int convert_int32(char *start, int length, field_type *ft,
+                         conversion_options *options, char *data_ptr)
+{
+    int error;
+    *(int32_t *) data_ptr = str_to_int32(start, length, &error);
+    return length ? int_error(error) : 0;
+}
+
+
+static int convert_uint32(char *start, int length, field_type *ft,
+                          conversion_options *options, char *data_ptr)
+{
+    int error;
+    *(uint32_t *) data_ptr = str_to_uint32(start, length, &error);
+    return length ? int_error(error) : 0;
+}
+
+
+static int convert_int64(char *start, int length, field_type *ft,
+                         conversion_options *options, char *data_ptr)
+{
+    int error;
+    *(int64_t *) data_ptr = str_to_int64(start, length, INT64_MIN, INT64_MAX, &error);
+    return length ? int_error(error) : 0;
+}
+
+
+static int convert_uint64(char *start, int length, field_type *ft,
+                          conversion_options *options, char *data_ptr)
+{
+    int error;
+    *(uint64_t *) data_ptr = str_to_uint64(start, length, UINT64_MAX, &error);
+    return length ? int_error(error) : 0;
+}
+
+
+static int convert_float(char *start, int length, field_type *ft,
+                         conversion_options *options, char *data_ptr)
+{
+    float x;
+    int error = 0;
+
+    if ((length == 0) || !to_float(start, length, &x, options->sci, options->decimal)) {
+        // XXX  Find the canonical platform-independent method to assign nan.
+        x = (float) (0.0 / 0.0);
+        error = length ? ERROR_INVALID_FLOAT : 0;
+    }
+    *(float *) data_ptr = x;
+    return error;
+}
+
+
+static int convert_double(char *start, int length, field_type *ft,
+                          conversion_options *options, char *data_ptr)
+{
+    double x;
+    int error = 0;
+
+    if ((length == 0) || !to_double(start, length, &x, options->sci, options->decimal)) {
+        // XXX  Find the canonical platform-independent method to assign nan.
+        x = 0.0 / 0.0;
+        error = length ? ERROR_INVALID_FLOAT : 0;
+    }
+    *(double *) data_ptr = x;
+    return error;
+}
+
+
+static int convert_complex(char *start, int length, field_type *ft,
+                           conversion_options *options, char *data_ptr)
+{
+    double x, y;
+    int error = 0;
+
+    if ((length == 0) || !to_complex(start, length, &x, &y, options->sci, options->decimal)) {
+        // XXX  Find the canonical platform-independent method to assign nan.
+        x = 0.0 / 0.0;
+        y = x;
+        error = length ? ERROR_INVALID_COMPLEX : 0;
+    }
+    if (ft->size == 8) {
+        ((float *) data_ptr)[0] = (float) x;
+        ((float *) data_ptr)[1] = (float) y;
+    }
+    else {
+        ((double *) data_ptr)[0] = x;
+        ((double *) data_ptr)[1] = y;
+    }
+    return error;
+}
+
+
+/*
+ *  The datetime converters.  The unit of the datetime64 value is given
+ *  by the type character: D (days), T (seconds), M (milliseconds),
+ *  U (microseconds) or N (nanoseconds).
+ */
+
+static int convert_datetime_days(char *start, int length, field_type *ft,
+                                 conversion_options *options, char *data_ptr)
+{
+    int64_t seconds;
+    int nanoseconds;
+    int status;
+
+    memset(data_ptr, 0, 8);
+    if (length == 0) {
+        return 0;
+    }
+    status = parse_datetime(start, length, options, &seconds, &nanoseconds);
+    if (status == 0) {
+        // Round toward -infinity, so times before 1970 are in the right day.
+        *(int64_t *) data_ptr = (seconds >= 0 ? seconds : seconds - 86399) / 86400;
+    }
+    return status;
+}
+
+static int convert_datetime_s(char *start, int length, field_type *ft,
+                              conversion_options *options, char *data_ptr)
+{
+    int64_t seconds;
+    int nanoseconds;
+    int status;
+
+    memset(data_ptr, 0, 8);
+    if (length == 0) {
+        return 0;
+    }
+    status = parse_datetime(start, length, options, &seconds, &nanoseconds);
+    if (status == 0) {
+        *(int64_t *) data_ptr = seconds;
+    }
+    return status;
+}
+
+static int convert_datetime_ms(char *start, int length, field_type *ft,
+                               conversion_options *options, char *data_ptr)
+{
+    int64_t seconds;
+    int nanoseconds;
+    int status;
+
+    memset(data_ptr, 0, 8);
+    if (length == 0) {
+        return 0;
+    }
+    status = parse_datetime(start, length, options, &seconds, &nanoseconds);
+    if (status == 0) {
+        *(int64_t *) data_ptr = seconds * 1000 + nanoseconds / 1000000;
+    }
+    return status;
+}
+
+static int convert_datetime_us(char *start, int length, field_type *ft,
+                               conversion_options *options, char *data_ptr)
+{
+    int64_t seconds;
+    int nanoseconds;
+    int status;
+
+    memset(data_ptr, 0, 8);
+    if (length == 0) {
+        return 0;
+    }
+    status = parse_datetime(start, length, options, &seconds, &nanoseconds);
+    if (status == 0) {
+        *(int64_t *) data_ptr = seconds * 1000000 + nanoseconds / 1000;
+    }
+    return status;
+}
+
+static int convert_datetime_ns(char *start, int length, field_type *ft,
+                               conversion_options *options, char *data_ptr)
+{
+    int64_t seconds;
+    int nanoseconds;
+    int status;
+
+    memset(data_ptr, 0, 8);
+    if (length == 0) {
+        return 0;
+    }
+    status = parse_datetime(start, length, options, &seconds, &nanoseconds);
+    if (status == 0) {
+        *(int64_t *) data_ptr = seconds * 1000000000 + nanoseconds;
+    }
+    return status;
+}
+
+
+static int convert_string(char *start, int length, field_type *ft,
+                          conversion_options *options, char *data_ptr)
+{
+    // Like strncpy(), pad with nul bytes.
+    int n = (length < ft->size) ? length : ft->size;
+
+    memcpy(data_ptr, start, n);
+    memset(data_ptr + n, 0, ft->size - n);
+    return 0;
+}
+
+
+/*
+ *  A categorical field is stored as the code of its string in
+ *  ft->categories.  A string that doesn't get a code is stored as -1.
+ */
+
+static int convert_category(char *start, int length, field_type *ft,
+                            conversion_options *options, char *data_ptr)
+{
+    int code = category_code(ft->categories, start, length);
+
+    switch (ft->size) {
+        case 1: *(int8_t *) data_ptr = (code < 0) ? -1 : code; break;
+        case 2: *(int16_t *) data_ptr = (code < 0) ? -1 : code; break;
+        case 8: *(int64_t *) data_ptr = (code < 0) ? -1 : code; break;
+        default: *(int32_t *) data_ptr = (code < 0) ? -1 : code; break;
+    }
+    if (code == -1) {
+        return ERROR_TOO_MANY_CATEGORIES;
+    }
+    return (code < 0) ? ERROR_OUT_OF_MEMORY : 0;
+}
+
+
+/*
+ *  A variable-length string field is stored as the offset of its string
+ *  in ft->arena.
+ */
+
+static int convert_varstring(char *start, int length, field_type *ft,
+                             conversion_options *options, char *data_ptr)
+{
+    int64_t offset = arena_append(ft->arena, start, length);
+
+    *(int64_t *) data_ptr = offset;
+    return (offset < 0) ? ERROR_OUT_OF_MEMORY : 0;
+}
+
+
+/*
+ *  convert_func converter_for_type(char typechar)
+ *
+ *  Returns the converter for the format character typechar (see fields.c),
+ *  or NULL if typechar is not valid.
+ */
+
+convert_func converter_for_type(char typechar)
+{
+    switch (typechar) {
+        case 'b': return convert_int8;
+        case 'B': return convert_uint8;
+        case 'h': return convert_int16;
+        case 'H': return convert_uint16;
+        case 'i': return convert_int32;
+        case 'I': return convert_uint32;
+        case 'q': return convert_int64;
+        case 'Q': return convert_uint64;
+        case 'f': return convert_float;
+        case 'd': return convert_double;
+        case 'c':
+        case 'z': return convert_complex;
+        case 'D': return convert_datetime_days;
+        case 'T': return convert_datetime_s;
+        case 'M': return convert_datetime_ms;
+        case 'U': return convert_datetime_us;
+        case 'N': return convert_datetime_ns;
+        case 's': return convert_string;
+        case 'k': return convert_category;
+        case 'v': return convert_varstring;
+    }
+    return NULL;
+}
+
+
 #ifdef TEST
 
 int main(int argc, char *argv[])
@@ -95,7 +455,7 @@ int main(int argc, char *argv[])
 
     //s = "0.10e-3-+5.5e2i";
     s = "1-0j";
-    status = to_complex(s, &x, &y, 'e', '.');
+    status = to_complex(s, strlen(s), &x, &y, 'e', '.');
     printf("s = '%s'\n", s);
     printf("status = %d\n", status);
     printf("x = %lg,  y = %lg\n", x, y);
@@ -1,4 +1,9 @@
 
-int to_double(char *item, double *p_value, char sci, char decimal);
-int to_complex(char *item, double *p_real, double *p_imag, char sci, char decimal);
+#include "field_type.h"
+
+int to_double(char *item, int length, double *p_value, char sci, char decimal);
+int to_float(char *item, int length, float *p_value, char sci, char decimal);
+int to_complex(char *item, int length, double *p_real, double *p_imag, char sci, char decimal);
 int to_longlong(char *item, long long *p_value);
+
+convert_func converter_for_type(char typechar);
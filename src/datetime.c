@@ -0,0 +1,300 @@
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "sizes.h"
+#include "constants.h"
+#include "field_type.h"
+#include "datetime.h"
+#include "error_types.h"
+
+#define IS_DIGIT(c) ((unsigned) ((c) - '0') < 10)
+
+
+/*
+ *  The datetime formats that parse_datetime() handles itself.  Any
+ *  other format is handled by strptime().
+ */
+
+static struct {
+    char *fmt;
+    int layout;
+    char sep;
+} iso_formats[] = {
+    {"%Y-%m-%d",          DATETIME_LAYOUT_DATE,    0},
+    {"%F",                DATETIME_LAYOUT_DATE,    0},
+    {"%Y-%m-%d %H:%M",    DATETIME_LAYOUT_MINUTES, ' '},
+    {"%Y-%m-%dT%H:%M",    DATETIME_LAYOUT_MINUTES, 'T'},
+    {"%Y-%m-%d %H:%M:%S", DATETIME_LAYOUT_SECONDS, ' '},
+    {"%Y-%m-%dT%H:%M:%S", DATETIME_LAYOUT_SECONDS, 'T'},
+    {"%F %T",             DATETIME_LAYOUT_SECONDS, ' '},
+    {"%FT%T",             DATETIME_LAYOUT_SECONDS, 'T'},
+    {NULL, 0, 0}
+};
+
+
+/*
+ *  void set_datetime_layout(conversion_options *options)
+ *
+ *  Set options->datetime_layout and options->datetime_sep from
+ *  options->datetime_fmt.
+ */
+
+void set_datetime_layout(conversion_options *options)
+{
+    int k;
+
+    options->datetime_layout = DATETIME_LAYOUT_STRPTIME;
+    options->datetime_sep = 0;
+    for (k = 0; iso_formats[k].fmt != NULL; ++k) {
+        if (strcmp(options->datetime_fmt, iso_formats[k].fmt) == 0) {
+            options->datetime_layout = iso_formats[k].layout;
+            options->datetime_sep = iso_formats[k].sep;
+            break;
+        }
+    }
+}
+
+
+/*
+ *  int64_t days_from_civil(int64_t year, int month, int day)
+ *
+ *  Number of days from 1970-01-01 to the given date of the proleptic
+ *  Gregorian calendar.  month is 1 to 12.  day may be out of the range
+ *  of the month (e.g. day 0 is the last day of the previous month),
+ *  like the normalization done by mktime().
+ */
+
+static int64_t days_from_civil(int64_t year, int month, int day)
+{
+    int64_t era;
+    int yoe, doy, doe;
+
+    // Count years from March 1, so the leap day is the last day of the year.
+    if (month <= 2) {
+        --year;
+    }
+    era = (year >= 0 ? year : year - 399) / 400;
+    yoe = (int) (year - era * 400);
+    doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+
+/*
+ *  void civil_from_days(int64_t days, int64_t *p_year, int *p_month, int *p_day)
+ *
+ *  The inverse of days_from_civil().
+ */
+
+static void civil_from_days(int64_t days, int64_t *p_year, int *p_month, int *p_day)
+{
+    int64_t era;
+    int yoe, doy, doe, mp;
+
+    days += 719468;
+    era = (days >= 0 ? days : days - 146096) / 146097;
+    doe = (int) (days - era * 146097);
+    yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    mp = (5 * doy + 2) / 153;
+    *p_day = doy - (153 * mp + 2) / 5 + 1;
+    *p_month = (mp < 10) ? mp + 3 : mp - 9;
+    *p_year = era * 400 + yoe + (*p_month <= 2);
+}
+
+
+/*
+ *  Parse exactly n digits at *p.  Returns -1 if they are not all digits.
+ */
+
+static int parse_digits(const char **p, const char *end, int n)
+{
+    int value = 0;
+    const char *q = *p;
+
+    if (end - q < n) {
+        return -1;
+    }
+    while (n-- > 0) {
+        if (!IS_DIGIT(*q)) {
+            return -1;
+        }
+        value = 10 * value + (*q - '0');
+        ++q;
+    }
+    *p = q;
+    return value;
+}
+
+
+/*
+ *  Parse the datetime at start with the ISO 8601 layout in options.
+ *  Returns FALSE if the field does not have exactly that layout (the
+ *  caller then uses strptime()).  After the seconds, a fraction of a
+ *  second (e.g. "12:30:05.25") is allowed.
+ */
+
+static int parse_iso_datetime(char *start, int length, conversion_options *options,
+                              int64_t *p_seconds, int *p_nanoseconds)
+{
+    const char *p = start;
+    const char *end = start + length;
+    int year, month, day;
+    int hour = 0, minute = 0, second = 0, nanoseconds = 0;
+
+    while (p < end && *p == ' ') {
+        ++p;
+    }
+    year = parse_digits(&p, end, 4);
+    if (year < 0 || p == end || *p++ != '-') {
+        return FALSE;
+    }
+    month = parse_digits(&p, end, 2);
+    if (month < 1 || month > 12 || p == end || *p++ != '-') {
+        return FALSE;
+    }
+    day = parse_digits(&p, end, 2);
+    if (day < 1 || day > 31) {
+        return FALSE;
+    }
+    if (options->datetime_layout != DATETIME_LAYOUT_DATE) {
+        if (p == end || *p++ != options->datetime_sep) {
+            return FALSE;
+        }
+        hour = parse_digits(&p, end, 2);
+        if (hour < 0 || hour > 23 || p == end || *p++ != ':') {
+            return FALSE;
+        }
+        minute = parse_digits(&p, end, 2);
+        if (minute < 0 || minute > 59) {
+            return FALSE;
+        }
+        if (options->datetime_layout == DATETIME_LAYOUT_SECONDS) {
+            if (p == end || *p++ != ':') {
+                return FALSE;
+            }
+            // Like strptime(), allow leap seconds.
+            second = parse_digits(&p, end, 2);
+            if (second < 0 || second > 61) {
+                return FALSE;
+            }
+            if (p < end && *p == '.') {
+                int scale = 100000000;
+                ++p;
+                if (p == end || !IS_DIGIT(*p)) {
+                    return FALSE;
+                }
+                // Digits after the nanoseconds are ignored.
+                while (p < end && IS_DIGIT(*p)) {
+                    nanoseconds += (*p - '0') * scale;
+                    scale /= 10;
+                    ++p;
+                }
+            }
+        }
+    }
+    while (p < end && *p == ' ') {
+        ++p;
+    }
+    if (p != end) {
+        return FALSE;
+    }
+
+    *p_seconds = days_from_civil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+    *p_nanoseconds = nanoseconds;
+    return TRUE;
+}
+
+
+/*
+ *  int parse_datetime(char *start, int length, conversion_options *options,
+ *                     int64_t *p_seconds, int *p_nanoseconds)
+ *
+ *  Convert the datetime in the length bytes at start, in the format
+ *  options->datetime_fmt, to the number of seconds since 1970-01-01
+ *  00:00:00 UTC, plus a fraction of a second in nanoseconds (0 to
+ *  999999999).  The time in the field is taken to be options->tz_offset
+ *  seconds ahead of UTC.
+ *
+ *  The ISO 8601 formats in iso_formats are parsed directly; any other
+ *  format is parsed with strptime().  In both cases the time is computed
+ *  arithmetically, not with mktime(), so the time zone of the process
+ *  doesn't matter (and daylight saving time is not applied).
+ *
+ *  Returns 0 or ERROR_INVALID_DATETIME.
+ */
+
+int parse_datetime(char *start, int length, conversion_options *options,
+                   int64_t *p_seconds, int *p_nanoseconds)
+{
+    struct tm tm = {0,0,0,0,0,0,0,0,0};
+    char field[FIELD_BUFFER_SIZE];
+    int64_t seconds;
+
+    if (options->datetime_layout == DATETIME_LAYOUT_STRPTIME ||
+            !parse_iso_datetime(start, length, options, &seconds, p_nanoseconds)) {
+
+        // strptime() needs a nul-terminated string.
+        if (length >= FIELD_BUFFER_SIZE) {
+            return ERROR_INVALID_DATETIME;
+        }
+        memcpy(field, start, length);
+        field[length] = '\0';
+
+        if (strptime(field, options->datetime_fmt, &tm) == NULL) {
+            return ERROR_INVALID_DATETIME;
+        }
+        seconds = days_from_civil(tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday) * 86400
+                  + tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec;
+        *p_nanoseconds = 0;
+    }
+    *p_seconds = seconds - options->tz_offset;
+    return 0;
+}
+
+
+/*
+ *  int format_datetime(int64_t value, char unit, char *buf, int size)
+ *
+ *  Write the datetime64 value, in the unit given by the format character
+ *  unit ('D', 'T', 'U' or 'N'; see fields.c), in buf as an ISO 8601 string
+ *  ("2012-03-04" for days, "2012-03-04 05:06:07" for seconds, followed by
+ *  ".ffffff" or ".fffffffff" for microseconds or nanoseconds).  This is
+ *  the inverse of parse_datetime() with the default datetime format.
+ *  Returns the length of the string (as snprintf() does).
+ */
+
+int format_datetime(int64_t value, char unit, char *buf, int size)
+{
+    int64_t per_second, days, seconds, fraction = 0, year;
+    int month, day;
+
+    per_second = (unit == 'U') ? 1000000 : (unit == 'N') ? 1000000000 : 1;
+    if (unit == 'D') {
+        civil_from_days(value, &year, &month, &day);
+        return snprintf(buf, size, "%04lld-%02d-%02d", (long long) year, month, day);
+    }
+    // Round toward -infinity, as convert_datetime_days() does.
+    seconds = (value >= 0) ? value / per_second : -((-value - 1) / per_second) - 1;
+    fraction = value - seconds * per_second;
+    days = (seconds >= 0) ? seconds / 86400 : -((-seconds - 1) / 86400) - 1;
+    seconds -= days * 86400;
+    civil_from_days(days, &year, &month, &day);
+    if (unit == 'U') {
+        return snprintf(buf, size, "%04lld-%02d-%02d %02d:%02d:%02d.%06lld",
+                        (long long) year, month, day, (int) (seconds / 3600),
+                        (int) (seconds / 60 % 60), (int) (seconds % 60), (long long) fraction);
+    }
+    if (unit == 'N') {
+        return snprintf(buf, size, "%04lld-%02d-%02d %02d:%02d:%02d.%09lld",
+                        (long long) year, month, day, (int) (seconds / 3600),
+                        (int) (seconds / 60 % 60), (int) (seconds % 60), (long long) fraction);
+    }
+    return snprintf(buf, size, "%04lld-%02d-%02d %02d:%02d:%02d",
+                    (long long) year, month, day, (int) (seconds / 3600),
+                    (int) (seconds / 60 % 60), (int) (seconds % 60));
+}
@@ -0,0 +1,25 @@
+
+#ifndef DATETIME_H
+#define DATETIME_H
+
+#include <stdint.h>
+
+#include "field_type.h"
+
+/*
+ *  Values of conversion_options.datetime_layout.
+ */
+
+#define DATETIME_LAYOUT_STRPTIME 0   /* Any format: use strptime().       */
+#define DATETIME_LAYOUT_DATE     1   /* %Y-%m-%d                          */
+#define DATETIME_LAYOUT_MINUTES  2   /* %Y-%m-%d %H:%M (or T for the ' ') */
+#define DATETIME_LAYOUT_SECONDS  3   /* %Y-%m-%d %H:%M:%S[.fraction]      */
+
+void set_datetime_layout(conversion_options *options);
+
+int parse_datetime(char *start, int length, conversion_options *options,
+                   int64_t *p_seconds, int *p_nanoseconds);
+
+int format_datetime(int64_t value, char unit, char *buf, int size);
+
+#endif
@@ -0,0 +1,109 @@
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "error_log.h"
+
+
+/*
+ *  Bad rows.  A large file with a few bad lines should not have to be
+ *  read again to find them, so instead of only reporting the first error,
+ *  the reader can record each error (with where it is in the file) in an
+ *  error log.  The log is bounded: if there are many errors (e.g. a
+ *  format that doesn't match the file), only the last capacity errors
+ *  are kept, and the others are only counted.  Nothing is done with the
+ *  log until there is an error, so it costs nothing for the good rows.
+ */
+
+
+/*
+ *  error_log *new_error_log(int policy, int capacity)
+ *
+ *  Create an empty log that keeps up to capacity errors (at least 1).
+ *  policy is one of the ERROR_POLICY_* values (see error_log.h).
+ *  Returns NULL if out of memory.
+ */
+
+error_log *new_error_log(int policy, int capacity)
+{
+    error_log *log;
+
+    if (capacity < 1) {
+        capacity = 1;
+    }
+    log = (error_log *) malloc(sizeof(error_log));
+    if (log == NULL) {
+        return NULL;
+    }
+    log->entries = (error_entry *) malloc(capacity * sizeof(error_entry));
+    if (log->entries == NULL) {
+        free(log);
+        return NULL;
+    }
+    log->policy = policy;
+    log->capacity = capacity;
+    log->head = 0;
+    log->count = 0;
+    log->num_skipped = 0;
+    return log;
+}
+
+
+/*
+ *  void log_error(error_log *log, int64_t row, int64_t offset,
+ *                 int column, int line, int code)
+ *
+ *  Add an error to the log (see error_entry), overwriting the oldest
+ *  error if the log is full.
+ */
+
+void log_error(error_log *log, int64_t row, int64_t offset,
+               int column, int line, int code)
+{
+    error_entry *e = &(log->entries[log->head]);
+
+    e->row = row;
+    e->offset = offset;
+    e->column = column;
+    e->line = line;
+    e->code = code;
+    log->head = (log->head + 1) % log->capacity;
+    ++(log->count);
+}
+
+
+/*
+ *  int num_logged(error_log *log)
+ *
+ *  Returns the number of errors that are kept in the log.
+ */
+
+int num_logged(error_log *log)
+{
+    return (log->count < log->capacity) ? (int) log->count : log->capacity;
+}
+
+
+/*
+ *  error_entry *logged_error(error_log *log, int k)
+ *
+ *  Returns the k-th error kept in the log, from the oldest (k = 0) to
+ *  the most recent (k = num_logged(log) - 1).
+ */
+
+error_entry *logged_error(error_log *log, int k)
+{
+    int first = (log->count < log->capacity) ? 0 : log->head;
+
+    return &(log->entries[(first + k) % log->capacity]);
+}
+
+
+void del_error_log(error_log *log)
+{
+    if (log == NULL) {
+        return;
+    }
+    free(log->entries);
+    free(log);
+}
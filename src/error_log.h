@@ -0,0 +1,80 @@
+#ifndef ERROR_LOG_H
+#define ERROR_LOG_H
+
+#include <stdint.h>
+
+/*
+ *  What reader_read() does with a bad row (a row with a field that can't
+ *  be converted, or with the wrong number of fields) when it is given an
+ *  error log.  Without a log, a conversion error is only reported (if it
+ *  is the first), and a wrong number of fields stops the read.
+ *
+ *  ERROR_POLICY_RAISE:   stop the read at the first bad row.
+ *  ERROR_POLICY_SKIP:    leave out the bad rows, and keep reading.
+ *  ERROR_POLICY_RECORD:  keep the rows with conversion errors (the bad
+ *                        fields are set to 0, as without a log), leave
+ *                        out the rows with the wrong number of fields,
+ *                        and keep reading.
+ *
+ *  In every case, the errors are recorded in the log.
+ */
+
+#define ERROR_POLICY_RAISE   1
+#define ERROR_POLICY_SKIP    2
+#define ERROR_POLICY_RECORD  3
+
+
+/*
+ *  One error.  row is the index of the row in the data, counting the
+ *  rows that were left out (so it is the index the row would have had),
+ *  and offset is the position in the file where the row starts.  column
+ *  is the index of the field in the file, or -1 for an error in the whole
+ *  row (ERROR_CHANGED_NUMBER_OF_FIELDS).  line is the line number
+ *  reported by read_rows() for the error.
+ */
+
+typedef struct _error_entry {
+    int64_t row;
+    int64_t offset;
+    int column;
+    int line;
+    int code;
+} error_entry;
+
+
+/*
+ *  A bounded log of errors: a ring buffer that holds the last capacity
+ *  errors.  count is the number of errors that were logged, which may be
+ *  more than the number that are kept.  See error_log.c.
+ */
+
+typedef struct _error_log {
+
+    int policy;
+
+    error_entry *entries;
+    int capacity;
+
+    /* The next entry to write (the oldest entry, once the log is full). */
+    int head;
+
+    int64_t count;
+
+    /* Number of rows that were left out. */
+    int64_t num_skipped;
+
+} error_log;
+
+
+error_log *new_error_log(int policy, int capacity);
+
+void log_error(error_log *log, int64_t row, int64_t offset,
+               int column, int line, int code);
+
+int num_logged(error_log *log);
+
+error_entry *logged_error(error_log *log, int k);
+
+void del_error_log(error_log *log);
+
+#endif
@@ -6,7 +6,23 @@
 
 #define ERROR_OUT_OF_MEMORY             1
 #define ERROR_INVALID_COLUMN_INDEX     10
+#define ERROR_INVALID_CATEGORIES       11
 #define ERROR_CHANGED_NUMBER_OF_FIELDS 12
+#define ERROR_INVALID_STRING_ARENA     13
+#define ERROR_BATCH_FAILED             14
+#define ERROR_INVALID_FILTER_COLUMN    15
 #define ERROR_TOO_MANY_CHARS           21
 #define ERROR_TOO_MANY_FIELDS          22
 #define ERROR_NO_DATA                  23
+
+/*
+ *  Errors in the conversion of a field.  These don't stop read_rows();
+ *  the field is set to 0 (NaN for floating point fields), and the first
+ *  error is reported.
+ */
+#define ERROR_INVALID_INTEGER          31
+#define ERROR_INTEGER_OVERFLOW         32
+#define ERROR_INVALID_FLOAT            33
+#define ERROR_INVALID_COMPLEX          34
+#define ERROR_INVALID_DATETIME         35
+#define ERROR_TOO_MANY_CATEGORIES      36
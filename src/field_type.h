@@ -1,5 +1,55 @@
+#ifndef FIELD_TYPE_H
+#define FIELD_TYPE_H
 
-typedef struct _field_type {
+/*
+ *  Options for the conversion of the fields of a row.
+ */
+
+typedef struct _conversion_options {
+    char sci;
+    char decimal;
+    char *datetime_fmt;
+    int tz_offset;
+    /* How datetime_fmt is parsed; set by set_datetime_layout(). */
+    int datetime_layout;
+    char datetime_sep;
+} conversion_options;
+
+typedef struct _field_type field_type;
+
+/*
+ *  A converter converts the length bytes at start to the type of the
+ *  field ft, and stores the value (ft->size bytes) at data_ptr.  It
+ *  returns 0 or one of the conversion error codes in error_types.h.
+ */
+
+typedef int (*convert_func)(char *start, int length, field_type *ft,
+                            conversion_options *options, char *data_ptr);
+
+/*
+ *  The fields of a row of the data, as computed by enumerate_fields().
+ *  offset is the position of the field in the row.  The row loop calls
+ *  convert for each field, so the type of the field is only looked at
+ *  once, when the converter is chosen.
+ *
+ *  categories is the dictionary of a categorical ('k') field (see
+ *  categories.h), and arena holds the strings of a variable-length
+ *  string ('v') field (see arena.h); they are NULL for the other fields.
+ *  validity is the bitmap of the missing values of the field (see
+ *  validity.h), or NULL if they are not recorded.  batch collects the
+ *  values of a field that is converted a block of rows at a time (see
+ *  batch.h); it is NULL for the fields converted one value at a time.
+ */
+
+struct _field_type {
     char typechar;
     int size;
-} field_type;
+    int offset;
+    convert_func convert;
+    struct _categories *categories;
+    struct _string_arena *arena;
+    struct _validity *validity;
+    struct _field_batch *batch;
+};
+
+#endif
@@ -4,6 +4,7 @@
 #include <errno.h>
 
 #include "field_type.h"
+#include "conversions.h"
 
 /*
  *  Format characters for data types (mostly compatible with
@@ -21,7 +22,17 @@
  *    c : 32 bit complex (real and imag are each 32 bit)
  *    z : 64 bit complex (real and imag are each 64 bit)
  *    s : character
- *    U : 64 bit datetime (very experimental)
+ *    D : 64 bit datetime, days           (datetime64[D])
+ *    T : 64 bit datetime, seconds        (datetime64[s])
+ *    M : 64 bit datetime, milliseconds   (datetime64[ms])
+ *    U : 64 bit datetime, microseconds   (datetime64[us])
+ *    N : 64 bit datetime, nanoseconds    (datetime64[ns])
+ *    k : categorical string, stored as a signed integer code
+ *    v : variable-length string, stored as a 64 bit offset into the
+ *        field's string arena (see arena.h)
+ *
+ *  As with 's', the count before 'k' is the size of the field in bytes
+ *  (1, 2, 4 or 8), not a repeat count.
  */
 
 /*
@@ -75,7 +86,9 @@ int calc_size(char *fmt, int *p_nfields)
             size += repcount * 4;
             ++p;
         }
-        else if (*p == 'q' || *p == 'Q' || *p == 'd' || *p == 'c' || *p == 'U') {
+        else if (*p == 'q' || *p == 'Q' || *p == 'd' || *p == 'c' ||
+                 *p == 'D' || *p == 'T' || *p == 'M' || *p == 'U' || *p == 'N' ||
+                 *p == 'v') {
             size += repcount * 8;
             ++p;
         }
@@ -83,7 +96,7 @@ int calc_size(char *fmt, int *p_nfields)
             size += repcount * 16;
             ++p;
         }
-        else if (*p == 's') {
+        else if (*p == 's' || *p == 'k') {
             ++p;
             size += repcount;
             repcount = 1;
@@ -99,9 +112,19 @@ int calc_size(char *fmt, int *p_nfields)
 }
 
 
+/*
+ *  field_type *enumerate_fields(char *fmt)
+ *
+ *  Returns an array with an element for each field in fmt, giving its
+ *  type, size, offset in a row of the data, and the converter for its
+ *  type.  The caller must free() the array.  Returns NULL if there is
+ *  not enough memory.
+ */
+
 field_type *enumerate_fields(char *fmt)
 {
     int item_size, fmt_size;
+    int offset;
     unsigned long repcount;
     char *p, *p_end;
     int nfields;
@@ -113,11 +136,11 @@ field_type *enumerate_fields(char *fmt)
     fmt_size = calc_size(fmt, &nfields);
     result = (field_type *) malloc(nfields * sizeof(field_type));
     if (result == NULL) {
-        printf("enumerate_fields: out of memory\n");
         return NULL;
     }
 
     field = 0;
+    offset = 0;
     p = fmt;
     while (*p) {
         errno = 0;
@@ -141,7 +164,9 @@ field_type *enumerate_fields(char *fmt)
             item_size = 4;
             ++p;
         }
-        else if (c == 'q' || c == 'Q' || c == 'd' || c == 'c' || c == 'U') {
+        else if (c == 'q' || c == 'Q' || c == 'd' || c == 'c' ||
+                 c == 'D' || c == 'T' || c == 'M' || c == 'U' || c == 'N' ||
+                 c == 'v') {
             item_size = 8;
             ++p;
         }
@@ -149,7 +174,7 @@ field_type *enumerate_fields(char *fmt)
             item_size = 16;
             ++p;
         }
-        else if (c == 's') {
+        else if (c == 's' || c == 'k') {
             item_size = repcount;
             repcount = 1;
             ++p;
@@ -162,6 +187,13 @@ field_type *enumerate_fields(char *fmt)
         for (k = field; k < field + repcount; ++k) {
             result[k].typechar = c;
             result[k].size = item_size;
+            result[k].offset = offset;
+            result[k].convert = converter_for_type(c);
+            result[k].categories = NULL;
+            result[k].arena = NULL;
+            result[k].validity = NULL;
+            result[k].batch = NULL;
+            offset += item_size;
         }
         field += repcount;
     }
@@ -7,10 +7,31 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <pthread.h>
+#include <time.h>
+
 #include "file_buffer.h"
 
 #define DEFAULT_BUFFER_SIZE 16777216
 
+/*
+ *  The file is read in blocks of buffer_size bytes.  While the tokenizer
+ *  works on one block, a thread reads the next block into a second buffer
+ *  (read-ahead), so reading the file overlaps with parsing it.  The thread
+ *  is started when the second block is needed, so it is not used for a
+ *  file that fits in one block.
+ *
+ *  Each buffer has one byte before the data of the block.  When the
+ *  buffers are switched, the last byte of the old block (if it was not
+ *  read yet) is copied there, so a "\r\n" across the end of a block is
+ *  still seen as two consecutive bytes.
+ */
+
+/* States of the read-ahead. */
+#define READ_AHEAD_NONE      0  /* No block is being read. */
+#define READ_AHEAD_REQUESTED 1  /* The thread is reading the next block. */
+#define READ_AHEAD_READY     2  /* The next block is in next_buffer. */
+
 
 typedef struct _file_buffer {
 
@@ -37,17 +58,131 @@ typedef struct _file_buffer {
     /* Actual number of bytes in the current buffer. (Can be less than buffer_size.) */
     off_t last_pos;
 
-    /* Size (in bytes) of the buffer. */
+    /* Size (in bytes) of a block. */
     off_t buffer_size;
 
-    /* Pointer to the buffer. */
+    /* Pointer to the buffer (buffer_size + 1 bytes). */
     char *buffer;
 
+    /*
+     *  The read-ahead.  The thread fills next_buffer with the block at
+     *  next_file_pos.  The fields from next_file_pos to stop_thread are
+     *  protected by lock.  The buffers are only switched when the thread
+     *  is not reading.
+     */
+    char *next_buffer;
+    off_t next_file_pos;
+    size_t next_num_read;
+    int next_eof;
+    int read_ahead_state;
+    int stop_thread;
+
+    /* Boolean: has a block been requested from the thread?  (Not protected by lock.) */
+    int requested;
+
+    int thread_started;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    /* Time (in seconds) spent waiting for the read-ahead. */
+    double wait_time;
+
 } file_buffer;
 
 #define FB(fb)  ((file_buffer *)fb)
 
 
+/*
+ *  The read-ahead thread.
+ */
+
+static void *read_ahead(void *arg)
+{
+    file_buffer *fb = (file_buffer *) arg;
+    size_t num_read;
+    int eof;
+
+    pthread_mutex_lock(&(fb->lock));
+    while (1) {
+        while (fb->read_ahead_state != READ_AHEAD_REQUESTED && !fb->stop_thread) {
+            pthread_cond_wait(&(fb->cond), &(fb->lock));
+        }
+        if (fb->stop_thread) {
+            break;
+        }
+        pthread_mutex_unlock(&(fb->lock));
+
+        num_read = fread(fb->next_buffer + 1, 1, fb->buffer_size, fb->file);
+        eof = (num_read < fb->buffer_size) && feof(fb->file);
+
+        pthread_mutex_lock(&(fb->lock));
+        fb->next_num_read = num_read;
+        fb->next_eof = eof;
+        fb->read_ahead_state = READ_AHEAD_READY;
+        pthread_cond_broadcast(&(fb->cond));
+    }
+    pthread_mutex_unlock(&(fb->lock));
+    return NULL;
+}
+
+
+/*
+ *  Ask the thread to read the block at file position pos (which is the
+ *  current position of fb->file).  If the thread can't be started, there
+ *  is no read-ahead, and _fb_load() reads the block itself.
+ */
+
+static void request_block(file_buffer *fb, off_t pos)
+{
+    if (!fb->thread_started) {
+        if (pthread_create(&(fb->thread), NULL, read_ahead, fb) != 0) {
+            return;
+        }
+        fb->thread_started = 1;
+    }
+    pthread_mutex_lock(&(fb->lock));
+    fb->next_file_pos = pos;
+    fb->read_ahead_state = READ_AHEAD_REQUESTED;
+    pthread_cond_broadcast(&(fb->cond));
+    pthread_mutex_unlock(&(fb->lock));
+    fb->requested = 1;
+}
+
+
+/*
+ *  Wait until the thread is not reading the file.  fb->lock must be held.
+ */
+
+static void wait_for_thread(file_buffer *fb)
+{
+    struct timespec t0, t1;
+
+    if (fb->read_ahead_state == READ_AHEAD_REQUESTED) {
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        while (fb->read_ahead_state == READ_AHEAD_REQUESTED) {
+            pthread_cond_wait(&(fb->cond), &(fb->lock));
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        fb->wait_time += (t1.tv_sec - t0.tv_sec) + 1e-9 * (t1.tv_nsec - t0.tv_nsec);
+    }
+}
+
+
+/*
+ *  Wait until the thread has read the block that was requested.
+ */
+
+static void wait_for_block(file_buffer *fb)
+{
+    pthread_mutex_lock(&(fb->lock));
+    wait_for_thread(fb);
+    fb->read_ahead_state = READ_AHEAD_NONE;
+    pthread_mutex_unlock(&(fb->lock));
+    fb->requested = 0;
+}
+
+
 /*
  *  void *new_file_buffer(FILE *f, int buffer_size)
  *
@@ -62,7 +197,6 @@ void *new_file_buffer(FILE *f, int buffer_size)
 
     fb = (file_buffer *) malloc(sizeof(file_buffer));
     if (fb == NULL) {
-        fprintf(stderr, "new_file_buffer: malloc() failed.\n");
         return NULL;
     }
 
@@ -83,19 +217,39 @@ void *new_file_buffer(FILE *f, int buffer_size)
     }
 
     fb->buffer_size = buffer_size;
-    fb->buffer = malloc(fb->buffer_size);
-    if (fb->buffer == NULL) {
-        fprintf(stderr, "new_file_buffer: malloc() failed.\n");
+    fb->buffer = malloc(fb->buffer_size + 1);
+    fb->next_buffer = malloc(fb->buffer_size + 1);
+    if (fb->buffer == NULL || fb->next_buffer == NULL) {
+        free(fb->buffer);
+        free(fb->next_buffer);
         free(fb);
-        fb = NULL;
+        return NULL;
     }
 
+    fb->read_ahead_state = READ_AHEAD_NONE;
+    fb->stop_thread = 0;
+    fb->requested = 0;
+    fb->thread_started = 0;
+    fb->wait_time = 0.0;
+    pthread_mutex_init(&(fb->lock), NULL);
+    pthread_cond_init(&(fb->cond), NULL);
+
     return (void *) fb;
 }
 
 
 void del_file_buffer(void *fb, int restore)
 {
+    if (FB(fb)->thread_started) {
+        pthread_mutex_lock(&(FB(fb)->lock));
+        FB(fb)->stop_thread = 1;
+        pthread_cond_broadcast(&(FB(fb)->cond));
+        pthread_mutex_unlock(&(FB(fb)->lock));
+        pthread_join(FB(fb)->thread, NULL);
+    }
+    pthread_mutex_destroy(&(FB(fb)->lock));
+    pthread_cond_destroy(&(FB(fb)->cond));
+
     if (restore == RESTORE_INITIAL) {
         fseek(FB(fb)->file, FB(fb)->initial_file_pos, SEEK_SET);
     }
@@ -103,6 +257,7 @@ void del_file_buffer(void *fb, int restore)
         fseek(FB(fb)->file, FB(fb)->buffer_file_pos + FB(fb)->current_buffer_pos, SEEK_SET);
     }
     free(FB(fb)->buffer);
+    free(FB(fb)->next_buffer);
     free(fb);
 }
 
@@ -111,10 +266,24 @@ inline int line_number(void *fb)
     return FB(fb)->line_number;
 }
 
+
+void set_line_number(void *fb, int lineno)
+{
+    FB(fb)->line_number = lineno;
+}
+
+
+off_t buffer_position(void *fb)
+{
+    return FB(fb)->buffer_file_pos + FB(fb)->current_buffer_pos;
+}
+
 /*
  *  int _fb_load(void *fb)
  *
- *  Get data from the file into the buffer.
+ *  Get data from the file into the buffer, when all of it (or all but
+ *  the last byte) has been read.  The next block comes from the read-ahead
+ *  if there is one; otherwise it is read here.
  *
  */
 
@@ -124,26 +293,44 @@ int _fb_load(void *fb)
 
     if (!FB(fb)->reached_eof && (FB(fb)->current_buffer_pos == FB(fb)->last_pos || FB(fb)->current_buffer_pos+1 == FB(fb)->last_pos)) {
         size_t num_read;
+        off_t block_pos;
+        int eof;
         /* k will be either 0 or 1. */
         int k = FB(fb)->last_pos - FB(fb)->current_buffer_pos;
-        if (k) {
-            buffer[0] = buffer[FB(fb)->current_buffer_pos];
+        char c = k ? buffer[FB(fb)->current_buffer_pos] : 0;
+
+        if (FB(fb)->requested) {
+            char *tmp;
+            wait_for_block(FB(fb));
+            tmp = FB(fb)->buffer;
+            FB(fb)->buffer = buffer = FB(fb)->next_buffer;
+            FB(fb)->next_buffer = tmp;
+            block_pos = FB(fb)->next_file_pos;
+            num_read = FB(fb)->next_num_read;
+            eof = FB(fb)->next_eof;
+        }
+        else {
+            block_pos = ftell(FB(fb)->file);
+            num_read = fread(buffer + 1, 1, FB(fb)->buffer_size, FB(fb)->file);
+            eof = (num_read < FB(fb)->buffer_size) && feof(FB(fb)->file);
         }
 
-        FB(fb)->buffer_file_pos  = ftell(FB(fb)->file) - k;
-        
-        num_read = fread(&(buffer[k]), 1, FB(fb)->buffer_size - k, FB(fb)->file);
-
-        FB(fb)->current_buffer_pos = 0;
-        FB(fb)->last_pos = num_read + k;
-        if (num_read < FB(fb)->buffer_size - k) {
-            if (feof(FB(fb)->file)) {
+        /* The data is at buffer + 1, preceded by the unread byte (if any). */
+        buffer[0] = c;
+        FB(fb)->buffer_file_pos = block_pos - 1;
+        FB(fb)->current_buffer_pos = 1 - k;
+        FB(fb)->last_pos = 1 + num_read;
+        if (num_read < FB(fb)->buffer_size) {
+            if (eof) {
                 FB(fb)->reached_eof = 1;
             }
             else {
                 return FB_ERROR;
             }
         }
+        else {
+            request_block(FB(fb), block_pos + num_read);
+        }
     }
     return 0;
 }
@@ -164,9 +351,10 @@ int _fb_load(void *fb)
 int fetch(void *fb)
 {
     char c;
-    char *buffer = FB(fb)->buffer;
-  
+    char *buffer;
+
     _fb_load(fb);
+    buffer = FB(fb)->buffer;
 
     if (FB(fb)->current_buffer_pos == FB(fb)->last_pos)
         return FB_EOF;
@@ -222,3 +410,102 @@ void skipline(void *fb)
         fetch(fb);
     }
 }
+
+
+/*
+ *  int next_span(void *fb, char **p_start)
+ *
+ *  Returns the number of bytes in the buffer starting at the next
+ *  byte to read, and puts a pointer to that byte in *p_start.
+ */
+
+int next_span(void *fb, char **p_start)
+{
+    _fb_load(fb);
+    *p_start = FB(fb)->buffer + FB(fb)->current_buffer_pos;
+    return FB(fb)->last_pos - FB(fb)->current_buffer_pos;
+}
+
+
+/*
+ *  void skipbytes(void *fb, int n)
+ *
+ *  Advance the buffer pointer by n bytes.
+ */
+
+void skipbytes(void *fb, int n)
+{
+    FB(fb)->current_buffer_pos += n;
+}
+
+
+/*
+ *  int spans_are_stable(void *fb)
+ *
+ *  The buffer is overwritten when it is refilled.
+ */
+
+int spans_are_stable(void *fb)
+{
+    return 0;
+}
+
+
+/*
+ *  Random access is not available with this implementation.
+ */
+
+char *buffer_contents(void *fb, off_t *p_pos, off_t *p_size)
+{
+    return NULL;
+}
+
+
+void *new_file_buffer_at(void *fb, off_t pos)
+{
+    return NULL;
+}
+
+
+void buffer_seek(void *fb, off_t pos)
+{
+    if (FB(fb)->requested) {
+        /* Discard the block that is being read. */
+        wait_for_block(FB(fb));
+    }
+    fseek(FB(fb)->file, pos, SEEK_SET);
+    FB(fb)->buffer_file_pos = pos;
+    FB(fb)->current_buffer_pos = 0;
+    FB(fb)->last_pos = 0;
+    FB(fb)->reached_eof = 0;
+}
+
+
+/*
+ *  void buffer_sync(void *fb)
+ *
+ *  Wait until the read-ahead thread has finished reading the block that
+ *  was requested (if any).  The block is kept, and used when the buffer
+ *  needs it.
+ */
+
+void buffer_sync(void *fb)
+{
+    if (FB(fb)->requested) {
+        pthread_mutex_lock(&(FB(fb)->lock));
+        wait_for_thread(FB(fb));
+        pthread_mutex_unlock(&(FB(fb)->lock));
+    }
+}
+
+
+/*
+ *  double read_wait_time(void *fb)
+ *
+ *  Time spent waiting for the read-ahead thread.
+ */
+
+double read_wait_time(void *fb)
+{
+    return FB(fb)->wait_time;
+}
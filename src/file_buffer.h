@@ -1,5 +1,7 @@
 
 
+#include <sys/types.h>
+
 #define FB_EOF   -1
 #define FB_ERROR -2
 
@@ -10,7 +12,7 @@
 /*
  *  This is the API used to access a file.
  *  All the code in rows.c and tokenize.c accesses the
- *  file using these four functions.
+ *  file using these functions.
  *
  *  The pointer returned by new_file_buffer() is intentionally
  *  opaque.  An implementation of this interface may define it
@@ -18,6 +20,12 @@
  *
  */
 
+/*
+ *  new_file_buffer() reads f from its current position.  buffer_size is
+ *  the amount of the file to hold in memory at a time; if it is less than
+ *  1, the implementation chooses.  (The memory mapped implementation then
+ *  maps the rest of the file.)
+ */
 void *new_file_buffer(FILE *f, int buffer_size);
 
 /*
@@ -34,8 +42,75 @@ void *new_file_buffer(FILE *f, int buffer_size);
  */
 void del_file_buffer(void *fb, int restore);
 
+/*
+ *  line_number() returns the number of '\n' read so far.  set_line_number()
+ *  changes it, for a caller that moves the position with buffer_seek().
+ */
 int line_number(void *fb);
+void set_line_number(void *fb, int lineno);
+
+/*
+ *  buffer_position() returns the position in the file of the next unread
+ *  byte.  (It is used to report where a bad row starts.)
+ */
+off_t buffer_position(void *fb);
 
 int fetch(void *fb);
 int next(void *fb);
 void skipline(void *fb);
+
+/*
+ *  next_span() sets *p_start to point to the next unread byte, and
+ *  returns the number of bytes that can be read contiguously from there.
+ *  It does not advance the buffer pointer.  The return value is 0 at
+ *  the end of the file.  (The span is not translated like the result of
+ *  fetch(); a '\r\n' in the span is still two bytes.)
+ *
+ *  skipbytes() advances the buffer pointer by n bytes.  n must not be
+ *  more than the value returned by the last call to next_span(), and
+ *  the bytes that are skipped must not contain '\n'.
+ */
+int next_span(void *fb, char **p_start);
+void skipbytes(void *fb, int n);
+
+/*
+ *  spans_are_stable() returns true if the memory returned by next_span()
+ *  remains valid (and unchanged) until the file_buffer is deleted.  In
+ *  that case, the tokenizer returns fields that point into that memory
+ *  instead of copying them.
+ */
+int spans_are_stable(void *fb);
+
+/*
+ *  The following functions give random access to the file, for the
+ *  multi-threaded reader in parallel.c.  An implementation that can't
+ *  provide this returns NULL from buffer_contents() and new_file_buffer_at().
+ *
+ *  buffer_contents() returns a pointer to the first byte of the file,
+ *  and puts the position of the next unread byte in *p_pos and the size
+ *  of the file in *p_size.
+ *
+ *  new_file_buffer_at() creates another file_buffer for the same file,
+ *  positioned at pos.  It shares the memory of fb, so it must be deleted
+ *  (with RESTORE_NOT) before fb is deleted.
+ *
+ *  buffer_seek() moves the position of fb to pos.
+ */
+char *buffer_contents(void *fb, off_t *p_pos, off_t *p_size);
+void *new_file_buffer_at(void *fb, off_t pos);
+void buffer_seek(void *fb, off_t pos);
+
+/*
+ *  buffer_sync() waits until the implementation is not reading the file
+ *  in the background, so the FILE may be used (or closed) by other code
+ *  until the next call that reads from fb.
+ */
+void buffer_sync(void *fb);
+
+/*
+ *  read_wait_time() returns the time, in seconds, that the reader has
+ *  spent waiting for data from the file, when the implementation reads
+ *  the file in the background.  (It is 0 for the memory mapped
+ *  implementation, where the time is spent in page faults.)
+ */
+double read_wait_time(void *fb);
@@ -1,12 +1,25 @@
 
+/* For madvise().  (With _XOPEN_SOURCE, glibc only declares posix_madvise().) */
+#define _DEFAULT_SOURCE
+#define _BSD_SOURCE
+
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "file_buffer.h"
 
+/*
+ *  When the whole file is mapped, the pages behind the read position
+ *  are released in blocks of this size, and the next block is read ahead.
+ */
+#define ADVICE_BLOCK_SIZE 16777216
+
 
 typedef struct _file_buffer {
 
@@ -23,27 +36,175 @@ typedef struct _file_buffer {
     int fileno;
     off_t current_pos;
     off_t last_pos;
+
+    /*
+     *  memmap holds the bytes of the file from map_start (a multiple of
+     *  the page size) to map_end.  Byte pos of the file is
+     *  memmap[pos - map_start].
+     */
     char *memmap;
+    off_t map_start;
+    off_t map_end;
+
+    /*
+     *  Size of the window of the file that is mapped at a time, or 0 if
+     *  everything from the initial position to the end of the file is
+     *  mapped.
+     */
+    off_t window_size;
+
+    /* The pages before this position have been released. */
+    off_t released_pos;
+
+    /* Boolean: is memmap unmapped when this file_buffer is deleted? */
+    int owns_memmap;
 
 } file_buffer;
 
 #define FB(fb)  ((file_buffer *)fb)
 
+#define BYTE(fb, pos) (FB(fb)->memmap[(pos) - FB(fb)->map_start])
+
+
+/*
+ *  There are two ways to map the file:
+ *
+ *  * By default (buffer_size < 1 in new_file_buffer()), the file is
+ *    mapped from the page containing the initial position to the end of
+ *    the file.  The fields returned by the tokenizer point into the map,
+ *    and the multi-threaded reader can use it (see file_buffer.h).  As
+ *    the file is read, the OS is told to read ahead (MADV_WILLNEED), and
+ *    that the pages that have been read are no longer needed
+ *    (MADV_DONTNEED, and POSIX_FADV_DONTNEED for the page cache).  The
+ *    pages are still mapped, so a pointer into them stays valid; if they
+ *    are used again, they are read from the file again.
+ *
+ *  * If buffer_size is given, a window of that size (rounded up to
+ *    whole pages, at least two) is mapped, and moved along the file as
+ *    it is read.  The address space and memory used don't depend on the
+ *    size of the file, but the tokenizer has to copy the fields, and
+ *    the multi-threaded reader is not available.  The window is always
+ *    moved so that the next two bytes (e.g. "\r\n") are in it.
+ */
+
+
+static off_t page_size(void)
+{
+    return (off_t) sysconf(_SC_PAGESIZE);
+}
+
+
+/*
+ *  Tell the OS that the bytes of the file from start to end are no
+ *  longer needed in memory.
+ */
+
+static void release_pages(file_buffer *fb, off_t start, off_t end)
+{
+    if (end <= start) {
+        return;
+    }
+#ifdef POSIX_FADV_DONTNEED
+    posix_fadvise(fb->fileno, start, end - start, POSIX_FADV_DONTNEED);
+#endif
+}
+
+
+/*
+ *  int map_window(file_buffer *fb, off_t pos)
+ *
+ *  Map the window of the file that starts at the page containing pos.
+ *  Returns 0, or -1 if mmap() fails.  In that case nothing is mapped,
+ *  and fb->last_pos is set to pos, so the file appears to end at pos.
+ */
+
+static int map_window(file_buffer *fb, off_t pos)
+{
+    off_t start;
+    off_t length;
+
+    if (fb->memmap != NULL) {
+        munmap(fb->memmap, fb->map_end - fb->map_start);
+        release_pages(fb, fb->map_start, pos < fb->map_end ? pos : fb->map_end);
+        fb->memmap = NULL;
+    }
+
+    start = pos - pos % page_size();
+    length = fb->size - start;
+    if (length > fb->window_size) {
+        length = fb->window_size;
+    }
+    fb->map_start = start;
+    fb->map_end = start;
+    if (length <= 0) {
+        return 0;
+    }
+    fb->memmap = mmap(NULL, length, PROT_READ, MAP_SHARED, fb->fileno, start);
+    if (fb->memmap == MAP_FAILED) {
+        fb->memmap = NULL;
+        fb->last_pos = pos;
+        return -1;
+    }
+    fb->map_end = start + length;
+    madvise(fb->memmap, length, MADV_SEQUENTIAL);
+    madvise(fb->memmap, length, MADV_WILLNEED);
+    return 0;
+}
+
 
 /*
- * XXX Currently the entire file is memory mapped.  It might be better
- *     to map blocks of the file sequentially.  Or, as least advise the OS
- *     occasionally that pages that we're finished with can be released.
+ *  Make sure the next two bytes (if the file has them) are in the window.
  */
 
+static inline void update_window(file_buffer *fb)
+{
+    if (fb->window_size > 0 && (fb->current_pos < fb->map_start ||
+            (fb->current_pos + 2 > fb->map_end && fb->map_end < fb->last_pos))) {
+        map_window(fb, fb->current_pos);
+    }
+}
+
+
+/*
+ *  When the whole file is mapped: release the blocks that are behind the
+ *  read position (keeping the last one), and read ahead the next block.
+ */
+
+static void advise(file_buffer *fb)
+{
+    off_t end;
+    off_t k;
+
+    if (fb->window_size > 0 || !fb->owns_memmap || fb->memmap == NULL) {
+        return;
+    }
+    end = fb->current_pos - ADVICE_BLOCK_SIZE;
+    end -= end % page_size();
+    if (end - fb->released_pos >= ADVICE_BLOCK_SIZE) {
+        madvise(fb->memmap + (fb->released_pos - fb->map_start), end - fb->released_pos, MADV_DONTNEED);
+        release_pages(fb, fb->released_pos, end);
+        fb->released_pos = end;
+
+        k = fb->current_pos - fb->current_pos % page_size();
+        if (k < fb->map_end) {
+            madvise(fb->memmap + (k - fb->map_start),
+                    (fb->map_end - k < ADVICE_BLOCK_SIZE) ? fb->map_end - k : ADVICE_BLOCK_SIZE,
+                    MADV_WILLNEED);
+        }
+    }
+}
+
 
 /*
  *  void *new_file_buffer(FILE *f, int buffer_size)
  *
- *  Allocate a new file_buffer.
- *  Returns NULL if the memory allocation fails or if the call to mmap fails.
+ *  Allocate a new file_buffer, for reading f from its current position.
+ *  Returns NULL if fstat, the memory allocation or mmap fails.  Nothing is
+ *  printed; the caller reports the error.
  *
- *  buffer_size is ignored.
+ *  If buffer_size is less than 1, the rest of the file is mapped.
+ *  Otherwise, buffer_size is the size of the window of the file that is
+ *  mapped at a time (see the comments above).
  */
 
 void *new_file_buffer(FILE *f, int buffer_size)
@@ -51,20 +212,17 @@ void *new_file_buffer(FILE *f, int buffer_size)
     struct stat buf;
     int fd;
     file_buffer *fb;
-    off_t current_pos;
     off_t filesize;
+    off_t pos;
 
     fd = fileno(f);
     if (fstat(fd, &buf) == -1) {
-        fprintf(stderr, "new_file_buffer: fstat() failed. errno =%d\n", errno);
         return NULL;
     }
     filesize = buf.st_size;  /* XXX This might be 32 bits. */
 
     fb = (file_buffer *) malloc(sizeof(file_buffer));
     if (fb == NULL) {
-        /* XXX Eventually remove this print statement. */
-        fprintf(stderr, "new_file_buffer: malloc() failed.\n");
         return NULL;
     }
     fb->file = f;
@@ -72,15 +230,33 @@ void *new_file_buffer(FILE *f, int buffer_size)
     fb->line_number = 0;  // XXX Maybe more natural to start at 1?
 
     fb->fileno = fd;
-    fb->current_pos = ftell(f);
+    pos = ftell(f);
+    fb->initial_file_pos = pos;
+    fb->current_pos = pos;
     fb->last_pos = (off_t) filesize;
+    fb->released_pos = pos - pos % page_size();
 
-    fb->memmap = mmap(NULL, filesize, PROT_READ, MAP_SHARED, fd, 0);
-    if (fb->memmap == NULL) {
-        /* XXX Eventually remove this print statement. */
-        fprintf(stderr, "new_file_buffer: mmap() failed.\n");
+    if (buffer_size < 1) {
+        /* Map everything from the page containing pos to the end of the file. */
+        fb->window_size = filesize;
+    }
+    else {
+        /* A whole number of pages, and at least two. */
+        fb->window_size = buffer_size + page_size() - 1;
+        fb->window_size -= fb->window_size % page_size();
+        if (fb->window_size < 2 * page_size()) {
+            fb->window_size = 2 * page_size();
+        }
+    }
+
+    fb->owns_memmap = 1;
+    fb->memmap = NULL;
+    if (map_window(fb, pos) == -1) {
         free(fb);
-        fb = NULL;
+        return NULL;
+    }
+    if (buffer_size < 1) {
+        fb->window_size = 0;
     }
 
     return fb;
@@ -89,7 +265,9 @@ void *new_file_buffer(FILE *f, int buffer_size)
 
 void del_file_buffer(void *fb, int restore)
 {
-    munmap(FB(fb)->memmap, FB(fb)->size);
+    if (FB(fb)->owns_memmap && FB(fb)->memmap != NULL) {
+        munmap(FB(fb)->memmap, FB(fb)->map_end - FB(fb)->map_start);
+    }
 
     /*
      *  With a memory mapped file, there is no need to do
@@ -107,6 +285,18 @@ inline int line_number(void *fb)
     return FB(fb)->line_number;
 }
 
+
+void set_line_number(void *fb, int lineno)
+{
+    FB(fb)->line_number = lineno;
+}
+
+
+off_t buffer_position(void *fb)
+{
+    return FB(fb)->current_pos;
+}
+
 /*
  *  int fetch(void *fb)
  *
@@ -122,17 +312,18 @@ inline int line_number(void *fb)
 int fetch(void *fb)
 {
     char c;
-    
+
+    update_window(FB(fb));
     if (FB(fb)->current_pos == FB(fb)->last_pos) {
         return FB_EOF;
     }
 
-    if (FB(fb)->current_pos + 1 < FB(fb)->last_pos && FB(fb)->memmap[FB(fb)->current_pos] == '\r'
-          && FB(fb)->memmap[FB(fb)->current_pos + 1] == '\n') {
+    if (FB(fb)->current_pos + 1 < FB(fb)->last_pos && BYTE(fb, FB(fb)->current_pos) == '\r'
+          && BYTE(fb, FB(fb)->current_pos + 1) == '\n') {
         c = '\n';
         FB(fb)->current_pos += 2;
     } else {
-        c = FB(fb)->memmap[FB(fb)->current_pos];
+        c = BYTE(fb, FB(fb)->current_pos);
         FB(fb)->current_pos += 1;
     }
     if (c == '\n') {
@@ -150,10 +341,11 @@ int fetch(void *fb)
 
 int next(void *fb)
 {
+    update_window(FB(fb));
     if (FB(fb)->current_pos + 1 >= FB(fb)->last_pos)
         return FB_EOF;
     else
-        return FB(fb)->memmap[FB(fb)->current_pos];
+        return BYTE(fb, FB(fb)->current_pos);
 }
 
 
@@ -172,3 +364,138 @@ void skipline(void *fb)
         fetch(fb);
     }
 }
+
+
+/*
+ *  int next_span(void *fb, char **p_start)
+ *
+ *  Returns the number of bytes from the next byte to read to the end
+ *  of the mapped part of the file, and puts a pointer to that byte in
+ *  *p_start.
+ *
+ *  XXX The result is an int, so at most INT_MAX bytes are returned.
+ */
+
+int next_span(void *fb, char **p_start)
+{
+    off_t n;
+
+    update_window(FB(fb));
+    if (FB(fb)->window_size == 0 && FB(fb)->current_pos >= FB(fb)->released_pos + 2 * ADVICE_BLOCK_SIZE) {
+        advise(FB(fb));
+    }
+    n = FB(fb)->map_end - FB(fb)->current_pos;
+    if (n > FB(fb)->last_pos - FB(fb)->current_pos) {
+        n = FB(fb)->last_pos - FB(fb)->current_pos;
+    }
+    if (n <= 0) {
+        *p_start = NULL;
+        return 0;
+    }
+    *p_start = &BYTE(fb, FB(fb)->current_pos);
+    if (n > INT_MAX) {
+        n = INT_MAX;
+    }
+    return (int) n;
+}
+
+
+/*
+ *  void skipbytes(void *fb, int n)
+ *
+ *  Advance the buffer pointer by n bytes.
+ */
+
+void skipbytes(void *fb, int n)
+{
+    FB(fb)->current_pos += n;
+}
+
+
+/*
+ *  int spans_are_stable(void *fb)
+ *
+ *  When the rest of the file is mapped, the memory map is not changed
+ *  until the file_buffer is deleted.  A window is replaced as it moves.
+ */
+
+int spans_are_stable(void *fb)
+{
+    return FB(fb)->window_size == 0;
+}
+
+
+/*
+ *  char *buffer_contents(void *fb, off_t *p_pos, off_t *p_size)
+ *
+ *  When the rest of the file is mapped, this returns the memory map,
+ *  offset so that the result can be indexed with positions in the file.
+ *  (Only the positions from the initial position of fb are valid.)
+ *  Random access is not available when a window is mapped.
+ */
+
+char *buffer_contents(void *fb, off_t *p_pos, off_t *p_size)
+{
+    if (FB(fb)->window_size > 0 || FB(fb)->memmap == NULL) {
+        return NULL;
+    }
+    *p_pos = FB(fb)->current_pos;
+    *p_size = FB(fb)->last_pos;
+    return FB(fb)->memmap - FB(fb)->map_start;
+}
+
+
+/*
+ *  void *new_file_buffer_at(void *fb, off_t pos)
+ *
+ *  Create a file_buffer that shares the memory map of fb, starting at pos.
+ *  Returns NULL if the memory allocation fails, or if fb maps a window.
+ */
+
+void *new_file_buffer_at(void *fb, off_t pos)
+{
+    file_buffer *new_fb;
+
+    if (FB(fb)->window_size > 0) {
+        return NULL;
+    }
+    new_fb = (file_buffer *) malloc(sizeof(file_buffer));
+    if (new_fb == NULL) {
+        return NULL;
+    }
+    *new_fb = *FB(fb);
+    new_fb->line_number = 0;
+    new_fb->current_pos = pos;
+    new_fb->owns_memmap = 0;
+    return new_fb;
+}
+
+
+void buffer_seek(void *fb, off_t pos)
+{
+    FB(fb)->current_pos = pos;
+}
+
+
+/*
+ *  void buffer_sync(void *fb)
+ *
+ *  The file is not read in the background, so there is nothing to wait
+ *  for.
+ */
+
+void buffer_sync(void *fb)
+{
+}
+
+
+/*
+ *  double read_wait_time(void *fb)
+ *
+ *  The time spent in page faults is not measured.
+ */
+
+double read_wait_time(void *fb)
+{
+    return 0.0;
+}
@@ -0,0 +1,553 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "constants.h"
+#include "error_types.h"
+#include "field_type.h"
+#include "conversions.h"
+#include "datetime.h"
+#include "file_buffer.h"
+#include "tokenize.h"
+#include "validity.h"
+#include "infer.h"
+
+
+/*
+ *  Inference of the types of the columns of a file.
+ *
+ *  The type of a value is the first of these that the converters accept:
+ *  a 64 bit integer (narrowed to the smallest integer type that holds
+ *  it), a double, a datetime (in the datetime format of the read), a
+ *  complex, and finally a string.  The type of a column is the smallest
+ *  type that holds all its values: integers widen to larger integers,
+ *  then to double and complex; datetimes widen to finer units; anything
+ *  else becomes a string.  Empty fields say nothing about the type.
+ *
+ *  infer_format() guesses the types from a sample of the rows.  The rest
+ *  of the file may not agree with the sample, so the reader can promote
+ *  the type of a field while it reads (see reader_read()); widen_value()
+ *  converts the values that were read before the promotion.
+ */
+
+/*
+ *  Rows are sampled at this many positions spread across the file (when
+ *  the file buffer gives random access to the file), in addition to the
+ *  rows at the start of the data.
+ */
+#define NUM_SAMPLE_POSITIONS 16
+
+/*
+ *  A sample position is only used if the quotes are balanced on each line
+ *  of this many bytes after it (see balanced_quotes()).
+ */
+#define SAMPLE_WINDOW 65536
+
+
+#define IS_INT(c) ((c) == 'b' || (c) == 'h' || (c) == 'i' || (c) == 'q')
+#define IS_DATETIME(c) ((c) == 'D' || (c) == 'T' || (c) == 'U' || (c) == 'N')
+
+
+/*
+ *  Order of the integer and datetime types (from narrowest to widest).
+ */
+
+static int rank(char typechar)
+{
+    switch (typechar) {
+        case 'b': case 'D': return 0;
+        case 'h': case 'T': return 1;
+        case 'i': case 'U': return 2;
+        default:            return 3;
+    }
+}
+
+
+/*
+ *  The length of the longest string that widen_value() writes for a
+ *  value of the given type.
+ */
+
+static int text_width(char typechar, int size)
+{
+    switch (typechar) {
+        case 'b': return 4;
+        case 'h': return 6;
+        case 'i': return 11;
+        case 'q': return 20;
+        case 'd': return 24;
+        case 'z': return 49;
+        case 'D': return 10;
+        case 'T': return 19;
+        case 'U': return 26;
+        case 'N': return 29;
+    }
+    return size;
+}
+
+
+static int has_digit(char *start, int length)
+{
+    int k;
+
+    for (k = 0; k < length; ++k) {
+        if (start[k] >= '0' && start[k] <= '9') {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+
+/*
+ *  The type of one (non-empty) value.
+ */
+
+static void value_type(type_guess *v, char *start, int length, conversion_options *options)
+{
+    field_type ft;
+    char value[16];
+    int64_t x;
+
+    ft.categories = NULL;
+    ft.arena = NULL;
+    ft.validity = NULL;
+    ft.batch = NULL;
+    ft.size = 8;
+    v->size = 8;
+
+    if (converter_for_type('q')(start, length, &ft, options, value) == 0) {
+        memcpy(&x, value, 8);
+        if (x >= INT8_MIN && x <= INT8_MAX) {
+            v->typechar = 'b';
+            v->size = 1;
+        }
+        else if (x >= INT16_MIN && x <= INT16_MAX) {
+            v->typechar = 'h';
+            v->size = 2;
+        }
+        else if (x >= INT32_MIN && x <= INT32_MAX) {
+            v->typechar = 'i';
+            v->size = 4;
+        }
+        else {
+            v->typechar = 'q';
+        }
+        return;
+    }
+    if (converter_for_type('d')(start, length, &ft, options, value) == 0) {
+        v->typechar = 'd';
+        return;
+    }
+    if (converter_for_type('U')(start, length, &ft, options, value) == 0) {
+        // Days only if the format has no time; otherwise the finest unit needed.
+        memcpy(&x, value, 8);
+        if (x % 1000000 != 0) {
+            v->typechar = 'U';
+        }
+        else {
+            v->typechar = (options->datetime_layout == DATETIME_LAYOUT_DATE) ? 'D' : 'T';
+        }
+        return;
+    }
+    // The complex converter accepts a bare "j" (or "i"); that is more likely text.
+    ft.size = 16;
+    if (has_digit(start, length) &&
+            converter_for_type('z')(start, length, &ft, options, value) == 0) {
+        v->typechar = 'z';
+        v->size = 16;
+        return;
+    }
+    v->typechar = 's';
+    v->size = length;
+}
+
+
+/*
+ *  void guess_type(type_guess *g, char *start, int length,
+ *                  conversion_options *options)
+ *
+ *  Widen the type g to hold the value in the length bytes at start.
+ */
+
+void guess_type(type_guess *g, char *start, int length, conversion_options *options)
+{
+    type_guess v;
+
+    if (length == 0) {
+        return;
+    }
+    value_type(&v, start, length, options);
+
+    if (g->typechar == 0) {
+        *g = v;
+    }
+    else if (g->typechar == 's' || v.typechar == 's' ||
+             IS_DATETIME(g->typechar) != IS_DATETIME(v.typechar)) {
+        int a = text_width(g->typechar, g->size);
+        int b = text_width(v.typechar, v.size);
+        g->typechar = 's';
+        g->size = (a > b) ? a : b;
+    }
+    else if (g->typechar == 'z' || v.typechar == 'z') {
+        g->typechar = 'z';
+        g->size = 16;
+    }
+    else if (g->typechar == 'd' || v.typechar == 'd') {
+        g->typechar = 'd';
+        g->size = 8;
+    }
+    else if (rank(v.typechar) > rank(g->typechar)) {
+        /* Both integers or both datetimes. */
+        *g = v;
+    }
+}
+
+
+/*
+ *  int can_promote(char typechar)
+ *
+ *  Boolean: can guess_type() and widen_value() handle a field of this type?
+ */
+
+int can_promote(char typechar)
+{
+    return IS_INT(typechar) || IS_DATETIME(typechar) ||
+           typechar == 'd' || typechar == 'z' || typechar == 's';
+}
+
+
+static int64_t int_value(char typechar, char *value)
+{
+    switch (typechar) {
+        case 'b': return *(int8_t *) value;
+        case 'h': return *(int16_t *) value;
+        case 'i': return *(int32_t *) value;
+    }
+    return *(int64_t *) value;
+}
+
+
+/*
+ *  Write the double x with the fewest digits that give x back.  NaN
+ *  (the value of an empty field) is written as an empty string.
+ */
+
+static int format_double(double x, char *buf, int size)
+{
+    int precision, n = 0;
+
+    if (isnan(x)) {
+        buf[0] = '\0';
+        return 0;
+    }
+    for (precision = 15; precision <= 17; ++precision) {
+        n = snprintf(buf, size, "%.*g", precision, x);
+        if (strtod(buf, NULL) == x) {
+            break;
+        }
+    }
+    return n;
+}
+
+
+/*
+ *  void widen_value(char from_typechar, int from_size,
+ *                   char to_typechar, int to_size, char *src, char *dst)
+ *
+ *  Convert the value at src, of the type from_typechar (from_size bytes),
+ *  to the type to_typechar (to_size bytes), and store it at dst.  The new
+ *  type must be one that guess_type() widens the old type to, so to_size
+ *  is at least from_size.  src and dst may overlap.  A number or datetime
+ *  becomes a string in the form that the converters read back (so e.g.
+ *  "1.50" in the file becomes "1.5").
+ */
+
+void widen_value(char from_typechar, int from_size, char to_typechar, int to_size,
+                 char *src, char *dst)
+{
+    char value[16];
+    char text[64];
+    int64_t x;
+    double d[2];
+    int n;
+
+    if (from_typechar == 's') {
+        memmove(dst, src, from_size);
+        memset(dst + from_size, 0, to_size - from_size);
+        return;
+    }
+    memcpy(value, src, from_size);
+
+    if (to_typechar == 's') {
+        if (IS_INT(from_typechar)) {
+            n = snprintf(text, sizeof(text), "%lld", (long long) int_value(from_typechar, value));
+        }
+        else if (from_typechar == 'd') {
+            n = format_double(*(double *) value, text, sizeof(text));
+        }
+        else if (from_typechar == 'z') {
+            n = format_double(((double *) value)[0], text, 25);
+            if (((double *) value)[1] >= 0) {
+                text[n++] = '+';
+            }
+            n += format_double(((double *) value)[1], text + n, 25);
+            text[n++] = 'j';
+        }
+        else {
+            n = format_datetime(*(int64_t *) value, from_typechar, text, sizeof(text));
+        }
+        if (n > to_size) {
+            n = to_size;
+        }
+        memcpy(dst, text, n);
+        memset(dst + n, 0, to_size - n);
+    }
+    else if (IS_INT(from_typechar)) {
+        x = int_value(from_typechar, value);
+        switch (to_typechar) {
+            case 'h': *(int16_t *) dst = (int16_t) x; break;
+            case 'i': *(int32_t *) dst = (int32_t) x; break;
+            case 'q': *(int64_t *) dst = x; break;
+            case 'd': *(double *) dst = (double) x; break;
+            case 'z':
+                d[0] = (double) x;
+                d[1] = 0.0;
+                memcpy(dst, d, 16);
+                break;
+        }
+    }
+    else if (from_typechar == 'd') {
+        /* to_typechar is 'z'. */
+        d[0] = *(double *) value;
+        d[1] = 0.0;
+        memcpy(dst, d, 16);
+    }
+    else if (IS_DATETIME(from_typechar)) {
+        static const int64_t per_day[] = {1, 86400, 86400000000LL, 86400000000000LL};
+        x = *(int64_t *) value;
+        *(int64_t *) dst = x * (per_day[rank(to_typechar)] / per_day[rank(from_typechar)]);
+    }
+}
+
+
+/*
+ *  Boolean: does each complete line of the n bytes at p have an even
+ *  number of quote characters?  If so, p is very likely the start of a
+ *  row, not a position inside a quoted field with embedded newlines.
+ */
+
+static int balanced_quotes(const char *p, off_t n, char quote)
+{
+    int count = 0;
+    off_t k;
+
+    if (quote == 0) {
+        return TRUE;
+    }
+    for (k = 0; k < n; ++k) {
+        if (p[k] == quote) {
+            ++count;
+        }
+        else if (p[k] == '\n') {
+            if (count % 2 != 0) {
+                return FALSE;
+            }
+            count = 0;
+        }
+    }
+    return TRUE;
+}
+
+
+/*
+ *  Tokenize up to max_rows rows, and widen the guesses with their fields.
+ *  Rows with a number of fields other than *p_num_fields are ignored; if
+ *  *p_num_fields is 0, it is set (and the guesses allocated) from the
+ *  first row.  Values that are NA tokens of na (if it is not NULL) are
+ *  ignored, like empty fields.  Returns 0, or -1 if out of memory.
+ */
+
+static int sample_rows_at(void *fb, row_buffer *rb, int max_rows,
+                          char delimiter, char quote, char comment,
+                          int allow_embedded_newline, conversion_options *options,
+                          na_set *na, type_guess **p_guesses, int *p_num_fields)
+{
+    int num_fields, n, k;
+    int tok_error_type;
+
+    for (n = 0; n < max_rows; ++n) {
+        num_fields = tokenize(fb, rb, delimiter, quote, comment,
+                              allow_embedded_newline, &tok_error_type);
+        if (num_fields == 0) {
+            break;
+        }
+        if (*p_num_fields == 0) {
+            *p_guesses = (type_guess *) calloc(num_fields, sizeof(type_guess));
+            if (*p_guesses == NULL) {
+                return -1;
+            }
+            *p_num_fields = num_fields;
+        }
+        if (num_fields != *p_num_fields) {
+            continue;
+        }
+        for (k = 0; k < num_fields; ++k) {
+            field_span *span = &(rb->words[k]);
+            if (na == NULL || !is_na_token(na, span->start, span->length)) {
+                guess_type(&((*p_guesses)[k]), span->start, span->length, options);
+            }
+        }
+    }
+    return 0;
+}
+
+
+/*
+ *  char *infer_format(FILE *f, char delimiter, char quote, char comment,
+ *                     char sci, char decimal,
+ *                     int allow_embedded_newline,
+ *                     char *datetime_fmt,
+ *                     int tz_offset,
+ *                     int skiprows, int sample_rows, na_set *na,
+ *                     int *p_error_type)
+ *
+ *  Guess the types of all the fields of the rows of f, after the first
+ *  skiprows rows, from a sample of about sample_rows rows, and return
+ *  them as a format (see fields.c), e.g. "hd12sT".  A field that is empty
+ *  in all the sampled rows is 'd'.  The NA tokens of na (which may be
+ *  NULL) are treated as empty fields.  The other arguments are the same as
+ *  those of read_rows().  The position of f is not changed.
+ *
+ *  Half of the sample is the first rows of the data.  If the file buffer
+ *  gives random access to the file (see file_buffer.h), the other half is
+ *  taken from NUM_SAMPLE_POSITIONS positions spread across the rest of
+ *  the file, so the file is not read in full; otherwise the whole sample
+ *  is taken from the start.  Since the rest of the file may still have
+ *  values that don't fit the types, the format is meant to be read with
+ *  type promotion (see read_rows()).
+ *
+ *  Returns a string that the caller must free(), or NULL if there is an
+ *  error: ERROR_NO_DATA if there are no rows after skiprows, or
+ *  ERROR_OUT_OF_MEMORY.
+ */
+
+char *infer_format(FILE *f, char delimiter, char quote, char comment,
+                   char sci, char decimal,
+                   int allow_embedded_newline,
+                   char *datetime_fmt,
+                   int tz_offset,
+                   int skiprows, int sample_rows, na_set *na,
+                   int *p_error_type)
+{
+    void *fb;
+    row_buffer rb;
+    conversion_options options;
+    type_guess *guesses = NULL;
+    int num_fields = 0;
+    int rows_per_position, tok_error_type;
+    char *contents, *fmt, *p;
+    off_t pos, size;
+    int k, m;
+
+    *p_error_type = 0;
+    if (sample_rows < 2) {
+        sample_rows = 2;
+    }
+
+    options.sci = sci;
+    options.decimal = decimal;
+    if (datetime_fmt == NULL || strlen(datetime_fmt) == 0) {
+        datetime_fmt = "%Y-%m-%d %H:%M:%S";
+    }
+    options.datetime_fmt = datetime_fmt;
+    options.tz_offset = tz_offset;
+    set_datetime_layout(&options);
+
+    fb = new_file_buffer(f, -1);
+    if (fb == NULL) {
+        *p_error_type = ERROR_OUT_OF_MEMORY;
+        return NULL;
+    }
+    if (init_row_buffer(&rb) != 0) {
+        del_file_buffer(fb, RESTORE_INITIAL);
+        *p_error_type = ERROR_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    set_projection(&rb, NULL, 0, -1);
+    while (skiprows > 0 && tokenize(fb, &rb, delimiter, quote, comment,
+                                    allow_embedded_newline, &tok_error_type) > 0) {
+        --skiprows;
+    }
+    clear_projection(&rb);
+
+    if (sample_rows_at(fb, &rb, sample_rows - sample_rows / 2, delimiter, quote, comment,
+                       allow_embedded_newline, &options, na, &guesses, &num_fields) != 0) {
+        goto out_of_memory;
+    }
+    if (num_fields == 0) {
+        free_row_buffer(&rb);
+        del_file_buffer(fb, RESTORE_INITIAL);
+        *p_error_type = ERROR_NO_DATA;
+        return NULL;
+    }
+
+    contents = buffer_contents(fb, &pos, &size);
+    rows_per_position = sample_rows / 2 / NUM_SAMPLE_POSITIONS;
+    if (rows_per_position < 1) {
+        rows_per_position = 1;
+    }
+    for (m = 1; contents != NULL && m <= NUM_SAMPLE_POSITIONS; ++m) {
+        off_t start = pos + (size - pos) / (NUM_SAMPLE_POSITIONS + 1) * m;
+        off_t window;
+        p = memchr(contents + start, '\n', size - start);
+        if (p == NULL) {
+            break;
+        }
+        start = (p - contents) + 1;
+        window = (size - start < SAMPLE_WINDOW) ? size - start : SAMPLE_WINDOW;
+        if (!balanced_quotes(contents + start, window, quote)) {
+            continue;
+        }
+        buffer_seek(fb, start);
+        if (sample_rows_at(fb, &rb, rows_per_position, delimiter, quote, comment,
+                           allow_embedded_newline, &options, na, &guesses, &num_fields) != 0) {
+            goto out_of_memory;
+        }
+    }
+
+    /* At most 11 characters per field ("2147483647s"). */
+    fmt = (char *) malloc(num_fields * 11 + 1);
+    if (fmt == NULL) {
+        goto out_of_memory;
+    }
+    p = fmt;
+    for (k = 0; k < num_fields; ++k) {
+        if (guesses[k].typechar == 0) {
+            *p++ = 'd';
+        }
+        else if (guesses[k].typechar == 's') {
+            p += sprintf(p, "%ds", guesses[k].size);
+        }
+        else {
+            *p++ = guesses[k].typechar;
+        }
+    }
+    *p = '\0';
+
+    free(guesses);
+    free_row_buffer(&rb);
+    del_file_buffer(fb, RESTORE_INITIAL);
+    return fmt;
+
+out_of_memory:
+    free(guesses);
+    free_row_buffer(&rb);
+    del_file_buffer(fb, RESTORE_INITIAL);
+    *p_error_type = ERROR_OUT_OF_MEMORY;
+    return NULL;
+}
@@ -0,0 +1,39 @@
+#ifndef INFER_H
+#define INFER_H
+
+#include <stdio.h>
+
+#include "field_type.h"
+#include "validity.h"
+
+/*
+ *  The type of a column, as inferred from its values: typechar is a
+ *  format character (see fields.c), or 0 if no value has been seen yet,
+ *  and size is the size of the field.  The types that are inferred are
+ *  'b', 'h', 'i', 'q' (the smallest integer that holds the values), 'd',
+ *  'z', a datetime ('D', 'T' or 'U', in the datetime format of the read)
+ *  and 's' (size is the length of the longest string).  See infer.c.
+ */
+
+typedef struct _type_guess {
+    char typechar;
+    int size;
+} type_guess;
+
+
+void guess_type(type_guess *g, char *start, int length, conversion_options *options);
+
+int can_promote(char typechar);
+
+void widen_value(char from_typechar, int from_size, char to_typechar, int to_size,
+                 char *src, char *dst);
+
+char *infer_format(FILE *f, char delimiter, char quote, char comment,
+                   char sci, char decimal,
+                   int allow_embedded_newline,
+                   char *datetime_fmt,
+                   int tz_offset,
+                   int skiprows, int sample_rows, na_set *na,
+                   int *p_error_type);
+
+#endif
@@ -0,0 +1,531 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "file_buffer.h"
+#include "tokenize.h"
+#include "scan.h"
+#include "sizes.h"
+#include "constants.h"
+#include "error_types.h"
+#include "rows.h"
+#include "validity.h"
+#include "parallel.h"
+
+
+/*
+ *  Multi-threaded version of the main loop of read_rows().
+ *
+ *  The part of the file that has not been read yet is split into byte
+ *  ranges ("chunks"), one per thread.  Each range is extended to end just
+ *  after a newline.  A newline may be inside a quoted field, though, so
+ *  the start of a chunk is not necessarily the start of a row.  The rows
+ *  are found in two passes:
+ *
+ *  1. Each thread scans its chunk for the row boundaries, twice: once
+ *     assuming the chunk starts at the beginning of a row, and once
+ *     assuming it starts inside a quoted field.  The scan only looks at
+ *     the quote, comment and newline characters, so it is much faster
+ *     than tokenizing.  After the threads finish, the results are chained
+ *     together from the first chunk (where the state is known) to select
+ *     the correct scan of each chunk.  This gives the position of the
+ *     first row in each chunk, the number of rows in it, and so the index
+ *     of the row in the output at which each chunk starts.
+ *
+ *  2. Each thread tokenizes and converts the rows of its chunk, writing
+ *     directly into the output.
+ *
+ *  The scan in the first pass is a simplified model of the tokenizer.  In
+ *  the unusual cases where it doesn't agree with the tokenizer, the checks
+ *  after the second pass fail (the end of the rows read by one thread must
+ *  be the start of the rows of the next thread), and read_rows_parallel()
+ *  returns -1.  Errors in the data (such as a change in the number of
+ *  fields, or a field that can't be converted) also make it return -1.
+ *  The caller then reads the rows with the single-threaded loop, so the
+ *  results and error reports are always the same as those of the
+ *  single-threaded reader.
+ */
+
+/*
+ *  Each thread gets at least this many bytes of the file.
+ */
+#define MIN_CHUNK_SIZE 1048576
+
+#define MAX_NUM_THREADS 256
+
+
+typedef struct _parallel_read {
+
+    void *fb;
+    char *contents;
+    off_t size;
+
+    char delimiter;
+    char quote;
+    char comment;
+    int allow_embedded_newline;
+    int num_fields;
+
+    field_type *ftypes;
+    int *valid_usecols;
+    int num_usecols;
+    conversion_options *options;
+
+    int row_size;
+    int columnar;
+    /* The data (see reader_read()). */
+    char **data;
+
+} parallel_read;
+
+
+typedef struct _chunk {
+
+    parallel_read *pr;
+
+    /* The byte range of the chunk. */
+    off_t begin;
+    off_t end;
+
+    /* Boolean: is this the first chunk?  (Its starting state is known.) */
+    int is_first;
+
+    /*
+     *  Results of the first pass, starting at the beginning of a row
+     *  (scan[0]) and inside a quoted field (scan[1]).
+     */
+    chunk_scan scan[2];
+
+    /* The rows to read in the second pass. */
+    off_t first_row;
+    int row_offset;
+    int num_rows;
+
+    /* Boolean: check that there are no more rows after this chunk. */
+    int check_end;
+
+    /*
+     *  The fields, with a validity bitmap of the rows of this chunk for
+     *  each field that has one (see merge_masks()), or NULL if no field
+     *  has a bitmap.
+     */
+    field_type *ftypes;
+
+    /*
+     *  Results of the second pass: the position after the rows read, and
+     *  the number of '\n' read (see line_number()).
+     */
+    off_t end_pos;
+    int num_lines;
+    int failed;
+
+} chunk;
+
+
+/*
+ *  First pass: scan a chunk for rows.
+ */
+
+static void *scan_chunk(void *arg)
+{
+    chunk *ch = (chunk *) arg;
+
+    parallel_read *pr = ch->pr;
+
+    scan_rows(pr->contents, pr->size, pr->delimiter, pr->quote, pr->comment,
+              ch->begin, ch->end, SCAN_ROW_START, -1, &(ch->scan[0]));
+    if (!ch->is_first) {
+        scan_rows(pr->contents, pr->size, pr->delimiter, pr->quote, pr->comment,
+                  ch->begin, ch->end, SCAN_QUOTED, -1, &(ch->scan[1]));
+    }
+    return NULL;
+}
+
+
+/*
+ *  Second pass: tokenize and convert the rows of a chunk.
+ */
+
+static void *read_chunk(void *arg)
+{
+    chunk *ch = (chunk *) arg;
+    parallel_read *pr = ch->pr;
+    field_type *ftypes = (ch->ftypes != NULL) ? ch->ftypes : pr->ftypes;
+    void *fb;
+    size_t row;
+    int error;
+    row_buffer rb;
+    int num_fields;
+    int tok_error_type;
+    off_t size;
+    int k;
+
+    fb = new_file_buffer_at(pr->fb, ch->first_row);
+    if (fb == NULL) {
+        ch->failed = TRUE;
+        return NULL;
+    }
+    if (init_row_buffer(&rb) != 0) {
+        del_file_buffer(fb, RESTORE_NOT);
+        ch->failed = TRUE;
+        return NULL;
+    }
+    set_projection(&rb, pr->valid_usecols, pr->num_usecols, pr->num_fields);
+
+    row = (size_t) ch->row_offset;
+    for (k = 0; k < ch->num_rows; ++k) {
+        num_fields = tokenize(fb, &rb, pr->delimiter, pr->quote, pr->comment,
+                              TRUE, &tok_error_type);
+        if (num_fields != pr->num_fields) {
+            ch->failed = TRUE;
+            break;
+        }
+        if (pr->columnar) {
+            error = convert_columns(rb.words, ftypes, pr->valid_usecols, pr->num_usecols,
+                                    pr->options, pr->data, row, NULL);
+        }
+        else {
+            error = convert_row(rb.words, ftypes, pr->valid_usecols, pr->num_usecols,
+                                pr->options, *(pr->data) + row * pr->row_size, row, NULL);
+        }
+        if (error != 0) {
+            /*
+             *  Let the single-threaded loop read the rows again, so it
+             *  reports the error with its line number.
+             */
+            ch->failed = TRUE;
+            break;
+        }
+        ++row;
+    }
+
+    if (!ch->failed && ch->check_end) {
+        /*
+         *  There should be no more rows.  (This also skips trailing comments,
+         *  so the final position is the same as that of the single-threaded loop.)
+         */
+        num_fields = tokenize(fb, &rb, pr->delimiter, pr->quote, pr->comment,
+                              TRUE, &tok_error_type);
+        if (num_fields != 0 || tok_error_type != ERROR_NO_DATA) {
+            ch->failed = TRUE;
+        }
+    }
+
+    buffer_contents(fb, &(ch->end_pos), &size);
+    ch->num_lines = line_number(fb);
+    free_row_buffer(&rb);
+    del_file_buffer(fb, RESTORE_NOT);
+    return NULL;
+}
+
+
+/*
+ *  Give each chunk its own copy of the fields, with an empty validity
+ *  bitmap (for the rows of the chunk) in place of each bitmap of ftypes.
+ *  The threads would otherwise write to the same bytes of the bitmaps.
+ *  Returns 0, or -1 if out of memory.
+ */
+
+static int split_masks(chunk *chunks, int num_chunks,
+                       field_type *ftypes, int num_usecols)
+{
+    int j, k;
+
+    for (k = 0; k < num_chunks; ++k) {
+        field_type *copy = (field_type *) malloc(num_usecols * sizeof(field_type));
+        if (copy == NULL) {
+            return -1;
+        }
+        memcpy(copy, ftypes, num_usecols * sizeof(field_type));
+        for (j = 0; j < num_usecols; ++j) {
+            if (ftypes[j].validity != NULL) {
+                copy[j].validity = new_validity(ftypes[j].validity->na,
+                                                chunks[k].row_offset);
+            }
+        }
+        chunks[k].ftypes = copy;
+        for (j = 0; j < num_usecols; ++j) {
+            if (ftypes[j].validity != NULL && copy[j].validity == NULL) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+
+/*
+ *  Mark the missing values found by the threads in the bitmaps of
+ *  ftypes, and delete the copies made by split_masks().  (Most chunks
+ *  usually have no missing values, and then there is nothing to copy.)
+ *  If merge is false, the copies are only deleted.  Returns 0, or -1 if
+ *  out of memory.
+ */
+
+static int merge_masks(chunk *chunks, int num_chunks,
+                       field_type *ftypes, int num_usecols, int merge)
+{
+    int j, k;
+    int status = 0;
+
+    for (k = 0; k < num_chunks; ++k) {
+        if (chunks[k].ftypes == NULL) {
+            continue;
+        }
+        for (j = 0; j < num_usecols; ++j) {
+            validity *part = chunks[k].ftypes[j].validity;
+            if (ftypes[j].validity == NULL || part == NULL) {
+                continue;
+            }
+            if (merge && status == 0 && part->null_count > 0) {
+                status = merge_validity(ftypes[j].validity, part, chunks[k].num_rows);
+            }
+            del_validity(part);
+        }
+        free(chunks[k].ftypes);
+        chunks[k].ftypes = NULL;
+    }
+    return status;
+}
+
+
+/*
+ *  Call func(&chunks[k]) for k = 0, ..., num_chunks - 1, each in its own
+ *  thread.  chunks[0] is handled in the calling thread.  If a thread can't
+ *  be created, that chunk is also handled in the calling thread.
+ */
+
+static void run_threads(void *(*func)(void *), chunk *chunks, int num_chunks)
+{
+    pthread_t threads[MAX_NUM_THREADS];
+    int started[MAX_NUM_THREADS];
+    int k;
+
+    for (k = 1; k < num_chunks; ++k) {
+        started[k] = (pthread_create(&threads[k], NULL, func, &chunks[k]) == 0);
+    }
+    func(&chunks[0]);
+    for (k = 1; k < num_chunks; ++k) {
+        if (started[k]) {
+            pthread_join(threads[k], NULL);
+        }
+        else {
+            func(&chunks[k]);
+        }
+    }
+}
+
+
+/*
+ *  int read_rows_parallel(void *fb, int num_threads, ...)
+ *
+ *  Read the rest of the rows from fb, using up to num_threads threads.
+ *  If num_threads is 0 or negative, the number of processors is used.
+ *
+ *  The rows are stored in *p_data (or by column in p_data[0], p_data[1],
+ *  ... if columnar is true; see reader_read()), starting at row index
+ *  row_count.  *p_row_capacity is the number of rows for which the data
+ *  has space.
+ *  If can_grow is true, *p_data may be reallocated to make room for the
+ *  rows (and *p_data and *p_row_capacity are updated).  At most
+ *  max_rows - row_count rows are read.
+ *
+ *  Returns the number of rows read, or -1 if the rows were not read.
+ *  The latter happens when fb doesn't support random access, when there
+ *  is not enough data to make the threads worthwhile, when there are
+ *  categorical, variable-length string or batch fields (see read_rows()), or
+ *  when there is anything in the file that the single-threaded reader
+ *  must handle (see the comments at the top of the file).  In that case,
+ *  the position of fb is unchanged, so the caller can continue with the
+ *  single-threaded loop.
+ *
+ *  On success, fb is positioned after the last row read, and its line
+ *  number is advanced by the number of lines read, so a later read
+ *  reports the same line numbers as the single-threaded loop.
+ */
+
+int read_rows_parallel(void *fb, int num_threads,
+                       char delimiter, char quote, char comment,
+                       int allow_embedded_newline, int num_fields,
+                       field_type *ftypes, int *valid_usecols, int num_usecols,
+                       conversion_options *options, int row_size, int columnar,
+                       int max_rows, int can_grow,
+                       char **p_data, int row_count, int *p_row_capacity)
+{
+    parallel_read pr;
+    chunk chunks[MAX_NUM_THREADS];
+    off_t start, size, end_pos;
+    int num_chunks;
+    int total, remaining;
+    int num_lines;
+    int state;
+    int has_masks = FALSE;
+    int k;
+
+    pr.contents = buffer_contents(fb, &start, &size);
+    if (pr.contents == NULL) {
+        return -1;
+    }
+
+    /*
+     *  The codes of categorical fields and the offsets of variable-length
+     *  strings depend on the order of the rows, and the values of a batch
+     *  are the values of consecutive rows.
+     */
+    for (k = 0; k < num_usecols; ++k) {
+        if (ftypes[k].categories != NULL || ftypes[k].arena != NULL ||
+                ftypes[k].batch != NULL) {
+            return -1;
+        }
+        if (ftypes[k].validity != NULL) {
+            has_masks = TRUE;
+        }
+    }
+
+    if (num_threads <= 0) {
+        num_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (num_threads > MAX_NUM_THREADS) {
+        num_threads = MAX_NUM_THREADS;
+    }
+    num_chunks = num_threads;
+    if ((size - start) / MIN_CHUNK_SIZE < num_chunks) {
+        num_chunks = (int) ((size - start) / MIN_CHUNK_SIZE);
+    }
+    if (num_chunks < 2) {
+        return -1;
+    }
+
+    pr.fb = fb;
+    pr.size = size;
+    pr.delimiter = delimiter;
+    pr.quote = quote;
+    pr.comment = comment;
+    pr.allow_embedded_newline = allow_embedded_newline;
+    pr.num_fields = num_fields;
+    pr.ftypes = ftypes;
+    pr.valid_usecols = valid_usecols;
+    pr.num_usecols = num_usecols;
+    pr.options = options;
+    pr.row_size = row_size;
+    pr.columnar = columnar;
+
+    /* Split the data into chunks that end just after a newline. */
+    for (k = 0; k < num_chunks; ++k) {
+        chunks[k].pr = &pr;
+        chunks[k].is_first = (k == 0);
+        chunks[k].begin = (k == 0) ? start : chunks[k - 1].end;
+        if (k == num_chunks - 1) {
+            chunks[k].end = size;
+        }
+        else {
+            off_t pos = start + (size - start) / num_chunks * (k + 1);
+            char *p;
+            if (pos < chunks[k].begin) {
+                pos = chunks[k].begin;
+            }
+            p = memchr(pr.contents + pos, '\n', size - pos);
+            chunks[k].end = (p == NULL) ? size : (p - pr.contents) + 1;
+        }
+        chunks[k].check_end = FALSE;
+        chunks[k].failed = FALSE;
+        chunks[k].ftypes = NULL;
+    }
+
+    /* First pass. */
+    run_threads(scan_chunk, chunks, num_chunks);
+
+    /* Chain the results of the first pass, starting with the first chunk. */
+    state = SCAN_ROW_START;
+    total = 0;
+    for (k = 0; k < num_chunks; ++k) {
+        chunk_scan *s;
+        if (state == SCAN_ROW_START) {
+            s = &(chunks[k].scan[0]);
+        }
+        else if (state == SCAN_QUOTED && k > 0) {
+            s = &(chunks[k].scan[1]);
+        }
+        else {
+            return -1;
+        }
+        chunks[k].first_row = s->first_row;
+        chunks[k].num_rows = s->num_rows;
+        chunks[k].row_offset = row_count + total;
+        total += s->num_rows;
+        state = s->end_state;
+    }
+    if (state == SCAN_STOPPED || total == 0) {
+        return -1;
+    }
+
+    /* Don't read more than max_rows. */
+    remaining = max_rows - row_count;
+    if (total >= remaining) {
+        int n = 0;
+        for (k = 0; k < num_chunks; ++k) {
+            if (chunks[k].num_rows > remaining - n) {
+                chunks[k].num_rows = remaining - n;
+            }
+            n += chunks[k].num_rows;
+        }
+        total = remaining;
+    }
+    else {
+        /* The last chunk with rows checks that there are no more rows. */
+        for (k = num_chunks - 1; chunks[k].num_rows == 0; --k)
+            ;
+        chunks[k].check_end = TRUE;
+    }
+
+    if (row_count + total > *p_row_capacity) {
+        if (!can_grow) {
+            return -1;
+        }
+        if (resize_data(p_data, columnar, ftypes, num_usecols, row_size,
+                        row_count + total) != 0) {
+            return -1;
+        }
+        *p_row_capacity = row_count + total;
+    }
+    pr.data = p_data;
+
+    if (has_masks && split_masks(chunks, num_chunks, ftypes, num_usecols) != 0) {
+        merge_masks(chunks, num_chunks, ftypes, num_usecols, FALSE);
+        return -1;
+    }
+
+    /* Second pass. */
+    run_threads(read_chunk, chunks, num_chunks);
+
+    /* Check that the rows read by each thread follow those of the previous thread. */
+    end_pos = start;
+    num_lines = 0;
+    for (k = 0; k < num_chunks; ++k) {
+        if (chunks[k].num_rows == 0) {
+            continue;
+        }
+        if (chunks[k].failed || chunks[k].first_row != end_pos) {
+            merge_masks(chunks, num_chunks, ftypes, num_usecols, FALSE);
+            return -1;
+        }
+        end_pos = chunks[k].end_pos;
+        num_lines += chunks[k].num_lines;
+    }
+
+    /*
+     *  If this fails, the single-threaded loop reads the rows again, and
+     *  marks the same values as missing.
+     */
+    if (merge_masks(chunks, num_chunks, ftypes, num_usecols, TRUE) != 0) {
+        return -1;
+    }
+
+    buffer_seek(fb, end_pos);
+    set_line_number(fb, line_number(fb) + num_lines);
+    return total;
+}
@@ -0,0 +1,10 @@
+
+#include "field_type.h"
+
+int read_rows_parallel(void *fb, int num_threads,
+                       char delimiter, char quote, char comment,
+                       int allow_embedded_newline, int num_fields,
+                       field_type *ftypes, int *valid_usecols, int num_usecols,
+                       conversion_options *options, int row_size, int columnar,
+                       int max_rows, int can_grow,
+                       char **p_data, int row_count, int *p_row_capacity);
@@ -0,0 +1,784 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "file_buffer.h"
+#include "tokenize.h"
+#include "sizes.h"
+#include "constants.h"
+#include "error_types.h"
+#include "fields.h"
+#include "rows.h"
+#include "datetime.h"
+#include "scan.h"
+#include "row_index.h"
+#include "conversions.h"
+#include "infer.h"
+#include "reader.h"
+
+
+/*
+ *  reader *new_reader(FILE *f, char *fmt, ...)
+ *
+ *  Create a reader for the rows of f, starting at the current position
+ *  of f.  The arguments are the same as those of read_rows().  The first
+ *  skiprows rows are skipped, and the first row of the data is tokenized
+ *  to validate usecols.  (If the file has no more than skiprows rows, the
+ *  reader is created, but it has no rows to read.)  buffer_size is passed
+ *  to new_file_buffer(); use -1 for the default.
+ *
+ *  The dictionaries of the categorical fields are given in cats (see
+ *  read_rows()), and are used for every read.  If a categorical field has
+ *  no dictionary, or its size is not 1, 2, 4 or 8, the error is
+ *  ERROR_INVALID_CATEGORIES, and *p_error_lineno is the index of the
+ *  field.  Likewise, the string arenas of the variable-length string
+ *  fields are given in arenas; a missing arena is
+ *  ERROR_INVALID_STRING_ARENA.  The validity bitmaps in masks (if it is
+ *  not NULL) are filled in with the missing values of the rows read; the
+ *  rows are counted from row_count of reader_read().  A field j with a
+ *  batch (batches[j], if batches is not NULL) is converted by the batch
+ *  function of the batch, a block of rows at a time (see batch.h and
+ *  reader_read()).
+ *
+ *  If filter is not NULL, only the rows that match it are read (see
+ *  row_filter.h).  The columns of its terms are validated like usecols;
+ *  an invalid one is ERROR_INVALID_FILTER_COLUMN, with the index of the
+ *  term in *p_error_lineno.  The filter belongs to the caller, and must
+ *  not be changed or deleted until the reader is deleted.
+ *
+ *  If index_path is not NULL, it is the name of a row index file made by
+ *  build_row_index() (see row_index.c).  When f is at the start of the
+ *  file and the index applies to it, the reader goes directly to the
+ *  nearest indexed row before row skiprows.
+ *
+ *  Returns NULL if there is an error; the error is in *p_error_type and
+ *  *p_error_lineno.  That includes ERROR_NO_DATA when there is no data
+ *  after the skipped rows.
+ *
+ *  The position of f is not defined until the reader is deleted by
+ *  del_reader().  f is not read in the background after new_reader() or
+ *  reader_read() returns (see buffer_sync()), so the caller may close f
+ *  between reads, but must then delete the reader with RESTORE_NOT.
+ */
+
+reader *new_reader(FILE *f, char *fmt,
+                   char delimiter, char quote, char comment,
+                   char sci, char decimal,
+                   int allow_embedded_newline,
+                   char *datetime_fmt,
+                   int tz_offset,
+                   int32_t *usecols, int num_usecols,
+                   int skiprows, int buffer_size, char *index_path,
+                   categories **cats, string_arena **arenas, validity **masks,
+                   field_batch **batches, row_filter *filter,
+                   int *p_error_type, int *p_error_lineno)
+{
+    reader *r;
+    int num_fields;
+    int tok_error_type;
+    int at_start;
+    int *wanted;
+    int j;
+
+    r = (reader *) malloc(sizeof(reader));
+    if (r == NULL) {
+        *p_error_type = ERROR_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    if (datetime_fmt == NULL || strlen(datetime_fmt) == 0) {
+        datetime_fmt = "%Y-%m-%d %H:%M:%S";
+    }
+    r->options.sci = sci;
+    r->options.decimal = decimal;
+    r->options.datetime_fmt = datetime_fmt;
+    r->options.tz_offset = tz_offset;
+    set_datetime_layout(&(r->options));
+
+    r->delimiter = delimiter;
+    r->quote = quote;
+    r->comment = comment;
+    r->allow_embedded_newline = allow_embedded_newline;
+    r->pending = FALSE;
+    r->finished = FALSE;
+    r->columnar = FALSE;
+    r->promote = FALSE;
+    r->errors = NULL;
+    r->field_errors = NULL;
+    r->num_batched = 0;
+    r->filter = filter;
+    r->num_allocations = 0;
+    r->valid_usecols = NULL;
+    r->num_usecols = num_usecols;
+    r->num_fields = 0;
+
+    r->row_size = calc_size(fmt, NULL);
+    r->ftypes = enumerate_fields(fmt);
+    if (r->ftypes == NULL) {
+        free(r);
+        *p_error_type = READ_ERROR_OUT_OF_MEMORY;
+        return NULL;
+    }
+    for (j = 0; j < num_usecols; ++j) {
+        int size = r->ftypes[j].size;
+        int error = 0;
+        if (r->ftypes[j].typechar == 'k') {
+            if (cats == NULL || cats[j] == NULL ||
+                    (size != 1 && size != 2 && size != 4 && size != 8)) {
+                error = ERROR_INVALID_CATEGORIES;
+            }
+            else {
+                r->ftypes[j].categories = cats[j];
+            }
+        }
+        else if (r->ftypes[j].typechar == 'v') {
+            if (arenas == NULL || arenas[j] == NULL) {
+                error = ERROR_INVALID_STRING_ARENA;
+            }
+            else {
+                r->ftypes[j].arena = arenas[j];
+            }
+        }
+        if (masks != NULL) {
+            r->ftypes[j].validity = masks[j];
+        }
+        if (batches != NULL && batches[j] != NULL) {
+            r->ftypes[j].batch = batches[j];
+            r->ftypes[j].convert = convert_batched;
+            ++(r->num_batched);
+        }
+        if (error) {
+            free(r->ftypes);
+            free(r);
+            *p_error_type = error;
+            *p_error_lineno = j;  /* As for ERROR_INVALID_COLUMN_INDEX. */
+            return NULL;
+        }
+    }
+
+    at_start = (ftell(f) == 0);
+    r->fb = new_file_buffer(f, buffer_size);
+    if (r->fb == NULL) {
+        free(r->ftypes);
+        free(r);
+        *p_error_type = ERROR_OUT_OF_MEMORY;
+        return NULL;
+    }
+    if (init_row_buffer(&(r->rb)) != 0) {
+        del_file_buffer(r->fb, RESTORE_INITIAL);
+        free(r->ftypes);
+        free(r);
+        *p_error_type = ERROR_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    if (skiprows > 0 && index_path != NULL && at_start) {
+        row_index *ri;
+        ri = load_row_index(index_path, f, delimiter, quote, comment);
+        if (ri != NULL) {
+            int64_t k = skiprows / ri->step;
+            if (k >= ri->num_entries) {
+                k = ri->num_entries - 1;
+            }
+            buffer_seek(r->fb, (off_t) ri->entries[k].offset);
+            set_line_number(r->fb, (int) ri->entries[k].line);
+            skiprows -= (int) (k * ri->step);
+            del_row_index(ri);
+        }
+    }
+
+    if (skiprows > 0) {
+        /*
+         *  Skip the rows without tokenizing them, if the file buffer gives
+         *  random access to the file.  The tokenizer skips the rest (all
+         *  of them, if find_rows() can't).
+         */
+        char *contents;
+        off_t pos, size, end, num_lines;
+        int num_rows;
+
+        contents = buffer_contents(r->fb, &pos, &size);
+        if (contents != NULL) {
+            end = find_rows(contents, size, pos, delimiter, quote, comment,
+                            skiprows, &num_rows, &num_lines);
+            if (end >= 0) {
+                buffer_seek(r->fb, end);
+                set_line_number(r->fb, line_number(r->fb) + (int) num_lines);
+                skiprows -= num_rows;
+            }
+        }
+    }
+
+    /* XXX Check interaction of skiprows with comments. */
+    set_projection(&(r->rb), NULL, 0, -1);
+    while ((skiprows > 0) && tokenize(r->fb, &(r->rb), delimiter, quote, comment,
+                                      TRUE, &tok_error_type) > 0) {
+        --skiprows;
+    }
+    clear_projection(&(r->rb));
+
+    if (skiprows > 0) {
+        /* There were fewer rows in the file than skiprows. */
+        /* This is not treated as an error. The result should be an empty array. */
+        r->finished = TRUE;
+        buffer_sync(r->fb);
+        return r;
+    }
+
+    /*
+     *  Read the first row to get the number of fields in the file.
+     *  We'll then use this to pre-validate the values in usecols.
+     *  (It might be easier to do this in the Python wrapper, but that
+     *  would require refactoring the C interface a bit to expose more
+     *  to Python.)
+     */
+    r->row_offset = buffer_position(r->fb);
+    num_fields = tokenize(r->fb, &(r->rb), delimiter, quote, comment, TRUE, &tok_error_type);
+    if (num_fields == 0) {
+        *p_error_type = tok_error_type;
+        *p_error_lineno = 1;
+        del_reader(r, RESTORE_FINAL);
+        return NULL;
+    }
+    r->pending = TRUE;
+    r->num_fields = num_fields;
+
+    r->valid_usecols = (int *) malloc(num_usecols * sizeof(int));
+    r->field_errors = (int *) calloc(num_usecols > 0 ? num_usecols : 1, sizeof(int));
+    if (r->valid_usecols == NULL || r->field_errors == NULL) {
+        /* Out of memory. */
+        *p_error_type = ERROR_OUT_OF_MEMORY;
+        del_reader(r, RESTORE_FINAL);
+        return NULL;
+    }
+
+    /*
+     *  Validate the column indices in usecols, and put the validated
+     *  column indices in valid_usecols.
+     */
+    for (j = 0; j < num_usecols; ++j) {
+
+        int32_t k;
+        k = usecols[j];
+        if (k < -num_fields || k >= num_fields) {
+            /* Invalid column index. */
+            *p_error_type = ERROR_INVALID_COLUMN_INDEX;
+            *p_error_lineno = j;  /* Abuse 'lineno' and put the bad column index there. */
+            del_reader(r, RESTORE_FINAL);
+            return NULL;
+        }
+        if (k < 0) {
+            k += num_fields;
+        }
+        r->valid_usecols[j] = k;
+    }
+
+    if (filter != NULL) {
+        /*
+         *  Validate the columns of the filter, which are added to the
+         *  projection.
+         */
+        wanted = (int *) malloc((num_usecols + filter->num_terms) * sizeof(int));
+        if (wanted == NULL) {
+            *p_error_type = ERROR_OUT_OF_MEMORY;
+            del_reader(r, RESTORE_FINAL);
+            return NULL;
+        }
+        memcpy(wanted, r->valid_usecols, num_usecols * sizeof(int));
+        for (j = 0; j < filter->num_terms; ++j) {
+            int k = filter->terms[j].column;
+            if (k < -num_fields || k >= num_fields) {
+                free(wanted);
+                *p_error_type = ERROR_INVALID_FILTER_COLUMN;
+                *p_error_lineno = j;
+                del_reader(r, RESTORE_FINAL);
+                return NULL;
+            }
+            if (k < 0) {
+                k += num_fields;
+            }
+            filter->terms[j].field = k;
+            wanted[num_usecols + j] = k;
+        }
+        set_projection(&(r->rb), wanted, num_usecols + filter->num_terms, num_fields);
+        free(wanted);
+        buffer_sync(r->fb);
+        return r;
+    }
+
+    /* The other fields of the following rows are only counted. */
+    set_projection(&(r->rb), r->valid_usecols, num_usecols, num_fields);
+
+    buffer_sync(r->fb);
+    return r;
+}
+
+
+/*
+ *  Convert the fields of the row in r->rb, and store them as row
+ *  row_index of the data.  Returns 0 or the first conversion error.
+ */
+
+static int convert_fields(reader *r, char **p_data, int row_index)
+{
+    int *field_errors = (r->errors != NULL) ? r->field_errors : NULL;
+
+    if (r->columnar) {
+        return convert_columns(r->rb.words, r->ftypes, r->valid_usecols,
+                               r->num_usecols, &(r->options), p_data,
+                               (size_t) row_index, field_errors);
+    }
+    return convert_row(r->rb.words, r->ftypes, r->valid_usecols,
+                       r->num_usecols, &(r->options),
+                       *p_data + (size_t) row_index * r->row_size, (size_t) row_index,
+                       field_errors);
+}
+
+
+/*
+ *  Undo what the conversion of a row that is left out of the data did
+ *  outside of the row itself (which the next row overwrites): its missing
+ *  values are cleared from the validity bitmaps, and its strings are
+ *  removed from the string arenas and the batches.  (The strings of the
+ *  categorical fields keep their codes.)
+ */
+
+static void drop_row(reader *r, char **p_data, int row_index)
+{
+    int j;
+
+    for (j = 0; j < r->num_usecols; ++j) {
+        field_type *ft = &(r->ftypes[j]);
+
+        if (ft->validity != NULL) {
+            clear_missing(ft->validity, (int64_t) row_index);
+        }
+        if (ft->typechar == 'v') {
+            int64_t offset;
+            char *p = r->columnar ? p_data[j] + (size_t) row_index * ft->size
+                                  : *p_data + (size_t) row_index * r->row_size + ft->offset;
+            memcpy(&offset, p, sizeof(offset));
+            if (offset >= 0 && offset < ft->arena->used) {
+                ft->arena->used = offset;
+            }
+        }
+        if (ft->batch != NULL) {
+            batch_drop_last(ft->batch);
+        }
+    }
+}
+
+
+/*
+ *  Change the type of field j to g, and convert the values of the field
+ *  in the first row_count rows of the data (see widen_value()).  The data
+ *  has room for capacity rows; it is reallocated for the larger field.
+ *  Rows are moved from the last to the first, so each row only moves
+ *  forward, over memory that has already been moved.
+ *
+ *  Returns 0, or -1 if out of memory (the data is then unchanged).
+ */
+
+static int widen_field(reader *r, int j, type_guess *g,
+                       char **p_data, int row_count, int capacity)
+{
+    field_type *ft = &(r->ftypes[j]);
+    int delta = g->size - ft->size;
+    char *data;
+    int i, k;
+
+    if (capacity < 1) {
+        capacity = 1;
+    }
+    if (r->columnar) {
+        data = (char *) realloc(p_data[j], (size_t) capacity * g->size);
+        if (data == NULL) {
+            return -1;
+        }
+        for (i = row_count - 1; i >= 0; --i) {
+            widen_value(ft->typechar, ft->size, g->typechar, g->size,
+                        data + (size_t) i * ft->size, data + (size_t) i * g->size);
+        }
+        p_data[j] = data;
+    }
+    else {
+        int old_size = r->row_size;
+        int new_size = r->row_size + delta;
+        int head = ft->offset;
+        int tail = old_size - ft->offset - ft->size;
+
+        data = (char *) realloc(*p_data, (size_t) capacity * new_size);
+        if (data == NULL) {
+            return -1;
+        }
+        for (i = row_count - 1; i >= 0; --i) {
+            char *old_row = data + (size_t) i * old_size;
+            char *new_row = data + (size_t) i * new_size;
+            memmove(new_row + head + g->size, old_row + head + ft->size, tail);
+            widen_value(ft->typechar, ft->size, g->typechar, g->size,
+                        old_row + head, new_row + head);
+            memmove(new_row, old_row, head);
+        }
+        *p_data = data;
+        r->row_size = new_size;
+        for (k = j + 1; k < r->num_usecols; ++k) {
+            r->ftypes[k].offset += delta;
+        }
+    }
+    ft->typechar = g->typechar;
+    ft->size = g->size;
+    ft->convert = converter_for_type(g->typechar);
+    r->num_allocations += 1;
+    return 0;
+}
+
+
+/*
+ *  Promote the types of the fields of the row in r->rb that don't hold
+ *  their values: the fields that could not be converted (if
+ *  conversion_error is not 0), and the string fields that are too short.
+ *  A string field is at least doubled, so a column of strings of growing
+ *  length is only widened a few times.
+ *
+ *  Returns the number of fields that were promoted, or -1 if out of
+ *  memory.  If a field is promoted, the row must be converted again;
+ *  what its conversion did outside of the row is undone (see
+ *  drop_row()).
+ */
+
+static int promote_fields(reader *r, int conversion_error,
+                          char **p_data, int row_count, int capacity)
+{
+    int j, num_promoted = 0;
+
+    for (j = 0; j < r->num_usecols; ++j) {
+        field_type *ft = &(r->ftypes[j]);
+        field_span *span = &(r->rb.words[r->valid_usecols[j]]);
+        type_guess g;
+
+        if (!can_promote(ft->typechar) || ft->batch != NULL ||
+                (ft->typechar == 's' ? span->length <= ft->size : !conversion_error) ||
+                (ft->validity != NULL && is_missing(ft->validity, span->start, span->length))) {
+            continue;
+        }
+        g.typechar = ft->typechar;
+        g.size = ft->size;
+        guess_type(&g, span->start, span->length, &(r->options));
+        if (g.typechar == ft->typechar && g.size <= ft->size) {
+            continue;
+        }
+        if (g.typechar == 's' && ft->typechar == 's' && g.size < 2 * ft->size) {
+            g.size = 2 * ft->size;
+        }
+        if (num_promoted == 0) {
+            /* The row is converted again. */
+            drop_row(r, p_data, row_count);
+        }
+        if (widen_field(r, j, &g, p_data, row_count, capacity) != 0) {
+            return -1;
+        }
+        ++num_promoted;
+    }
+    return num_promoted;
+}
+
+
+/*
+ *  Log the errors of the fields of the row in r->rb (from
+ *  r->field_errors, which is cleared), or the error code if no field has
+ *  an error.  row_index is the index of the row in the data.
+ */
+
+static void log_row_errors(reader *r, int row_index, int code)
+{
+    int64_t row = row_index + r->errors->num_skipped;
+    int line = line_number(r->fb);
+    int j, logged = FALSE;
+
+    for (j = 0; j < r->num_usecols; ++j) {
+        if (r->field_errors[j]) {
+            log_error(r->errors, row, (int64_t) r->row_offset, r->valid_usecols[j],
+                      line, r->field_errors[j]);
+            r->field_errors[j] = 0;
+            logged = TRUE;
+        }
+    }
+    if (!logged) {
+        log_error(r->errors, row, (int64_t) r->row_offset, -1, line, code);
+    }
+}
+
+
+/*
+ *  Convert the values in the batches of the fields (the values of the
+ *  last rows before row row_count), if they are full or if all is true.
+ *  Returns 0, or ERROR_BATCH_FAILED if a batch function fails (the
+ *  batches are emptied in either case).
+ */
+
+static int flush_batches(reader *r, char **p_data, int row_count, int all)
+{
+    int j, error = 0;
+
+    for (j = 0; j < r->num_usecols; ++j) {
+        field_type *ft = &(r->ftypes[j]);
+        field_batch *b = ft->batch;
+        int first_row;
+        char *dst;
+
+        if (b == NULL || (b->count < b->capacity && !all)) {
+            continue;
+        }
+        first_row = row_count - b->count;
+        if (r->columnar) {
+            dst = p_data[j] + (size_t) first_row * ft->size;
+        }
+        else {
+            dst = *p_data + (size_t) first_row * r->row_size + ft->offset;
+        }
+        if (flush_batch(b, first_row, dst, r->columnar ? ft->size : r->row_size) != 0) {
+            error = ERROR_BATCH_FAILED;
+        }
+    }
+    return error;
+}
+
+
+/*
+ *  int reader_read(reader *r, int max_rows, int can_grow,
+ *                  char **p_data, int row_count, int *p_row_capacity,
+ *                  int *p_error_type, int *p_error_lineno)
+ *
+ *  Read up to max_rows rows (all the remaining rows if max_rows is
+ *  negative), and store them in *p_data, starting at row index row_count.
+ *  *p_row_capacity is the number of rows for which *p_data has space.  If
+ *  can_grow is true, *p_data is reallocated (doubling its capacity) when
+ *  it is full, and *p_data and *p_row_capacity are updated; otherwise the
+ *  read stops when *p_data is full.
+ *
+ *  If r->columnar is true, p_data is instead an array of r->num_usecols
+ *  columns, and the field j of row i is stored at p_data[j] + i * size,
+ *  where size is the size of the field (see read_columns()).  The columns
+ *  are reallocated in the same way.
+ *
+ *  If r->promote is true, *p_data must have been allocated with malloc()
+ *  (it is reallocated even if can_grow is false).  A field whose value
+ *  doesn't fit its type gets a wider type (see infer.c), instead of a
+ *  conversion error: the field is widened in the rows that have already
+ *  been read, and the row is converted again.  r->ftypes and r->row_size
+ *  then describe the new layout of the data; see reader_format().  Only
+ *  the types that guess_type() infers are promoted.
+ *
+ *  If r->filter is not NULL, the rows that don't match it are skipped
+ *  right after they are tokenized (after the check of their number of
+ *  fields): none of their fields is converted, and they are not counted
+ *  in the rows read, or in max_rows.
+ *
+ *  The values of the fields with a batch are converted when the batch is
+ *  full, and when the read returns, so the rows that are returned are
+ *  complete.  If a batch function fails, the error is ERROR_BATCH_FAILED,
+ *  which stops the read.
+ *
+ *  Returns the number of rows read.  Fewer than max_rows rows are read
+ *  when the end of the file is reached, or when there is an error that
+ *  stops the read (a change in the number of fields, or out of memory).
+ *  After such an error, the reader reads no more rows, and the error is
+ *  put in *p_error_type and *p_error_lineno.  Errors in the conversion of
+ *  fields don't stop the read; the first one is put in *p_error_type and
+ *  *p_error_lineno if *p_error_type is 0.
+ */
+
+int reader_read(reader *r, int max_rows, int can_grow,
+                char **p_data, int row_count, int *p_row_capacity,
+                int *p_error_type, int *p_error_lineno)
+{
+    int current_num_fields;
+    int tok_error_type;
+    int conversion_error;
+    int n;
+    int rb_allocations = r->rb.num_allocations;
+
+    if (max_rows < 0) {
+        max_rows = INT_MAX;
+    }
+
+    n = 0;
+    while (!r->finished && n < max_rows) {
+
+        if (row_count == *p_row_capacity) {
+            /* The data has filled the memory allocated so far. */
+            int new_capacity;
+
+            if (!can_grow) {
+                break;
+            }
+            new_capacity = (*p_row_capacity > INT_MAX / 2) ? INT_MAX : 2 * *p_row_capacity;
+            if (new_capacity < 1) {
+                new_capacity = 1;
+            }
+            if (resize_data(p_data, r->columnar, r->ftypes, r->num_usecols, r->row_size,
+                            new_capacity) != 0) {
+                *p_error_type = ERROR_OUT_OF_MEMORY;
+                *p_error_lineno = line_number(r->fb);
+                r->finished = TRUE;
+                break;
+            }
+            *p_row_capacity = new_capacity;
+            r->num_allocations += r->columnar ? r->num_usecols : 1;
+        }
+
+        if (r->pending) {
+            r->pending = FALSE;
+            current_num_fields = r->num_fields;
+        }
+        else {
+            if (r->errors != NULL) {
+                r->row_offset = buffer_position(r->fb);
+            }
+            current_num_fields = tokenize(r->fb, &(r->rb), r->delimiter, r->quote, r->comment,
+                                          TRUE, &tok_error_type);
+            if (current_num_fields == 0) {
+                r->finished = TRUE;
+                break;
+            }
+        }
+
+        if (current_num_fields != r->num_fields) {
+            if (r->errors != NULL) {
+                log_row_errors(r, row_count, ERROR_CHANGED_NUMBER_OF_FIELDS);
+                if (r->errors->policy != ERROR_POLICY_RAISE) {
+                    ++(r->errors->num_skipped);
+                    if (*p_error_type == 0) {
+                        *p_error_type = ERROR_CHANGED_NUMBER_OF_FIELDS;
+                        *p_error_lineno = line_number(r->fb);
+                    }
+                    continue;
+                }
+            }
+            *p_error_type = ERROR_CHANGED_NUMBER_OF_FIELDS;
+            *p_error_lineno = line_number(r->fb);
+            r->finished = TRUE;
+            break;
+        }
+
+        if (r->filter != NULL && !row_matches(r->filter, r->rb.words, &(r->options))) {
+            /* The row is left out without being converted. */
+            continue;
+        }
+
+        conversion_error = convert_fields(r, p_data, row_count);
+        if (r->promote) {
+            int num_promoted = promote_fields(r, conversion_error, p_data, row_count,
+                                              *p_row_capacity);
+            if (num_promoted < 0) {
+                *p_error_type = ERROR_OUT_OF_MEMORY;
+                *p_error_lineno = line_number(r->fb);
+                r->finished = TRUE;
+                break;
+            }
+            if (num_promoted > 0) {
+                if (r->errors != NULL) {
+                    memset(r->field_errors, 0, r->num_usecols * sizeof(int));
+                }
+                conversion_error = convert_fields(r, p_data, row_count);
+            }
+        }
+        if (conversion_error) {
+            if (r->errors != NULL) {
+                log_row_errors(r, row_count, conversion_error);
+                if (r->errors->policy == ERROR_POLICY_RAISE) {
+                    drop_row(r, p_data, row_count);
+                    *p_error_type = conversion_error;
+                    *p_error_lineno = line_number(r->fb);
+                    r->finished = TRUE;
+                    break;
+                }
+            }
+            if (*p_error_type == 0) {
+                /* Report the first conversion error, and keep reading. */
+                *p_error_type = conversion_error;
+                *p_error_lineno = line_number(r->fb);
+            }
+            if (r->errors != NULL && r->errors->policy == ERROR_POLICY_SKIP) {
+                drop_row(r, p_data, row_count);
+                ++(r->errors->num_skipped);
+                continue;
+            }
+        }
+        ++row_count;
+        ++n;
+
+        if (r->num_batched > 0 && flush_batches(r, p_data, row_count, FALSE) != 0) {
+            *p_error_type = ERROR_BATCH_FAILED;
+            *p_error_lineno = line_number(r->fb);
+            r->finished = TRUE;
+            break;
+        }
+    }
+
+    if (r->num_batched > 0 && flush_batches(r, p_data, row_count, TRUE) != 0) {
+        *p_error_type = ERROR_BATCH_FAILED;
+        *p_error_lineno = line_number(r->fb);
+        r->finished = TRUE;
+    }
+
+    r->num_allocations += r->rb.num_allocations - rb_allocations;
+
+    /* The caller may use f until the next read. */
+    buffer_sync(r->fb);
+    return n;
+}
+
+
+/*
+ *  char *reader_format(reader *r)
+ *
+ *  Returns the format (see fields.c) of the fields of the data, which
+ *  differs from the format given to new_reader() if types have been
+ *  promoted.  The caller must free() the string.  Returns NULL if out of
+ *  memory.
+ */
+
+char *reader_format(reader *r)
+{
+    char *fmt, *p;
+    int j;
+
+    /* At most 11 characters per field ("2147483647s"). */
+    fmt = (char *) malloc(r->num_usecols * 11 + 1);
+    if (fmt == NULL) {
+        return NULL;
+    }
+    p = fmt;
+    for (j = 0; j < r->num_usecols; ++j) {
+        char c = r->ftypes[j].typechar;
+        if (c == 's' || c == 'k') {
+            p += sprintf(p, "%d%c", r->ftypes[j].size, c);
+        }
+        else {
+            *p++ = c;
+        }
+    }
+    *p = '\0';
+    return fmt;
+}
+
+
+/*
+ *  void del_reader(reader *r, int restore)
+ *
+ *  Free the reader.  restore is passed to del_file_buffer().
+ */
+
+void del_reader(reader *r, int restore)
+{
+    free(r->valid_usecols);
+    free(r->field_errors);
+    free(r->ftypes);
+    free_row_buffer(&(r->rb));
+    del_file_buffer(r->fb, restore);
+    free(r);
+}
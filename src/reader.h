@@ -0,0 +1,127 @@
+
+#ifndef READER_H
+#define READER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "sizes.h"
+#include "field_type.h"
+#include "tokenize.h"
+#include "categories.h"
+#include "arena.h"
+#include "validity.h"
+#include "error_log.h"
+#include "batch.h"
+#include "row_filter.h"
+
+/*
+ *  A reader holds everything that is needed to read rows from a file:
+ *  the file buffer, the tokenizer settings, and the types, offsets and
+ *  converters of the fields (the "plan").  These are set up once by
+ *  new_reader(), and then any number of calls to reader_read() can read
+ *  the rows in pieces.
+ */
+
+typedef struct _reader {
+
+    void *fb;
+
+    char delimiter;
+    char quote;
+    char comment;
+    int allow_embedded_newline;
+
+    conversion_options options;
+
+    /* The fields of a row of the data (from enumerate_fields()). */
+    field_type *ftypes;
+    int row_size;
+
+    /* The validated column indices (negative values of usecols resolved). */
+    int *valid_usecols;
+    int num_usecols;
+
+    /* Number of fields in the rows of the file. */
+    int num_fields;
+
+    /*
+     *  Boolean: words holds the first row of the data, which new_reader()
+     *  tokenizes to get the number of fields.  It is converted by the
+     *  next reader_read().
+     */
+    int pending;
+
+    /* Boolean: no more rows will be read. */
+    int finished;
+
+    /*
+     *  Boolean: the data is stored by column (see reader_read()).  This
+     *  is FALSE when the reader is created.
+     */
+    int columnar;
+
+    /*
+     *  Boolean: promote the type of a field when a value doesn't fit it
+     *  (see reader_read()).  This is FALSE when the reader is created.
+     */
+    int promote;
+
+    /*
+     *  The log of the bad rows, and what to do with them (see
+     *  reader_read()).  This is NULL when the reader is created.
+     */
+    error_log *errors;
+
+    /*
+     *  The errors of the fields of the row being converted (see
+     *  convert_row()), and the position in the file after the previous
+     *  row.  These are only used when there is an error log.
+     */
+    int *field_errors;
+    off_t row_offset;
+
+    /* Number of fields with a batch (see new_reader()). */
+    int num_batched;
+
+    /*
+     *  The rows that are not converted or stored are those that don't
+     *  match the filter (see reader_read()), if it is not NULL.
+     */
+    row_filter *filter;
+
+    /*
+     *  Number of memory allocations made by reader_read(): to grow the
+     *  data, and to grow rb.  The rows are tokenized into rb, which is
+     *  reused for every row (it only grows for a row that is larger
+     *  than all the previous ones).
+     */
+    int num_allocations;
+
+    row_buffer rb;
+
+} reader;
+
+
+reader *new_reader(FILE *f, char *fmt,
+                   char delimiter, char quote, char comment,
+                   char sci, char decimal,
+                   int allow_embedded_newline,
+                   char *datetime_fmt,
+                   int tz_offset,
+                   int32_t *usecols, int num_usecols,
+                   int skiprows, int buffer_size, char *index_path,
+                   categories **cats, string_arena **arenas, validity **masks,
+                   field_batch **batches, row_filter *filter,
+                   int *p_error_type, int *p_error_lineno);
+
+int reader_read(reader *r, int max_rows, int can_grow,
+                char **p_data, int row_count, int *p_row_capacity,
+                int *p_error_type, int *p_error_lineno);
+
+char *reader_format(reader *r);
+
+void del_reader(reader *r, int restore);
+
+#endif
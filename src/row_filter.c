@@ -0,0 +1,235 @@
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "constants.h"
+#include "error_types.h"
+#include "conversions.h"
+#include "row_filter.h"
+
+
+/*
+ *  Row filters.  When only a few of the rows of a large file are wanted
+ *  (e.g. the rows of one symbol, or of one day), most of the time of a
+ *  read goes into converting rows that are then thrown away.  A filter
+ *  is checked by reader_read() right after a row is tokenized, before
+ *  any field is converted: a row that doesn't match is not converted,
+ *  and takes no space in the data.  Only the fields of the terms are
+ *  looked at (and converted, for a range), so the cost of a rejected row
+ *  is little more than the cost of tokenizing it.
+ */
+
+
+/*
+ *  row_filter *new_row_filter(void)
+ *
+ *  Create a filter with no terms (which every row matches).  Returns
+ *  NULL if out of memory.
+ */
+
+row_filter *new_row_filter(void)
+{
+    row_filter *f;
+
+    f = (row_filter *) malloc(sizeof(row_filter));
+    if (f == NULL) {
+        return NULL;
+    }
+    f->terms = NULL;
+    f->num_terms = 0;
+    f->capacity = 0;
+    return f;
+}
+
+
+/*
+ *  Add a term of the given kind for column.  Returns the term, or NULL
+ *  if out of memory.
+ */
+
+static filter_term *add_term(row_filter *f, int kind, int column)
+{
+    filter_term *t;
+
+    if (f->num_terms == f->capacity) {
+        int capacity = (f->capacity > 0) ? 2 * f->capacity : 4;
+        filter_term *terms;
+        terms = (filter_term *) realloc(f->terms, capacity * sizeof(filter_term));
+        if (terms == NULL) {
+            return NULL;
+        }
+        f->terms = terms;
+        f->capacity = capacity;
+    }
+    t = &(f->terms[f->num_terms]);
+    t->kind = kind;
+    t->column = column;
+    t->field = -1;
+    t->values = NULL;
+    t->typechar = 0;
+    t->convert = NULL;
+    t->low = 0.0;
+    t->high = 0.0;
+    t->int_low = 0;
+    t->int_high = 0;
+    ++(f->num_terms);
+    return t;
+}
+
+
+/*
+ *  int filter_in(row_filter *f, int column, char **values, int *lengths,
+ *                int count)
+ *
+ *  Add a term that keeps the rows whose field column is one of the count
+ *  strings in values (string k has lengths[k] bytes).  The strings are
+ *  copied.  Returns 0, or ERROR_OUT_OF_MEMORY.
+ */
+
+int filter_in(row_filter *f, int column, char **values, int *lengths, int count)
+{
+    categories *c;
+    filter_term *t;
+    int k;
+
+    c = new_categories(INT_MAX, INT_MAX);
+    if (c == NULL) {
+        return ERROR_OUT_OF_MEMORY;
+    }
+    for (k = 0; k < count; ++k) {
+        if (category_code(c, values[k], lengths[k]) < 0) {
+            del_categories(c);
+            return ERROR_OUT_OF_MEMORY;
+        }
+    }
+    t = add_term(f, FILTER_IN, column);
+    if (t == NULL) {
+        del_categories(c);
+        return ERROR_OUT_OF_MEMORY;
+    }
+    t->values = c;
+    return 0;
+}
+
+
+/*
+ *  int filter_range(row_filter *f, int column, double low, double high)
+ *
+ *  Add a term that keeps the rows whose field column is a floating point
+ *  number between low and high.  Returns 0, or ERROR_OUT_OF_MEMORY.
+ */
+
+int filter_range(row_filter *f, int column, double low, double high)
+{
+    filter_term *t;
+
+    t = add_term(f, FILTER_RANGE, column);
+    if (t == NULL) {
+        return ERROR_OUT_OF_MEMORY;
+    }
+    t->typechar = 'd';
+    t->convert = converter_for_type('d');
+    t->low = low;
+    t->high = high;
+    return 0;
+}
+
+
+/*
+ *  int filter_int_range(row_filter *f, int column, char typechar,
+ *                       int64_t low, int64_t high)
+ *
+ *  Add a term that keeps the rows whose field column, converted to
+ *  typechar ('q', or one of the datetime types D, T, M, U and N, with the
+ *  reader's datetime format), is between low and high.  Returns 0,
+ *  ERROR_OUT_OF_MEMORY, or -1 if typechar is not one of those types.
+ */
+
+int filter_int_range(row_filter *f, int column, char typechar,
+                     int64_t low, int64_t high)
+{
+    filter_term *t;
+
+    if (typechar != 'q' && typechar != 'D' && typechar != 'T' &&
+            typechar != 'M' && typechar != 'U' && typechar != 'N') {
+        return -1;
+    }
+    t = add_term(f, FILTER_RANGE, column);
+    if (t == NULL) {
+        return ERROR_OUT_OF_MEMORY;
+    }
+    t->typechar = typechar;
+    t->convert = converter_for_type(typechar);
+    t->int_low = low;
+    t->int_high = high;
+    return 0;
+}
+
+
+/*
+ *  int row_matches(row_filter *f, field_span *words,
+ *                  conversion_options *options)
+ *
+ *  Returns TRUE if the row in words (as returned by tokenize()) matches
+ *  all the terms of f, and FALSE otherwise.  The fields of the terms
+ *  must have been validated (see new_reader()).
+ */
+
+int row_matches(row_filter *f, field_span *words, conversion_options *options)
+{
+    int k;
+
+    for (k = 0; k < f->num_terms; ++k) {
+        filter_term *t = &(f->terms[k]);
+        field_span *span = &(words[t->field]);
+
+        if (t->kind == FILTER_IN) {
+            if (find_category(t->values, span->start, span->length) < 0) {
+                return FALSE;
+            }
+        }
+        else {
+            field_type ft;
+            union {
+                double d;
+                int64_t q;
+            } value;
+
+            if (span->length == 0) {
+                return FALSE;
+            }
+            ft.typechar = t->typechar;
+            ft.size = 8;
+            if (t->convert(span->start, span->length, &ft, options, (char *) &value) != 0) {
+                return FALSE;
+            }
+            if (t->typechar == 'd') {
+                if (!(value.d >= t->low && value.d <= t->high)) {
+                    return FALSE;
+                }
+            }
+            else {
+                if (value.q < t->int_low || value.q > t->int_high) {
+                    return FALSE;
+                }
+            }
+        }
+    }
+    return TRUE;
+}
+
+
+void del_row_filter(row_filter *f)
+{
+    int k;
+
+    if (f == NULL) {
+        return;
+    }
+    for (k = 0; k < f->num_terms; ++k) {
+        del_categories(f->terms[k].values);
+    }
+    free(f->terms);
+    free(f);
+}
@@ -0,0 +1,74 @@
+#ifndef ROW_FILTER_H
+#define ROW_FILTER_H
+
+#include <stdint.h>
+
+#include "field_type.h"
+#include "tokenize.h"
+#include "categories.h"
+
+/*
+ *  The kinds of terms of a row filter.
+ *
+ *  FILTER_IN:     the text of the field is one of a set of strings
+ *                 (compared as bytes, after the quotes are removed).
+ *  FILTER_RANGE:  the field, converted to the type of the term, is
+ *                 between the low and high bounds (inclusive).  An empty
+ *                 field, or one that can't be converted, is not in any
+ *                 range.
+ */
+
+#define FILTER_IN     1
+#define FILTER_RANGE  2
+
+
+/*
+ *  One term of a filter.  column is the index of the field in the file
+ *  (negative values count from the end, as in usecols); field is the
+ *  validated index, set by new_reader().  The type of a range is 'd'
+ *  (with the bounds in low and high) or 'q' or one of the datetime types
+ *  (with the bounds in int_low and int_high).
+ */
+
+typedef struct _filter_term {
+    int kind;
+    int column;
+    int field;
+
+    /* FILTER_IN: the strings, in a dictionary used as a set. */
+    categories *values;
+
+    /* FILTER_RANGE */
+    char typechar;
+    convert_func convert;
+    double low, high;
+    int64_t int_low, int_high;
+} filter_term;
+
+
+/*
+ *  A row filter: a row is kept if it matches all the terms.  See
+ *  row_filter.c.
+ */
+
+typedef struct _row_filter {
+    filter_term *terms;
+    int num_terms;
+    int capacity;
+} row_filter;
+
+
+row_filter *new_row_filter(void);
+
+int filter_in(row_filter *f, int column, char **values, int *lengths, int count);
+
+int filter_range(row_filter *f, int column, double low, double high);
+
+int filter_int_range(row_filter *f, int column, char typechar,
+                     int64_t low, int64_t high);
+
+int row_matches(row_filter *f, field_span *words, conversion_options *options);
+
+void del_row_filter(row_filter *f);
+
+#endif
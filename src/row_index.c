@@ -0,0 +1,262 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "file_buffer.h"
+#include "tokenize.h"
+#include "sizes.h"
+#include "constants.h"
+#include "scan.h"
+#include "row_index.h"
+
+
+/*
+ *  The sidecar file is the header below followed by num_entries entries,
+ *  written in the native layout and byte order of the machine (so it is
+ *  not meant to be copied to a different kind of machine).  The size and
+ *  modification time of the data file are saved in the header; an index
+ *  whose file has changed since it was built is not used.
+ *
+ *  XXX The modification time has a resolution of one second, so a change
+ *  that doesn't change the size of the file, made in the same second that
+ *  the index was built, is not detected.
+ */
+
+#define ROW_INDEX_MAGIC "TXRIDX01"
+
+typedef struct _row_index_header {
+    char magic[8];
+    int64_t file_size;
+    int64_t file_mtime;
+    char delimiter;
+    char quote;
+    char comment;
+    char unused;
+    int32_t step;
+    int64_t num_rows;
+    int64_t num_entries;
+} row_index_header;
+
+
+static int file_stat(FILE *f, int64_t *p_size, int64_t *p_mtime)
+{
+    struct stat st;
+
+    if (fstat(fileno(f), &st) != 0) {
+        return -1;
+    }
+    *p_size = (int64_t) st.st_size;
+    *p_mtime = (int64_t) st.st_mtime;
+    return 0;
+}
+
+
+/*
+ *  int build_row_index(FILE *f, char *path,
+ *                      char delimiter, char quote, char comment, int step)
+ *
+ *  Find the start of every step-th row of f, from the beginning of the
+ *  file, and save the row index in the file path.  The rows are found as
+ *  in count_rows(): by find_rows() where possible, otherwise with the
+ *  tokenizer.  The position of f is not changed.
+ *
+ *  This needs a file buffer that gives random access to the file (see
+ *  file_buffer.h).
+ *
+ *  Returns the number of rows in the file; negative return values
+ *  indicate an error.
+ */
+
+int build_row_index(FILE *f, char *path,
+                    char delimiter, char quote, char comment, int step)
+{
+    row_index_header header;
+    row_index_entry *entries;
+    int64_t capacity;
+    void *fb;
+    char *contents;
+    off_t pos, size, end, num_lines;
+    long initial_pos;
+    int num_rows, n;
+    FILE *out;
+    int ok;
+
+    if (step < 1) {
+        return -1;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ROW_INDEX_MAGIC, sizeof(header.magic));
+    if (file_stat(f, &header.file_size, &header.file_mtime) != 0) {
+        return -1;
+    }
+    header.delimiter = delimiter;
+    header.quote = quote;
+    header.comment = comment;
+    header.step = step;
+
+    initial_pos = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    fb = new_file_buffer(f, -1);
+    if (fb == NULL) {
+        fseek(f, initial_pos, SEEK_SET);
+        return -1;
+    }
+    contents = buffer_contents(fb, &pos, &size);
+    if (contents == NULL) {
+        del_file_buffer(fb, RESTORE_NOT);
+        fseek(f, initial_pos, SEEK_SET);
+        return -1;
+    }
+
+    capacity = 1024;
+    entries = (row_index_entry *) malloc(capacity * sizeof(row_index_entry));
+    if (entries == NULL) {
+        del_file_buffer(fb, RESTORE_NOT);
+        fseek(f, initial_pos, SEEK_SET);
+        return -1;
+    }
+    entries[0].offset = pos;
+    entries[0].line = 0;
+    header.num_entries = 1;
+
+    num_rows = 0;
+    while (1) {
+        end = find_rows(contents, size, pos, delimiter, quote, comment, step, &n, &num_lines);
+        if (end < 0) {
+            /* find_rows() can't handle these rows; tokenize them. */
+            row_buffer rb;
+            int tok_error_type;
+
+            if (init_row_buffer(&rb) != 0) {
+                free(entries);
+                del_file_buffer(fb, RESTORE_NOT);
+                fseek(f, initial_pos, SEEK_SET);
+                return -1;
+            }
+            set_projection(&rb, NULL, 0, -1);
+            buffer_seek(fb, pos);
+            set_line_number(fb, 0);
+            n = 0;
+            while (n < step && tokenize(fb, &rb, delimiter, quote, comment, TRUE, &tok_error_type) > 0) {
+                ++n;
+            }
+            free_row_buffer(&rb);
+            buffer_contents(fb, &end, &size);
+            num_lines = line_number(fb);
+        }
+        num_rows += n;
+        if (n < step) {
+            break;
+        }
+
+        if (header.num_entries == capacity) {
+            row_index_entry *new_entries;
+            capacity *= 2;
+            new_entries = (row_index_entry *) realloc(entries, capacity * sizeof(row_index_entry));
+            if (new_entries == NULL) {
+                free(entries);
+                del_file_buffer(fb, RESTORE_NOT);
+                fseek(f, initial_pos, SEEK_SET);
+                return -1;
+            }
+            entries = new_entries;
+        }
+        entries[header.num_entries].offset = end;
+        entries[header.num_entries].line = entries[header.num_entries - 1].line + num_lines;
+        header.num_entries++;
+        pos = end;
+    }
+    header.num_rows = num_rows;
+
+    del_file_buffer(fb, RESTORE_NOT);
+    fseek(f, initial_pos, SEEK_SET);
+
+    out = fopen(path, "wb");
+    if (out == NULL) {
+        free(entries);
+        return -1;
+    }
+    ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+         fwrite(entries, sizeof(row_index_entry), header.num_entries, out) == (size_t) header.num_entries;
+    ok = (fclose(out) == 0) && ok;
+    free(entries);
+    if (!ok) {
+        remove(path);
+        return -1;
+    }
+    return num_rows;
+}
+
+
+/*
+ *  row_index *load_row_index(char *path, FILE *f,
+ *                            char delimiter, char quote, char comment)
+ *
+ *  Read the row index saved in the file path by build_row_index().
+ *  Returns NULL if it can't be read, or if it doesn't apply: if f has
+ *  been changed since the index was built, or if the index was built
+ *  with a different delimiter, quote or comment character.
+ *
+ *  The caller must free the index with del_row_index().
+ */
+
+row_index *load_row_index(char *path, FILE *f,
+                          char delimiter, char quote, char comment)
+{
+    row_index_header header;
+    row_index *ri;
+    int64_t file_size, file_mtime;
+    FILE *in;
+
+    if (path == NULL || file_stat(f, &file_size, &file_mtime) != 0) {
+        return NULL;
+    }
+    in = fopen(path, "rb");
+    if (in == NULL) {
+        return NULL;
+    }
+    if (fread(&header, sizeof(header), 1, in) != 1 ||
+            memcmp(header.magic, ROW_INDEX_MAGIC, sizeof(header.magic)) != 0 ||
+            header.file_size != file_size || header.file_mtime != file_mtime ||
+            header.delimiter != delimiter || header.quote != quote ||
+            header.comment != comment ||
+            header.step < 1 || header.num_entries < 1) {
+        fclose(in);
+        return NULL;
+    }
+
+    ri = (row_index *) malloc(sizeof(row_index));
+    if (ri == NULL) {
+        fclose(in);
+        return NULL;
+    }
+    ri->entries = (row_index_entry *) malloc(header.num_entries * sizeof(row_index_entry));
+    if (ri->entries == NULL ||
+            fread(ri->entries, sizeof(row_index_entry), header.num_entries, in)
+                != (size_t) header.num_entries) {
+        fclose(in);
+        del_row_index(ri);
+        return NULL;
+    }
+    fclose(in);
+
+    ri->delimiter = delimiter;
+    ri->quote = quote;
+    ri->comment = comment;
+    ri->step = header.step;
+    ri->num_rows = header.num_rows;
+    ri->num_entries = header.num_entries;
+    return ri;
+}
+
+
+void del_row_index(row_index *ri)
+{
+    free(ri->entries);
+    free(ri);
+}
@@ -0,0 +1,46 @@
+
+#ifndef ROW_INDEX_H
+#define ROW_INDEX_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ *  A row index holds the position in the file of the start of every
+ *  step-th row (row 0, step, 2*step, ...), and the number of '\n' before
+ *  it, so that a reader can go directly to any row.  It is saved in a
+ *  "sidecar" file next to the data file; see row_index.c.
+ */
+
+typedef struct _row_index_entry {
+    int64_t offset;
+    int64_t line;
+} row_index_entry;
+
+typedef struct _row_index {
+
+    char delimiter;
+    char quote;
+    char comment;
+
+    int step;
+
+    /* Number of rows in the file. */
+    int64_t num_rows;
+
+    /* entries[k] is the start of row k * step. */
+    int64_t num_entries;
+    row_index_entry *entries;
+
+} row_index;
+
+
+int build_row_index(FILE *f, char *path,
+                    char delimiter, char quote, char comment, int step);
+
+row_index *load_row_index(char *path, FILE *f,
+                          char delimiter, char quote, char comment);
+
+void del_row_index(row_index *ri);
+
+#endif
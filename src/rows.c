@@ -3,6 +3,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <limits.h>
 #include <time.h>
 #include <errno.h>
 
@@ -14,26 +15,28 @@
 #include "fields.h"
 #include "rows.h"
 #include "error_types.h"
+#include "parallel.h"
+#include "scan.h"
+#include "reader.h"
+#include "validity.h"
 
-int64_t str_to_int64(const char *p_item, int64_t int_min, int64_t int_max, int *error);
-uint64_t str_to_uint64(const char *p_item, uint64_t uint_max, int *error);
-
-
-/*
- *  XXX Might want to couple count_rows() with read_rows() to avoid duplication
- *      of some file I/O.
- */
 
 /*
- *  WORD_BUFFER_SIZE determines the maximum amount of non-delimiter
- *  text in a row.
+ *  When read_rows() allocates the memory for the data and the number
+ *  of rows is not known, this is the number of rows for which memory
+ *  is initially allocated.  The memory is doubled whenever it fills up.
  */
-#define WORD_BUFFER_SIZE 4000
+#define INITIAL_ROW_CAPACITY 4096
 
 /*
  *
  *  int count_rows(FILE *f, char delimiter, char quote, char comment, int allow_embedded_newline)
  *
+ *  When the file buffer gives random access to the file, the rows are
+ *  counted by find_rows() (see scan.c), which doesn't tokenize them.
+ *  Otherwise, or if find_rows() can't handle the data, each row is
+ *  tokenized.
+ *
  *  Negative return values indicate an error.
  *
  *  XXX Need a mechanism to pass more error information back to the caller.
@@ -43,27 +46,34 @@ int count_rows(FILE *f, char delimiter, char quote, char comment, int allow_embe
 {
     void *fb;
     int row_count;
-    int num_fields;
-    char **result;
-    char word_buffer[WORD_BUFFER_SIZE];
+    row_buffer rb;
     int tok_error_type;
+    char *contents;
+    off_t pos, size;
 
     fb = new_file_buffer(f, -1);
     if (fb == NULL) {
         return -1;
     }
- 
+
+    contents = buffer_contents(fb, &pos, &size);
+    if (contents != NULL &&
+            find_rows(contents, size, pos, delimiter, quote, comment, -1, &row_count, NULL) >= 0) {
+        del_file_buffer(fb, RESTORE_INITIAL);
+        return row_count;
+    }
+
+    if (init_row_buffer(&rb) != 0) {
+        del_file_buffer(fb, RESTORE_INITIAL);
+        return -1;
+    }
+    set_projection(&rb, NULL, 0, -1);
     row_count = 0;
-    while ((result = tokenize(fb, word_buffer, WORD_BUFFER_SIZE,
-                              delimiter, quote, comment, &num_fields, TRUE, &tok_error_type)) != NULL) {
-        if (result == NULL) {
-            row_count = -1;
-            break;
-        }
-        free(result);
+    while (tokenize(fb, &rb, delimiter, quote, comment, TRUE, &tok_error_type) > 0) {
         ++row_count;
     }
 
+    free_row_buffer(&rb);
     del_file_buffer(fb, RESTORE_INITIAL);
 
     return row_count;
@@ -74,24 +84,24 @@ int count_fields(FILE *f, char delimiter, char quote, char comment, int allow_em
 {
     void *fb;
     int num_fields;
-    char **result;
-    char word_buffer[WORD_BUFFER_SIZE];
+    row_buffer rb;
     int tok_error_type;
 
     fb = new_file_buffer(f, -1);
     if (fb == NULL) {
         return -1;
     }
+    if (init_row_buffer(&rb) != 0) {
+        del_file_buffer(fb, RESTORE_INITIAL);
+        return -1;
+    }
  
-    result = tokenize(fb, word_buffer, WORD_BUFFER_SIZE,
-                      delimiter, quote, comment, &num_fields, TRUE, &tok_error_type);
-    if (result == NULL) {
+    num_fields = tokenize(fb, &rb, delimiter, quote, comment, TRUE, &tok_error_type);
+    if (num_fields == 0) {
         num_fields = -1;
     }
-    else {
-        free(result);
-    }
 
+    free_row_buffer(&rb);
     del_file_buffer(fb, RESTORE_INITIAL);
 
     return num_fields;
@@ -109,7 +119,7 @@ int count_fields(FILE *f, char delimiter, char quote, char comment, int allow_em
     void *fb;
     int row_count;
     int num_fields;
-    char **result;
+    field_span *result;
     char word_buffer[WORD_BUFFER_SIZE];
     int tok_error_type;
 
@@ -133,274 +143,432 @@ int count_fields(FILE *f, char delimiter, char quote, char comment, int allow_em
 
 
 /*
- *  XXX Handle errors in any of the functions called by read_rows().
- *
- *  XXX Currently *nrows must be at least 1.
+ *  Convert one field, and mark it as missing in its validity bitmap (if
+ *  it has one) if it is empty or an NA token.  A missing value is stored
+ *  as an empty field.
  */
 
-void *read_rows(FILE *f, int *nrows, char *fmt,
-                char delimiter, char quote, char comment,
-                char sci, char decimal,
-                int allow_embedded_newline,
-                char *datetime_fmt,
-                int tz_offset,
-                int32_t *usecols, int num_usecols,
-                int skiprows,
-                void *data_array,
-                int *p_error_type, int *p_error_lineno)
+static int convert_field(field_span *span, field_type *ft,
+                         conversion_options *options, char *data_ptr, size_t row)
 {
-    void *fb;
-    char *data_ptr;
-    int num_fields, current_num_fields;
-    char **result;
-    int fmt_nfields;
-    field_type *ftypes;
-    int size;
-    int row_count;
-    int j;
-    int *valid_usecols;
-    char word_buffer[WORD_BUFFER_SIZE];
-    int tok_error_type;
-
-    *p_error_type = 0;
-    *p_error_lineno = 0;
+    validity *v = ft->validity;
 
-    if (datetime_fmt == NULL || strlen(datetime_fmt) == 0) {
-        datetime_fmt = "%Y-%m-%d %H:%M:%S";
+    if (v != NULL && is_missing(v, span->start, span->length)) {
+        ft->convert(span->start, 0, ft, options, data_ptr);
+        return (set_missing(v, (int64_t) row) == 0) ? 0 : ERROR_OUT_OF_MEMORY;
     }
+    return ft->convert(span->start, span->length, ft, options, data_ptr);
+}
 
-    size = (*nrows) * calc_size(fmt, &fmt_nfields);
 
-    ftypes = enumerate_fields(fmt);  /* Must free this when finished. */
-    if (ftypes == NULL) {
-        /* Out of memory. */
-        *p_error_type = READ_ERROR_OUT_OF_MEMORY;
-        return NULL;
+/*
+ *  int convert_row(field_span *result, ...)
+ *
+ *  Convert the fields of one row (the spans in result, as returned by
+ *  tokenize()) to the types given in ftypes, and store the values in
+ *  the row at data_ptr.  valid_usecols[j] is the index in result of the
+ *  field that is converted to the type ftypes[j].  row is the index of
+ *  the row in the validity bitmaps of the fields.
+ *
+ *  Returns 0, or the error code of the first field that could not be
+ *  converted.  (All the fields are converted in either case.)  If
+ *  field_errors is not NULL, the error code of each field j that could
+ *  not be converted is also put in field_errors[j]; the other entries
+ *  are not changed, so the caller only has to clear the entries after
+ *  an error.
+ */
+
+int convert_row(field_span *result, field_type *ftypes,
+                int *valid_usecols, int num_usecols,
+                conversion_options *options, char *data_ptr, size_t row,
+                int *field_errors)
+{
+    int j, k;
+    int error, first_error = 0;
+
+    for (j = 0; j < num_usecols; ++j) {
+        /* k is the column index of the field in the file. */
+        k = valid_usecols[j];
+        error = convert_field(&result[k], &ftypes[j], options,
+                              data_ptr + ftypes[j].offset, row);
+        if (error) {
+            if (!first_error) {
+                first_error = error;
+            }
+            if (field_errors != NULL) {
+                field_errors[j] = error;
+            }
+        }
     }
+    return first_error;
+}
 
-    /*
-    for (k = 0; k < fmt_nfields; ++k) {
-        printf("k = %d  typechar = '%c'  size = %d\n", k, ftypes[k].typechar, ftypes[k].size);
+
+/*
+ *  int convert_columns(field_span *result, ...)
+ *
+ *  Like convert_row(), but for data stored by column: the value of
+ *  field j is stored in row `row` of the column columns[j] (at
+ *  columns[j] + row * ftypes[j].size).
+ */
+
+int convert_columns(field_span *result, field_type *ftypes,
+                    int *valid_usecols, int num_usecols,
+                    conversion_options *options, char **columns, size_t row,
+                    int *field_errors)
+{
+    int j, k;
+    int error, first_error = 0;
+
+    for (j = 0; j < num_usecols; ++j) {
+        k = valid_usecols[j];
+        error = convert_field(&result[k], &ftypes[j], options,
+                              columns[j] + row * ftypes[j].size, row);
+        if (error) {
+            if (!first_error) {
+                first_error = error;
+            }
+            if (field_errors != NULL) {
+                field_errors[j] = error;
+            }
+        }
     }
-    printf("size = %d\n", size);
-    printf("-----\n");
-    */
+    return first_error;
+}
 
-    if (data_array == NULL) {
-        /* XXX The case where data_ptr is allocated here is untested. */
-        data_ptr = malloc(size);
+
+/*
+ *  int resize_data(char **p_data, int columnar, field_type *ftypes,
+ *                  int num_columns, int row_size, int capacity)
+ *
+ *  Reallocate the memory for the data to hold capacity rows.  If columnar
+ *  is false, *p_data is the data, with rows of row_size bytes.  Otherwise
+ *  p_data is an array of num_columns columns; the values in column j have
+ *  ftypes[j].size bytes.  NULL pointers are allocated.
+ *
+ *  Returns 0, or -1 if out of memory.  The data is still valid after a
+ *  failure (some of the columns may have been reallocated).
+ */
+
+int resize_data(char **p_data, int columnar, field_type *ftypes,
+                int num_columns, int row_size, int capacity)
+{
+    char *new_data;
+    int j;
+
+    if (!columnar) {
+        new_data = realloc(*p_data, (size_t) capacity * row_size);
+        if (new_data == NULL) {
+            return -1;
+        }
+        *p_data = new_data;
+        return 0;
     }
-    else {
-        data_ptr = data_array;
+    for (j = 0; j < num_columns; ++j) {
+        new_data = realloc(p_data[j], (size_t) capacity * ftypes[j].size);
+        if (new_data == NULL) {
+            return -1;
+        }
+        p_data[j] = new_data;
     }
+    return 0;
+}
 
-    fb = new_file_buffer(f, -1);
-    if (fb == NULL) {
-        free(ftypes);
-        *p_error_type = ERROR_OUT_OF_MEMORY;
-        return NULL;
+
+static void free_data(char **p_data, int columnar, int num_columns)
+{
+    int j;
+
+    for (j = 0; j < (columnar ? num_columns : 1); ++j) {
+        free(p_data[j]);
+        p_data[j] = NULL;
     }
+}
+
 
-    /* XXX Check interaction of skiprows with comments. */
-    while ((skiprows > 0) && ((result = tokenize(fb, word_buffer, WORD_BUFFER_SIZE,
-                              delimiter, quote, comment, &num_fields, TRUE, &tok_error_type)) != NULL)) {
-        if (result == NULL) {
-            break;
+/*
+ *  The body of read_rows() and read_columns().  The data is stored in
+ *  *p_data, or by column in p_data[0], p_data[1], ... if columnar is
+ *  true (see reader_read()).  If allocate is true, the memory for the
+ *  data is allocated here.  Returns 0, or -1 if there is an error (with
+ *  nothing allocated).  If p_fmt is not NULL, *p_fmt is set to the
+ *  format of the data.
+ */
+
+static int read_data(FILE *f, int *nrows, char *fmt,
+                     char delimiter, char quote, char comment,
+                     char sci, char decimal,
+                     int allow_embedded_newline,
+                     char *datetime_fmt,
+                     int tz_offset,
+                     int32_t *usecols, int num_usecols,
+                     int skiprows, int num_threads, int buffer_size,
+                     char *index_path, categories **cats, string_arena **arenas,
+                     validity **masks, field_batch **batches, error_log *errors,
+                     row_filter *filter,
+                     int columnar, char **p_data, int allocate, char **p_fmt,
+                     int *p_error_type, int *p_error_lineno)
+{
+    reader *r;
+    int row_count;
+    int max_rows;
+    int row_capacity;
+    int j, has_strings = FALSE;
+
+    *p_error_type = 0;
+    *p_error_lineno = 0;
+
+    r = new_reader(f, fmt, delimiter, quote, comment, sci, decimal,
+                   allow_embedded_newline, datetime_fmt, tz_offset,
+                   usecols, num_usecols, skiprows, buffer_size, index_path,
+                   cats, arenas, masks, batches, filter, p_error_type, p_error_lineno);
+    if (r == NULL) {
+        return -1;
+    }
+    r->columnar = columnar;
+    r->promote = (p_fmt != NULL && allocate);
+    r->errors = errors;
+    for (j = 0; j < num_usecols; ++j) {
+        if (r->ftypes[j].typechar == 's') {
+            has_strings = TRUE;
         }
-        free(result);
-        --skiprows;
     }
 
-    if (skiprows > 0) {
-        /* There were fewer rows in the file than skiprows. */
-        /* This is not treated as an error. The result should be an empty array. */
-        *nrows = 0;
-        free(ftypes);
-        del_file_buffer(fb, RESTORE_FINAL);
-        return data_ptr;
+    if (allocate) {
+        if (*nrows < 0) {
+            max_rows = INT_MAX;
+            row_capacity = INITIAL_ROW_CAPACITY;
+        }
+        else {
+            max_rows = *nrows;
+            row_capacity = (*nrows > 0) ? *nrows : 1;
+        }
+        if (resize_data(p_data, columnar, r->ftypes, num_usecols, r->row_size,
+                        row_capacity) != 0) {
+            free_data(p_data, columnar, num_usecols);
+            del_reader(r, RESTORE_FINAL);
+            *p_error_type = ERROR_OUT_OF_MEMORY;
+            return -1;
+        }
+    }
+    else {
+        max_rows = *nrows;
+        row_capacity = *nrows;
     }
 
-    /* XXX Assume *nrows > 0! */
+    row_count = 0;
     /*
-     *  Read the first row to get the number of fields in the file.
-     *  We'll then use this to pre-validate the values in usecols.
-     *  (It might be easier to do this in the Python wrapper, but that
-     *  would require refactoring the C interface a bit to expose more
-     *  to Python.)
+     *  A value that doesn't fit its type stops the threads, so types can
+     *  be promoted after a parallel read falls back to reader_read().
+     *  But strings that are too long are truncated without an error.
+     *  Batches are never read by the threads, and reading the first row
+     *  alone would flush them for that row.  The threads write each row
+     *  at an index that is known before the row is read, which a filter
+     *  doesn't allow.
      */
-    row_count = 0;
-    result = tokenize(fb, word_buffer, WORD_BUFFER_SIZE,
-                              delimiter, quote, comment, &num_fields, TRUE, &tok_error_type);
-    if (result == NULL) {
-        *p_error_type = tok_error_type;
-        *p_error_lineno = 1;
-        free(ftypes);
-        del_file_buffer(fb, RESTORE_FINAL);
-        return NULL;
+    if (num_threads != 1 && max_rows > 1 && !(r->promote && has_strings) &&
+            r->num_batched == 0 && filter == NULL) {
+        /*
+         *  Read the first row, then try to read the rest of the rows with
+         *  several threads.  If that is not possible, read_rows_parallel()
+         *  returns -1, and the rows are read by reader_read().
+         */
+        row_count = reader_read(r, 1, allocate, p_data, row_count, &row_capacity,
+                                p_error_type, p_error_lineno);
+        if (row_count == 1 && !r->finished) {
+            int n;
+            n = read_rows_parallel(r->fb, num_threads, delimiter, quote, comment,
+                                   allow_embedded_newline, r->num_fields,
+                                   r->ftypes, r->valid_usecols, r->num_usecols, &(r->options),
+                                   r->row_size, columnar, max_rows, allocate,
+                                   p_data, row_count, &row_capacity);
+            if (n >= 0) {
+                row_count += n;
+                r->finished = TRUE;
+            }
+        }
     }
+    row_count += reader_read(r, max_rows - row_count, allocate,
+                             p_data, row_count, &row_capacity, p_error_type, p_error_lineno);
 
-    valid_usecols = (int *) malloc(num_usecols * sizeof(int));
-    if (valid_usecols == NULL) {
-        /* Out of memory. */
-        *p_error_type = ERROR_OUT_OF_MEMORY;
-        free(result);
-        free(ftypes);
-        del_file_buffer(fb, RESTORE_FINAL);
-        return NULL;
+    if (allocate && row_count < row_capacity) {
+        /* Trim the memory to the size of the data that was read. */
+        resize_data(p_data, columnar, r->ftypes, num_usecols, r->row_size,
+                    row_count > 0 ? row_count : 1);
     }
 
-    /*
-     *  Validate the column indices in usecols, and put the validated
-     *  column indices in valid_usecols.
-     */
-    for (j = 0; j < num_usecols; ++j) {
-
-        int32_t k;
-        k = usecols[j];
-        if (k < -num_fields || k >= num_fields) {
-            /* Invalid column index. */
-            *p_error_type = ERROR_INVALID_COLUMN_INDEX;
-            *p_error_lineno = j;  /* Abuse 'lineno' and put the bad column index there. */
-            free(valid_usecols);
-            free(result);
-            free(ftypes);
-            del_file_buffer(fb, RESTORE_FINAL);
-            return NULL;
-        }
-        if (k < 0) {
-            k += num_fields;
+    if (p_fmt != NULL) {
+        *p_fmt = reader_format(r);
+        if (*p_fmt == NULL) {
+            if (allocate) {
+                free_data(p_data, columnar, num_usecols);
+            }
+            del_reader(r, RESTORE_FINAL);
+            *p_error_type = ERROR_OUT_OF_MEMORY;
+            return -1;
         }
-        valid_usecols[j] = k;
     }
 
-    current_num_fields = num_fields;
-    row_count = 0;
-    do {
-        int j, k;
+    del_reader(r, RESTORE_FINAL);
+
+    *nrows = row_count;
+    return 0;
+}
 
-        if (current_num_fields != num_fields) {
-            *p_error_type = ERROR_CHANGED_NUMBER_OF_FIELDS;
-            *p_error_lineno = line_number(fb);
-            break;
-        }
 
-        for (j = 0; j < num_usecols; ++j) {
+/*
+ *  void *read_rows(FILE *f, int *nrows, char *fmt, ...)
+ *
+ *  Read rows of data from f into data_array, and return a pointer to
+ *  the start of the data.  On return, *nrows holds the number of rows
+ *  that were actually read.
+ *
+ *  If data_array is NULL, the memory for the data is allocated here,
+ *  and the caller must free() it.  In that case, *nrows may be negative,
+ *  which means "read all the rows".  The memory is then grown geometrically
+ *  as rows are read, and trimmed to the size of the data when the read
+ *  is finished.  This allows the caller to read the file in a single pass,
+ *  instead of first calling count_rows() to find the size of the array.
+ *
+ *  The rows are read with a reader (see reader.c), which is deleted when
+ *  the read is finished.  To read a file in pieces, use a reader directly.
+ *
+ *  buffer_size is passed to new_file_buffer() (-1 for the default).
+ *  index_path (which may be NULL) is the name of a row index file for
+ *  skiprows; see new_reader().
+ *
+ *  If num_threads is not 1 and the file buffer allows random access to
+ *  the file (see file_buffer.h), the rows after the first row are read
+ *  with up to num_threads threads (all the processors if num_threads is
+ *  0 or negative).  See parallel.c.
+ *
+ *  cats is an array of num_usecols dictionaries (see categories.h), one
+ *  for each categorical ('k') field of fmt; the other entries are not
+ *  used, and cats may be NULL if there are no categorical fields.  The
+ *  dictionaries belong to the caller, who gets the strings of the codes
+ *  from them after the read.  Since the codes are given in the order in
+ *  which the strings are first seen, the rows are read by one thread
+ *  when there are categorical fields.
+ *
+ *  Similarly, arenas is an array of num_usecols string arenas (see
+ *  arena.h), one for each variable-length string ('v') field; it may be
+ *  NULL if there are none.  The field holds the offset of its string in
+ *  the arena, and the arenas belong to the caller.  The offsets depend
+ *  on the order of the rows, so these fields are also read by one
+ *  thread.
+ *
+ *  masks is an array of num_usecols validity bitmaps (see validity.h), or
+ *  NULL.  The missing values (empty fields and NA tokens) of a field with
+ *  a bitmap are marked in the bitmap, with the rows counted from 0; the
+ *  field itself is stored as an empty field.  The bitmaps belong to the
+ *  caller.
+ *
+ *  batches is an array of num_usecols batches (see batch.h), or NULL.  A
+ *  field with a batch is converted by its batch function instead of the
+ *  converter of its type: the text of the values is collected in the
+ *  batch, and the function converts a block of rows (the capacity of the
+ *  batch) at once, which is how a converter that is expensive to call
+ *  (such as a Python function) is used.  The batches belong to the
+ *  caller.  Like the arenas, they make the rows be read by one thread.
+ *
+ *  If p_fmt is not NULL and data_array is NULL, the types of the fields
+ *  are promoted as needed to hold the values (e.g. an 'i' field widens to
+ *  'q' or 'd' when a value doesn't fit; see reader_read() and infer.c),
+ *  instead of reporting conversion errors.  This is meant for a format
+ *  made by infer_format().  If the read succeeds, *p_fmt is set to the
+ *  format of the data that is returned (one character or count per
+ *  field), which the caller must free().  If data_array is not NULL,
+ *  nothing is promoted.
+ *
+ *  A field that can't be converted (e.g. "1.q25" in a float field) does
+ *  not stop the read.  The field is set to 0 (NaN for floating point
+ *  fields), and the first such error is returned in *p_error_type and
+ *  *p_error_lineno (unless a later error stops the read).
+ *
+ *  If errors is not NULL, each bad row (a row with a field that can't be
+ *  converted, or with the wrong number of fields) is recorded in the
+ *  log, with the row, the column, the line and the position of the row
+ *  in the file, and is kept, left out or made to stop the read according
+ *  to the policy of the log (see error_log.h and reader_read()).  The log
+ *  belongs to the caller.  The threads stop at a bad row, and the rows
+ *  are then read again by one thread, so the log is the same for any
+ *  num_threads.
+ *
+ *  If filter is not NULL, only the rows that match it (see row_filter.h)
+ *  are read: the other rows are not converted, take no space in the
+ *  data, and are not counted in *nrows, in the rows of the errors, or in
+ *  the rows of the validity bitmaps.  An invalid column in the filter is
+ *  ERROR_INVALID_FILTER_COLUMN (see new_reader()).  The filter belongs to
+ *  the caller.  The rows are read by one thread when there is a filter.
+ *
+ *  XXX Handle errors in any of the functions called by read_rows().
+ */
 
-            int error;
-            char typ = ftypes[j].typechar;
-            /* k is the column index of the field in the file. */
-            k = valid_usecols[j];
+void *read_rows(FILE *f, int *nrows, char *fmt,
+                char delimiter, char quote, char comment,
+                char sci, char decimal,
+                int allow_embedded_newline,
+                char *datetime_fmt,
+                int tz_offset,
+                int32_t *usecols, int num_usecols,
+                int skiprows, int num_threads, int buffer_size,
+                char *index_path, categories **cats, string_arena **arenas,
+                validity **masks, field_batch **batches, error_log *errors,
+                row_filter *filter, void *data_array, char **p_fmt,
+                int *p_error_type, int *p_error_lineno)
+{
+    char *data = data_array;
 
-            /* XXX Handle error != 0 in the following cases. */
-            if (typ == 'b') {
-                int8_t x = (int8_t) str_to_int64(result[k], INT8_MIN, INT8_MAX, &error);
-                *(int8_t *) data_ptr = x;
-                data_ptr += ftypes[j].size;
-            }
-            else if (typ == 'B') {
-                uint8_t x = (uint8_t) str_to_uint64(result[k], UINT8_MAX, &error);
-                *(uint8_t *) data_ptr = x;
-                data_ptr += ftypes[j].size;   
-            }
-            else if (typ == 'h') {
-                int16_t x = (int16_t) str_to_int64(result[k], INT16_MIN, INT16_MAX, &error);
-                *(int16_t *) data_ptr = x;
-                data_ptr += ftypes[j].size;
-            }
-            else if (typ == 'H') {
-                uint16_t x = (uint16_t) str_to_uint64(result[k], UINT16_MAX, &error);
-                *(uint16_t *) data_ptr = x;
-                data_ptr += ftypes[j].size;    
-            }
-            else if (typ == 'i') {
-                int32_t x = (int32_t) str_to_int64(result[k], INT32_MIN, INT32_MAX, &error);
-                *(int32_t *) data_ptr = x;
-                data_ptr += ftypes[j].size;   
-            }
-            else if (typ == 'I') {
-                uint32_t x = (uint32_t) str_to_uint64(result[k], UINT32_MAX, &error);
-                *(uint32_t *) data_ptr = x;
-                data_ptr += ftypes[j].size;   
-            }
-            else if (typ == 'q') {
-                int64_t x = (int64_t) str_to_int64(result[k], INT64_MIN, INT64_MAX, &error);
-                *(int64_t *) data_ptr = x;
-                data_ptr += ftypes[j].size; 
-            }
-            else if (typ == 'Q') {
-                uint64_t x = (uint64_t) str_to_uint64(result[k], UINT64_MAX, &error);
-                *(uint64_t *) data_ptr = x;
-                data_ptr += ftypes[j].size;    
-            }
-            else if (typ == 'f' || typ == 'd') {
-                // Convert to float.
-                double x;
-                if ((strlen(result[k]) == 0) || !to_double(result[k], &x, sci, decimal)) {
-                    // XXX  Find the canonical platform-independent method to assign nan.
-                    x = 0.0 / 0.0;
-                }
-                if (typ == 'f')
-                    *(float *) data_ptr = (float) x;
-                else
-                    *(double *) data_ptr = x;
-                data_ptr += ftypes[j].size;
-            }
-            else if (typ == 'c' || typ == 'z') {
-                // Convert to complex.
-                double x, y;
-                if ((strlen(result[k]) == 0) || !to_complex(result[k], &x, &y, sci, decimal)) {
-                    // XXX  Find the canonical platform-independent method to assign nan.
-                    x = 0.0 / 0.0;
-                    y = x;
-                }
-                if (typ == 'c') {
-                    *(float *) data_ptr = (float) x;
-                    data_ptr += ftypes[j].size / 2;
-                    *(float *) data_ptr = (float) y;
-                }
-                else {
-                    *(double *) data_ptr = x;
-                    data_ptr += ftypes[j].size / 2; 
-                    *(double *) data_ptr = y;
-                }
-                data_ptr += ftypes[j].size / 2;
-            }
-            else if (typ == 'U') {
-                // Datetime64, microseconds.
-                struct tm tm = {0,0,0,0,0,0,0,0,0};
-                time_t t;
-
-                if (strptime(result[k], datetime_fmt, &tm) == NULL) {
-                    memset(data_ptr, 0, 8);
-                }
-                else {
-                    tm.tm_isdst = -1;
-                    t = mktime(&tm);
-                    if (t == -1) {
-                        memset(data_ptr, 0, 8);
-                    }
-                    else {
-                        *(uint64_t *) data_ptr = (long long) (t - tz_offset) * 1000000L;
-                    }
-                }
-                data_ptr += 8;
-            }
-            else {
-                // String
-                strncpy(data_ptr, result[k], ftypes[j].size);
-                data_ptr += ftypes[j].size;
-            }
-        }
-        free(result);
-        ++row_count;
-    } while ((row_count < *nrows) && (result = tokenize(fb, word_buffer, WORD_BUFFER_SIZE,
-                              delimiter, quote, comment, &current_num_fields, TRUE, &tok_error_type)) != NULL);
+    if (read_data(f, nrows, fmt, delimiter, quote, comment, sci, decimal,
+                  allow_embedded_newline, datetime_fmt, tz_offset,
+                  usecols, num_usecols, skiprows, num_threads, buffer_size,
+                  index_path, cats, arenas, masks, batches, errors, filter, FALSE, &data, data_array == NULL, p_fmt,
+                  p_error_type, p_error_lineno) != 0) {
+        return NULL;
+    }
+    return (void *) data;
+}
 
-    del_file_buffer(fb, RESTORE_FINAL);
 
-    *nrows = row_count;
+/*
+ *  char **read_columns(FILE *f, int *nrows, char *fmt, ...)
+ *
+ *  Like read_rows(), but the data is stored by column: columns is an
+ *  array of num_usecols pointers, and the values of field j (column
+ *  usecols[j] of the file) are stored one after the other in columns[j].
+ *  Each column is a contiguous array of the type given by the j-th field
+ *  of fmt.  This is the layout wanted by code that uses the columns
+ *  separately, and each column is written sequentially.
+ *
+ *  If the pointers in columns are NULL, the memory for each column is
+ *  allocated here (as for read_rows() with data_array NULL), and the
+ *  caller must free() each column.  Otherwise each column must have room
+ *  for *nrows values.
+ *
+ *  Returns columns, or NULL if there is an error.
+ */
 
-    free(valid_usecols);
+char **read_columns(FILE *f, int *nrows, char *fmt,
+                    char delimiter, char quote, char comment,
+                    char sci, char decimal,
+                    int allow_embedded_newline,
+                    char *datetime_fmt,
+                    int tz_offset,
+                    int32_t *usecols, int num_usecols,
+                    int skiprows, int num_threads, int buffer_size,
+                    char *index_path, categories **cats, string_arena **arenas,
+                    validity **masks, field_batch **batches, error_log *errors,
+                    row_filter *filter, char **columns, char **p_fmt,
+                    int *p_error_type, int *p_error_lineno)
+{
+    int allocate = (num_usecols > 0 && columns[0] == NULL);
 
-    return (void *) data_ptr;
+    if (read_data(f, nrows, fmt, delimiter, quote, comment, sci, decimal,
+                  allow_embedded_newline, datetime_fmt, tz_offset,
+                  usecols, num_usecols, skiprows, num_threads, buffer_size,
+                  index_path, cats, arenas, masks, batches, errors, filter, TRUE, columns, allocate, p_fmt,
+                  p_error_type, p_error_lineno) != 0) {
+        return NULL;
+    }
+    return columns;
 }
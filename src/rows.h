@@ -1,4 +1,13 @@
 
+#include "field_type.h"
+#include "tokenize.h"
+#include "categories.h"
+#include "arena.h"
+#include "validity.h"
+#include "error_log.h"
+#include "batch.h"
+#include "row_filter.h"
+
 #define READ_ERROR_OUT_OF_MEMORY   1
 
 int count_rows(FILE *f, char delimiter, char quote, char comment, int allow_embedded_newline);
@@ -13,6 +22,34 @@ void *read_rows(FILE *f, int *nrows, char *fmt,
                 char *datetime_fmt,
                 int tz_offset,
                 int *usecols, int num_usecols,
-                int skiprows,
-                void *data_array,
-                int *p_error_type, int *p_error_lineno);
\ No newline at end of file
+                int skiprows, int num_threads, int buffer_size,
+                char *index_path, categories **cats, string_arena **arenas,
+                validity **masks, field_batch **batches, error_log *errors,
+                row_filter *filter, void *data_array, char **p_fmt,
+                int *p_error_type, int *p_error_lineno);
+
+char **read_columns(FILE *f, int *nrows, char *fmt,
+                    char delimiter, char quote, char comment,
+                    char sci, char decimal,
+                    int allow_embedded_newline,
+                    char *datetime_fmt,
+                    int tz_offset,
+                    int *usecols, int num_usecols,
+                    int skiprows, int num_threads, int buffer_size,
+                    char *index_path, categories **cats, string_arena **arenas,
+                    validity **masks, field_batch **batches, error_log *errors,
+                    row_filter *filter, char **columns, char **p_fmt,
+                    int *p_error_type, int *p_error_lineno);
+
+int convert_row(field_span *result, field_type *ftypes,
+                int *valid_usecols, int num_usecols,
+                conversion_options *options, char *data_ptr, size_t row,
+                int *field_errors);
+
+int convert_columns(field_span *result, field_type *ftypes,
+                    int *valid_usecols, int num_usecols,
+                    conversion_options *options, char **columns, size_t row,
+                    int *field_errors);
+
+int resize_data(char **p_data, int columnar, field_type *ftypes,
+                int num_columns, int row_size, int capacity);
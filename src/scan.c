@@ -0,0 +1,705 @@
+#include <limits.h>
+
+#include "scan.h"
+
+/*
+ *  Vectorized search for the "structural" characters of a row of text.
+ *
+ *  int scan_for_chars(const char *p, int n, char c1, char c2, char c3)
+ *
+ *  Returns the index of the first byte in p[0] ... p[n-1] that is one
+ *  of c1, c2, c3, '\n', '\r' or '\xff', or n if there is no such byte.
+ *  (The byte '\xff' is included because it compares equal to FB_EOF
+ *  after it has been assigned to a char by the tokenizer.)
+ *
+ *  On x86 processors, the search is done 16 bytes at a time with SSE2,
+ *  or 32 bytes at a time with AVX2 if the CPU supports it.  The version
+ *  to use is selected at run time, the first time the function is called.
+ *  On other platforms, a plain C loop is used.
+ */
+
+#define IS_STOP_CHAR(c, c1, c2, c3) \
+    ((c) == (c1) || (c) == (c2) || (c) == (c3) || \
+     (c) == '\n' || (c) == '\r' || (c) == '\xff')
+
+
+static int scan_for_chars_c(const char *p, int n, char c1, char c2, char c3)
+{
+    int k;
+
+    for (k = 0; k < n; ++k) {
+        char c = p[k];
+        if (IS_STOP_CHAR(c, c1, c2, c3)) {
+            break;
+        }
+    }
+    return k;
+}
+
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+#include <immintrin.h>
+
+#define HAVE_SIMD_SCAN 1
+
+__attribute__((target("sse2")))
+static int scan_for_chars_sse2(const char *p, int n, char c1, char c2, char c3)
+{
+    int k = 0;
+    __m128i v1 = _mm_set1_epi8(c1);
+    __m128i v2 = _mm_set1_epi8(c2);
+    __m128i v3 = _mm_set1_epi8(c3);
+    __m128i vnl = _mm_set1_epi8('\n');
+    __m128i vcr = _mm_set1_epi8('\r');
+    __m128i vff = _mm_set1_epi8('\xff');
+
+    while (k + 16 <= n) {
+        __m128i block = _mm_loadu_si128((const __m128i *) (p + k));
+        __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, v1),
+                                              _mm_cmpeq_epi8(block, v2)),
+                                 _mm_or_si128(_mm_cmpeq_epi8(block, v3),
+                                              _mm_cmpeq_epi8(block, vnl)));
+        int mask;
+        m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi8(block, vcr),
+                                         _mm_cmpeq_epi8(block, vff)));
+        mask = _mm_movemask_epi8(m);
+        if (mask) {
+            return k + __builtin_ctz(mask);
+        }
+        k += 16;
+    }
+    return k + scan_for_chars_c(p + k, n - k, c1, c2, c3);
+}
+
+
+__attribute__((target("avx2")))
+static int scan_for_chars_avx2(const char *p, int n, char c1, char c2, char c3)
+{
+    int k = 0;
+    __m256i v1 = _mm256_set1_epi8(c1);
+    __m256i v2 = _mm256_set1_epi8(c2);
+    __m256i v3 = _mm256_set1_epi8(c3);
+    __m256i vnl = _mm256_set1_epi8('\n');
+    __m256i vcr = _mm256_set1_epi8('\r');
+    __m256i vff = _mm256_set1_epi8('\xff');
+
+    while (k + 32 <= n) {
+        __m256i block = _mm256_loadu_si256((const __m256i *) (p + k));
+        __m256i m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(block, v1),
+                                                    _mm256_cmpeq_epi8(block, v2)),
+                                    _mm256_or_si256(_mm256_cmpeq_epi8(block, v3),
+                                                    _mm256_cmpeq_epi8(block, vnl)));
+        unsigned int mask;
+        m = _mm256_or_si256(m, _mm256_or_si256(_mm256_cmpeq_epi8(block, vcr),
+                                               _mm256_cmpeq_epi8(block, vff)));
+        mask = (unsigned int) _mm256_movemask_epi8(m);
+        if (mask) {
+            return k + __builtin_ctz(mask);
+        }
+        k += 32;
+    }
+    /* Finish the last partial block (if any) with SSE2. */
+    return k + scan_for_chars_sse2(p + k, n - k, c1, c2, c3);
+}
+
+#endif
+
+
+/*
+ *  Each function below calls its implementation through a pointer, which
+ *  is set the first time the function is called.  Any thread may set it,
+ *  so it is loaded and stored atomically.  (The threads all store the same
+ *  value, so no ordering is needed.)
+ */
+
+#ifdef __GNUC__
+#define LOAD_IMPL(v)        __atomic_load_n(&(v), __ATOMIC_RELAXED)
+#define STORE_IMPL(v, f)    __atomic_store_n(&(v), (f), __ATOMIC_RELAXED)
+#else
+#define LOAD_IMPL(v)        (v)
+#define STORE_IMPL(v, f)    ((v) = (f))
+#endif
+
+
+typedef int (*scan_func)(const char *p, int n, char c1, char c2, char c3);
+
+static int scan_for_chars_init(const char *p, int n, char c1, char c2, char c3);
+
+static scan_func scan_impl = scan_for_chars_init;
+
+
+/*
+ *  Select the implementation to use, and then do the scan.
+ */
+
+static int scan_for_chars_init(const char *p, int n, char c1, char c2, char c3)
+{
+    scan_func impl = scan_for_chars_c;
+#ifdef HAVE_SIMD_SCAN
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        impl = scan_for_chars_avx2;
+    }
+    else if (__builtin_cpu_supports("sse2")) {
+        impl = scan_for_chars_sse2;
+    }
+#endif
+    STORE_IMPL(scan_impl, impl);
+    return impl(p, n, c1, c2, c3);
+}
+
+
+int scan_for_chars(const char *p, int n, char c1, char c2, char c3)
+{
+    return LOAD_IMPL(scan_impl)(p, n, c1, c2, c3);
+}
+
+
+/*
+ *  off_t count_newlines(const char *p, off_t n, char c1, char c2, char c3,
+ *                       off_t max_count, off_t *p_count)
+ *
+ *  Count the '\n' bytes in p[0] ... p[n-1].  The count stops at the first
+ *  byte that is c1, c2 or c3, or just after the max_count-th '\n' if
+ *  max_count is not negative.  Returns the index at which the count
+ *  stopped (n if it reached the end), and puts the count in *p_count.
+ *
+ *  The SIMD versions compare a block of bytes with '\n' and the stop
+ *  characters, and add the population count of the newline mask to the
+ *  count, so no byte is looked at individually.  The implementation is
+ *  selected at run time, like that of scan_for_chars().
+ *
+ *  The internal versions add to the count already in *p_count.
+ */
+
+static off_t count_newlines_c(const char *p, off_t n, char c1, char c2, char c3,
+                              off_t max_count, off_t *p_count)
+{
+    off_t count = *p_count;
+    off_t k;
+
+    for (k = 0; k < n; ++k) {
+        char c = p[k];
+        if (c == c1 || c == c2 || c == c3) {
+            break;
+        }
+        if (c == '\n' && ++count == max_count) {
+            ++k;
+            break;
+        }
+    }
+    *p_count = count;
+    return k;
+}
+
+
+#ifdef HAVE_SIMD_SCAN
+
+/*
+ *  Used by the SIMD versions when the block at p + k has newlines in the bit
+ *  mask nl.  Returns the index at which the count stops within the block, or
+ *  -1 to go on with the next block.  (count_delimiters() passes its mask of
+ *  delimiters as nl.)
+ */
+
+static inline off_t count_mask(unsigned int nl, unsigned int stop, off_t k,
+                               off_t max_count, off_t *p_count)
+{
+    int num;
+
+    if (stop) {
+        /* Only the newlines before the first stop character are counted. */
+        nl &= (stop & -stop) - 1;
+    }
+    num = __builtin_popcount(nl);
+    if (max_count >= 0 && *p_count + num >= max_count) {
+        int r;
+        /* Drop the newlines before the max_count-th one. */
+        for (r = (int) (max_count - *p_count); r > 1; --r) {
+            nl &= nl - 1;
+        }
+        *p_count = max_count;
+        return k + __builtin_ctz(nl) + 1;
+    }
+    *p_count += num;
+    if (stop) {
+        return k + __builtin_ctz(stop);
+    }
+    return -1;
+}
+
+
+__attribute__((target("sse2")))
+static off_t count_newlines_sse2(const char *p, off_t n, char c1, char c2, char c3,
+                                 off_t max_count, off_t *p_count)
+{
+    off_t k = 0;
+    __m128i v1 = _mm_set1_epi8(c1);
+    __m128i v2 = _mm_set1_epi8(c2);
+    __m128i v3 = _mm_set1_epi8(c3);
+    __m128i vnl = _mm_set1_epi8('\n');
+
+    while (k + 16 <= n) {
+        __m128i block = _mm_loadu_si128((const __m128i *) (p + k));
+        __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, v1),
+                                              _mm_cmpeq_epi8(block, v2)),
+                                 _mm_cmpeq_epi8(block, v3));
+        unsigned int stop = (unsigned int) _mm_movemask_epi8(m);
+        unsigned int nl = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(block, vnl));
+        if (nl | stop) {
+            off_t end = count_mask(nl, stop, k, max_count, p_count);
+            if (end >= 0) {
+                return end;
+            }
+        }
+        k += 16;
+    }
+    return k + count_newlines_c(p + k, n - k, c1, c2, c3, max_count, p_count);
+}
+
+
+__attribute__((target("avx2,popcnt")))
+static off_t count_newlines_avx2(const char *p, off_t n, char c1, char c2, char c3,
+                                 off_t max_count, off_t *p_count)
+{
+    off_t k = 0;
+    __m256i v1 = _mm256_set1_epi8(c1);
+    __m256i v2 = _mm256_set1_epi8(c2);
+    __m256i v3 = _mm256_set1_epi8(c3);
+    __m256i vnl = _mm256_set1_epi8('\n');
+
+    while (k + 32 <= n) {
+        __m256i block = _mm256_loadu_si256((const __m256i *) (p + k));
+        __m256i m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(block, v1),
+                                                    _mm256_cmpeq_epi8(block, v2)),
+                                    _mm256_cmpeq_epi8(block, v3));
+        unsigned int stop = (unsigned int) _mm256_movemask_epi8(m);
+        unsigned int nl = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, vnl));
+        if (nl | stop) {
+            off_t end = count_mask(nl, stop, k, max_count, p_count);
+            if (end >= 0) {
+                return end;
+            }
+        }
+        k += 32;
+    }
+    return k + count_newlines_sse2(p + k, n - k, c1, c2, c3, max_count, p_count);
+}
+
+#endif
+
+
+typedef off_t (*count_func)(const char *p, off_t n, char c1, char c2, char c3,
+                            off_t max_count, off_t *p_count);
+
+static off_t count_newlines_init(const char *p, off_t n, char c1, char c2, char c3,
+                                 off_t max_count, off_t *p_count);
+
+static count_func count_impl = count_newlines_init;
+
+
+static off_t count_newlines_init(const char *p, off_t n, char c1, char c2, char c3,
+                                 off_t max_count, off_t *p_count)
+{
+    count_func impl = count_newlines_c;
+#ifdef HAVE_SIMD_SCAN
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+        impl = count_newlines_avx2;
+    }
+    else if (__builtin_cpu_supports("sse2")) {
+        impl = count_newlines_sse2;
+    }
+#endif
+    STORE_IMPL(count_impl, impl);
+    return impl(p, n, c1, c2, c3, max_count, p_count);
+}
+
+
+off_t count_newlines(const char *p, off_t n, char c1, char c2, char c3,
+                     off_t max_count, off_t *p_count)
+{
+    *p_count = 0;
+    if (max_count == 0) {
+        return 0;
+    }
+    return LOAD_IMPL(count_impl)(p, n, c1, c2, c3, max_count, p_count);
+}
+
+
+
+/*
+ *  off_t count_delimiters(const char *p, off_t n, char delimiter, char c1, char c2,
+ *                         off_t max_count, off_t *p_count)
+ *
+ *  Like count_newlines(), but counts the delimiter bytes, and stops at the
+ *  first byte that is c1, c2, '\n', '\r' or '\xff' (the stop characters of
+ *  scan_for_chars(), with delimiter taken out).
+ *
+ *  The tokenizer uses this to skip over the fields of a row that it doesn't
+ *  want (see tokenize.c).
+ */
+
+static off_t count_delimiters_c(const char *p, off_t n, char delimiter, char c1, char c2,
+                                off_t max_count, off_t *p_count)
+{
+    off_t count = *p_count;
+    off_t k;
+
+    for (k = 0; k < n; ++k) {
+        char c = p[k];
+        if (IS_STOP_CHAR(c, c1, c2, c2)) {
+            break;
+        }
+        if (c == delimiter && ++count == max_count) {
+            ++k;
+            break;
+        }
+    }
+    *p_count = count;
+    return k;
+}
+
+
+#ifdef HAVE_SIMD_SCAN
+
+__attribute__((target("sse2")))
+static off_t count_delimiters_sse2(const char *p, off_t n, char delimiter, char c1, char c2,
+                                   off_t max_count, off_t *p_count)
+{
+    off_t k = 0;
+    __m128i vd = _mm_set1_epi8(delimiter);
+    __m128i v1 = _mm_set1_epi8(c1);
+    __m128i v2 = _mm_set1_epi8(c2);
+    __m128i vnl = _mm_set1_epi8('\n');
+    __m128i vcr = _mm_set1_epi8('\r');
+    __m128i vff = _mm_set1_epi8('\xff');
+
+    while (k + 16 <= n) {
+        __m128i block = _mm_loadu_si128((const __m128i *) (p + k));
+        __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, v1),
+                                              _mm_cmpeq_epi8(block, v2)),
+                                 _mm_or_si128(_mm_cmpeq_epi8(block, vnl),
+                                              _mm_or_si128(_mm_cmpeq_epi8(block, vcr),
+                                                           _mm_cmpeq_epi8(block, vff))));
+        unsigned int stop = (unsigned int) _mm_movemask_epi8(m);
+        unsigned int delim = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(block, vd));
+        if (delim | stop) {
+            off_t end = count_mask(delim, stop, k, max_count, p_count);
+            if (end >= 0) {
+                return end;
+            }
+        }
+        k += 16;
+    }
+    return k + count_delimiters_c(p + k, n - k, delimiter, c1, c2, max_count, p_count);
+}
+
+
+__attribute__((target("avx2,popcnt")))
+static off_t count_delimiters_avx2(const char *p, off_t n, char delimiter, char c1, char c2,
+                                   off_t max_count, off_t *p_count)
+{
+    off_t k = 0;
+    __m256i vd = _mm256_set1_epi8(delimiter);
+    __m256i v1 = _mm256_set1_epi8(c1);
+    __m256i v2 = _mm256_set1_epi8(c2);
+    __m256i vnl = _mm256_set1_epi8('\n');
+    __m256i vcr = _mm256_set1_epi8('\r');
+    __m256i vff = _mm256_set1_epi8('\xff');
+
+    while (k + 32 <= n) {
+        __m256i block = _mm256_loadu_si256((const __m256i *) (p + k));
+        __m256i m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(block, v1),
+                                                    _mm256_cmpeq_epi8(block, v2)),
+                                    _mm256_or_si256(_mm256_cmpeq_epi8(block, vnl),
+                                                    _mm256_or_si256(_mm256_cmpeq_epi8(block, vcr),
+                                                                    _mm256_cmpeq_epi8(block, vff))));
+        unsigned int stop = (unsigned int) _mm256_movemask_epi8(m);
+        unsigned int delim = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, vd));
+        if (delim | stop) {
+            off_t end = count_mask(delim, stop, k, max_count, p_count);
+            if (end >= 0) {
+                return end;
+            }
+        }
+        k += 32;
+    }
+    return k + count_delimiters_sse2(p + k, n - k, delimiter, c1, c2, max_count, p_count);
+}
+
+#endif
+
+
+typedef off_t (*count_delimiters_func)(const char *p, off_t n, char delimiter, char c1, char c2,
+                                       off_t max_count, off_t *p_count);
+
+static off_t count_delimiters_init(const char *p, off_t n, char delimiter, char c1, char c2,
+                                   off_t max_count, off_t *p_count);
+
+static count_delimiters_func count_delimiters_impl = count_delimiters_init;
+
+
+static off_t count_delimiters_init(const char *p, off_t n, char delimiter, char c1, char c2,
+                                   off_t max_count, off_t *p_count)
+{
+    count_delimiters_func impl = count_delimiters_c;
+#ifdef HAVE_SIMD_SCAN
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+        impl = count_delimiters_avx2;
+    }
+    else if (__builtin_cpu_supports("sse2")) {
+        impl = count_delimiters_sse2;
+    }
+#endif
+    STORE_IMPL(count_delimiters_impl, impl);
+    return impl(p, n, delimiter, c1, c2, max_count, p_count);
+}
+
+
+off_t count_delimiters(const char *p, off_t n, char delimiter, char c1, char c2,
+                       off_t max_count, off_t *p_count)
+{
+    *p_count = 0;
+    if (max_count == 0) {
+        return 0;
+    }
+    return LOAD_IMPL(count_delimiters_impl)(p, n, delimiter, c1, c2, max_count, p_count);
+}
+
+/*
+ *  void scan_rows(const char *buf, off_t size,
+ *                 char delimiter, char quote, char comment,
+ *                 off_t begin, off_t end, int state, int max_rows,
+ *                 chunk_scan *result)
+ *
+ *  Find the row boundaries in buf[begin] ... buf[end - 1], starting in the
+ *  given state, where buf holds a file of size bytes.  This follows the
+ *  rules of tokenize(), including its handling of comments and of the last
+ *  byte of the file.  If max_rows is not negative, the scan stops at the
+ *  start of the row after the first max_rows rows.
+ */
+
+void scan_rows(const char *buf, off_t size,
+               char delimiter, char quote, char comment,
+               off_t begin, off_t end, int state, int max_rows,
+               chunk_scan *result)
+{
+    /* tokenize_ws() only recognizes comments at the start of a row. */
+    char field_comment = delimiter ? comment : '\n';
+    off_t pos = begin;
+    off_t num_lines = 0;
+    int num_rows = 0;
+    char c;
+
+    result->first_row = -1;
+
+    while (pos < end && state != SCAN_STOPPED) {
+        int n, k;
+        n = (end - pos > INT_MAX) ? INT_MAX : (int) (end - pos);
+        switch (state) {
+            case SCAN_ROW_START:
+                if (pos + 1 >= size) {
+                    /*
+                     *  next() returns FB_EOF at the last byte of the file,
+                     *  so the tokenizer stops here.
+                     */
+                    end = pos;
+                    break;
+                }
+                if (result->first_row < 0) {
+                    result->first_row = pos;
+                }
+                c = buf[pos];
+                if (c == comment) {
+                    state = SCAN_ROW_COMMENT;
+                    ++pos;
+                }
+                else if (c == '\xff') {
+                    /* The tokenizer sees this as the end of the file. */
+                    state = SCAN_STOPPED;
+                }
+                else if (num_rows == max_rows) {
+                    end = pos;
+                }
+                else {
+                    /* The start of a row.  c is handled in the SCAN_FIELD state. */
+                    ++num_rows;
+                    state = SCAN_FIELD;
+                }
+                break;
+
+            case SCAN_FIELD:
+                k = scan_for_chars(buf + pos, n, quote, field_comment, '\n');
+                pos += k;
+                if (k == n) {
+                    break;
+                }
+                c = buf[pos++];
+                if (c == quote) {
+                    state = SCAN_QUOTED;
+                }
+                else if (c == field_comment && c != '\n') {
+                    state = SCAN_COMMENT;
+                }
+                else if (c == '\n' || c == '\xff') {
+                    num_lines += (c == '\n');
+                    state = SCAN_ROW_START;
+                }
+                break;
+
+            case SCAN_QUOTED:
+                k = scan_for_chars(buf + pos, n, quote, quote, quote);
+                pos += k;
+                if (k == n) {
+                    break;
+                }
+                c = buf[pos++];
+                if (c == quote) {
+                    if (pos + 1 < size && buf[pos] == quote) {
+                        /* Repeated quote characters. */
+                        ++pos;
+                    }
+                    else {
+                        state = SCAN_FIELD;
+                    }
+                }
+                else if (c == '\n') {
+                    ++num_lines;
+                }
+                else if (c == '\xff') {
+                    state = SCAN_ROW_START;
+                }
+                break;
+
+            case SCAN_COMMENT:
+            case SCAN_ROW_COMMENT:
+                /*
+                 *  This follows skipline(), which reads '\r\n' as part of the
+                 *  comment.  skipline() stops at the last byte of the file; in
+                 *  a comment line, the tokenizer then stops there too.
+                 */
+                if (state == SCAN_ROW_COMMENT) {
+                    if (pos + 1 >= size) {
+                        end = pos;
+                        break;
+                    }
+                    if (n > size - 1 - pos) {
+                        n = (int) (size - 1 - pos);
+                    }
+                }
+                k = scan_for_chars(buf + pos, n, '\n', '\n', '\n');
+                pos += k;
+                if (k == n) {
+                    break;
+                }
+                c = buf[pos];
+                if (c == '\n') {
+                    ++pos;
+                    ++num_lines;
+                    state = (state == SCAN_COMMENT) ? SCAN_FIELD : SCAN_ROW_START;
+                }
+                else if (c == '\r') {
+                    if (pos + 1 < size && buf[pos + 1] == '\n') {
+                        pos += 2;
+                        ++num_lines;
+                    }
+                    else {
+                        pos += 1;
+                    }
+                }
+                else {
+                    state = SCAN_STOPPED;
+                }
+                break;
+        }
+    }
+
+    result->num_rows = num_rows;
+    result->end_state = state;
+    result->end_pos = pos;
+    result->num_lines = num_lines;
+}
+
+
+/*
+ *  off_t find_rows(const char *buf, off_t size, off_t pos,
+ *                  char delimiter, char quote, char comment,
+ *                  int max_rows, int *p_num_rows, off_t *p_num_lines)
+ *
+ *  Count the rows of a file of size bytes in buf, starting at the start of
+ *  a row at pos, without tokenizing them.  If max_rows is not negative, at
+ *  most max_rows rows are counted.  The number of rows is put in
+ *  *p_num_rows, and the number of '\n' bytes in them in *p_num_lines.
+ *  Returns the position of the row after the counted rows (size if there
+ *  are no more rows), or -1 if the rows can't be found this way; the
+ *  caller must then use the tokenizer.
+ *
+ *  When there are no quote, comment or '\xff' bytes after pos, the rows
+ *  are the lines, so only the newlines are counted (with count_newlines()).
+ *  Otherwise, the rows are found with scan_rows().
+ *
+ *  XXX Rows delimited by whitespace are not handled: tokenize_ws() has
+ *  other rules for quotes, and the scanner doesn't model them.
+ */
+
+off_t find_rows(const char *buf, off_t size, off_t pos,
+                char delimiter, char quote, char comment,
+                int max_rows, int *p_num_rows, off_t *p_num_lines)
+{
+    chunk_scan scan;
+    off_t count;
+    off_t end;
+    int num_rows;
+
+    if (delimiter == 0) {
+        return -1;
+    }
+
+    end = pos + count_newlines(buf + pos, size - pos, quote, comment, '\xff',
+                               max_rows, &count);
+    if (max_rows >= 0 && count == max_rows) {
+        /* end is just after the last line of the max_rows rows. */
+        num_rows = max_rows;
+        if (max_rows > 0 && end == size && (end - 1 == pos || buf[end - 2] == '\n')) {
+            /* The last line is a blank line at the last byte of the file. */
+            --num_rows;
+            --end;
+        }
+    }
+    else if (end == size) {
+        /*
+         *  A row starts at pos and after each newline, except when it
+         *  would start at the last byte of the file (where the tokenizer
+         *  stops), or at the end.
+         */
+        num_rows = 0;
+        if (size - pos >= 2) {
+            num_rows = (int) (1 + count - (buf[size - 1] == '\n') - (buf[size - 2] == '\n'));
+            if (buf[size - 2] == '\n') {
+                --end;
+            }
+        }
+        else if (size - pos == 1) {
+            --end;
+        }
+    }
+    else {
+        scan_rows(buf, size, delimiter, quote, comment, pos, size, SCAN_ROW_START,
+                  max_rows, &scan);
+        if (scan.end_state == SCAN_STOPPED) {
+            return -1;
+        }
+        num_rows = scan.num_rows;
+        count = scan.num_lines;
+        end = scan.end_pos;
+    }
+
+    *p_num_rows = num_rows;
+    if (p_num_lines != NULL) {
+        *p_num_lines = count;
+    }
+    return end;
+}
@@ -0,0 +1,47 @@
+
+#include <sys/types.h>
+
+int scan_for_chars(const char *p, int n, char c1, char c2, char c3);
+
+off_t count_newlines(const char *p, off_t n, char c1, char c2, char c3,
+                     off_t max_count, off_t *p_count);
+
+off_t count_delimiters(const char *p, off_t n, char delimiter, char c1, char c2,
+                       off_t max_count, off_t *p_count);
+
+
+/* Row scanner states. */
+#define SCAN_ROW_START   0  /* At the start of a row. */
+#define SCAN_FIELD       1  /* In an unquoted field. */
+#define SCAN_QUOTED      2  /* In a quoted field. */
+#define SCAN_COMMENT     3  /* In a comment that started in a row. */
+#define SCAN_ROW_COMMENT 4  /* In a comment line (comment at the start of a row). */
+#define SCAN_STOPPED     5  /* Found something that the scanner doesn't handle. */
+
+
+typedef struct _chunk_scan {
+
+    /* Position of the first row start found in the chunk, or -1. */
+    off_t first_row;
+
+    /* Number of rows that start in the chunk. */
+    int num_rows;
+
+    /* The scanner state at the end of the chunk. */
+    int end_state;
+
+    /* The position at which the scan stopped, and the number of '\n' before it. */
+    off_t end_pos;
+    off_t num_lines;
+
+} chunk_scan;
+
+
+void scan_rows(const char *buf, off_t size,
+               char delimiter, char quote, char comment,
+               off_t begin, off_t end, int state, int max_rows,
+               chunk_scan *result);
+
+off_t find_rows(const char *buf, off_t size, off_t pos,
+                char delimiter, char quote, char comment,
+                int max_rows, int *p_num_rows, off_t *p_num_lines);
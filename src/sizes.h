@@ -1,6 +1,10 @@
 
-// Maximum number of columns in a file.
-#define MAX_NUM_COLUMNS    2000
+// Initial number of fields that a row_buffer holds (see tokenize.h).
+#define INITIAL_NUM_FIELDS 256
 
 // Maximum number of characters in single field.
 #define FIELD_BUFFER_SIZE  2000
+
+// Initial size of the word_buffer of a row_buffer.  (Only the fields that
+// can't be left in the file buffer are copied to it.)
+#define WORD_BUFFER_SIZE   4000
@@ -0,0 +1,20 @@
+
+#include <stdint.h>
+
+/* Error codes of the functions in str_to.c. */
+#define ERROR_OK             0
+#define ERROR_NO_DIGITS      1
+#define ERROR_OVERFLOW       2
+#define ERROR_INVALID_CHARS  3
+#define ERROR_MINUS_SIGN     4
+
+int64_t str_to_int64(const char *p_item, int length, int64_t int_min, int64_t int_max, int *error);
+uint64_t str_to_uint64(const char *p_item, int length, uint64_t uint_max, int *error);
+
+/* The same, with the limits of each type. */
+int8_t str_to_int8(const char *p_item, int length, int *error);
+int16_t str_to_int16(const char *p_item, int length, int *error);
+int32_t str_to_int32(const char *p_item, int length, int *error);
+uint8_t str_to_uint8(const char *p_item, int length, int *error);
+uint16_t str_to_uint16(const char *p_item, int length, int *error);
+uint32_t str_to_uint32(const char *p_item, int length, int *error);
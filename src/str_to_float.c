@@ -0,0 +1,795 @@
+
+/*
+ *  Correctly rounded conversion of decimal strings to double and float.
+ *
+ *  Most strings are handled by one of two fast paths:
+ *
+ *  * Clinger's fast path: when the significand has at most 53 bits (24 for
+ *    float) and the power of ten is exactly representable, the result is a
+ *    single correctly rounded multiplication or division.
+ *  * The Eisel-Lemire algorithm: the first 19 significant digits are
+ *    multiplied by a 128 bit approximation of the power of five (see
+ *    powers_of_five.h), which determines the correctly rounded result in
+ *    all but a tiny fraction of the cases.
+ *
+ *  The remaining cases (halfway cases hidden by truncation of very long
+ *  significands, and the rare products that are too close to call) fall
+ *  back to an exact but slow big decimal conversion (the "simple decimal
+ *  conversion" algorithm, as used by Go's strconv).
+ *
+ *  The syntax accepted is the one of the old xstrtod(): optional leading
+ *  spaces, an optional sign, digits with an optional `decimal` point
+ *  character, and an optional exponent introduced by `sci` (case is
+ *  ignored).  Unlike strtod(), the conversion does not depend on the
+ *  locale, and "inf" and "nan" are not recognized.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <float.h>
+#include <math.h>
+
+#include "powers_of_five.h"
+
+#define IS_DIGIT(c) ((unsigned) ((c) - '0') < 10)
+
+// Maximum number of significant digits that fit in a uint64_t.
+#define MAX_FAST_DIGITS 19
+
+// Number of digits held by the slow path.  Beyond that, only whether the
+// dropped digits are nonzero matters.
+#define MAX_DECIMAL_DIGITS 800
+
+// Largest shift that can be done on a big decimal at once.
+#define MAX_SHIFT 60
+
+// Exponents beyond this are clamped; the result is 0 or inf anyway.
+#define MAX_EXPONENT 100000
+
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+#define HAVE_CLINGER_FAST_PATH 1
+#endif
+
+
+typedef struct _binary_format {
+    int mantissa_bits;           // Explicitly stored mantissa bits.
+    int minimum_exponent;        // Minus the exponent bias.
+    int infinite_power;          // Biased exponent of inf.
+    int smallest_power_of_ten;   // Below this, the value is 0.
+    int largest_power_of_ten;    // Above this, the value is inf.
+    int min_round_to_even;       // Range of powers of ten in which an
+    int max_round_to_even;       // exact halfway case is possible.
+} binary_format;
+
+static const binary_format binary64 = {52, -1023, 0x7FF, -342, 308, -4, 23};
+static const binary_format binary32 = {23, -127, 0xFF, -65, 38, -17, 10};
+
+static const double exact_double_powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static const float exact_float_powers_of_ten[] = {
+    1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f
+};
+
+
+/*
+ *  The significand and exponent of a decimal string, as found by
+ *  parse_number().
+ */
+
+typedef struct _parsed_number {
+    int negative;
+    uint64_t mantissa;        // The first (up to) 19 significant digits...
+    int64_t exponent;         // ...times 10**exponent.
+    int truncated;            // Digits were dropped from mantissa.
+    const char *digits;       // First digit of the significand.
+    int64_t exp_number;       // The number following `sci`.
+} parsed_number;
+
+
+/*
+ *  int parse_number(const char *str, const char *str_end, const char **endptr,
+ *                   char decimal, char sci, parsed_number *num)
+ *
+ *  Parse the decimal string from str to str_end.  Returns 0 if there are
+ *  no digits.  On return, *endptr points to the first character after the
+ *  number.
+ */
+
+static int parse_number(const char *str, const char *str_end, const char **endptr,
+                        char decimal, char sci, parsed_number *num)
+{
+    const char *p = str;
+    const char *int_end;
+    int64_t num_digits;
+    int64_t num_decimals = 0;
+    uint64_t w = 0;
+
+    // Skip leading whitespace.
+    while (p < str_end && isspace(*p)) {
+        ++p;
+    }
+
+    num->negative = 0;
+    if (p < str_end && *p == '-') {
+        num->negative = 1;
+        ++p;
+    }
+    else if (p < str_end && *p == '+') {
+        ++p;
+    }
+
+    num->digits = p;
+    while (p < str_end && IS_DIGIT(*p)) {
+        w = 10 * w + (*p - '0');
+        ++p;
+    }
+    int_end = p;
+    num_digits = p - num->digits;
+
+    if (p < str_end && *p == decimal) {
+        const char *frac = ++p;
+        while (p < str_end && IS_DIGIT(*p)) {
+            w = 10 * w + (*p - '0');
+            ++p;
+        }
+        num_decimals = p - frac;
+        num_digits += num_decimals;
+    }
+
+    if (num_digits == 0) {
+        return 0;
+    }
+
+    num->exp_number = 0;
+    if (p < str_end && toupper(*p) == toupper(sci)) {
+        int exp_negative = 0;
+        int64_t n = 0;
+
+        ++p;
+        if (p < str_end && *p == '-') {
+            exp_negative = 1;
+            ++p;
+        }
+        else if (p < str_end && *p == '+') {
+            ++p;
+        }
+        while (p < str_end && IS_DIGIT(*p)) {
+            if (n < MAX_EXPONENT) {
+                n = 10 * n + (*p - '0');
+            }
+            ++p;
+        }
+        num->exp_number = exp_negative ? -n : n;
+    }
+    *endptr = p;
+
+    num->mantissa = w;
+    num->exponent = num->exp_number - num_decimals;
+    num->truncated = 0;
+
+    if (num_digits > MAX_FAST_DIGITS) {
+        // w may have overflowed.  Leading zeros are not significant, so
+        // count again starting from the first nonzero digit, and keep only
+        // the first MAX_FAST_DIGITS significant digits.
+        const char *s = num->digits;
+        int n = 0;
+
+        w = 0;
+        num->exponent = num->exp_number;
+        while (s < int_end && *s == '0') {
+            ++s;
+        }
+        if (s == int_end && s < str_end && *s == decimal) {
+            ++s;
+            while (s < str_end && *s == '0') {
+                --num->exponent;
+                ++s;
+            }
+        }
+        if (s < int_end) {
+            // Significant digits start in the integer part.
+            while (s < int_end) {
+                if (n < MAX_FAST_DIGITS) {
+                    w = 10 * w + (*s - '0');
+                    ++n;
+                }
+                else {
+                    ++num->exponent;
+                    num->truncated = 1;
+                }
+                ++s;
+            }
+            if (s < str_end && *s == decimal) {
+                ++s;
+            }
+        }
+        while (s < str_end && IS_DIGIT(*s)) {
+            if (n < MAX_FAST_DIGITS) {
+                w = 10 * w + (*s - '0');
+                --num->exponent;
+                ++n;
+            }
+            else {
+                num->truncated = 1;
+            }
+            ++s;
+        }
+        num->mantissa = w;
+    }
+    return 1;
+}
+
+
+/*
+ *  128 bit product of two 64 bit integers.
+ */
+
+static void full_multiplication(uint64_t a, uint64_t b, uint64_t *p_high, uint64_t *p_low)
+{
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 r = (unsigned __int128) a * b;
+    *p_high = (uint64_t) (r >> 64);
+    *p_low = (uint64_t) r;
+#else
+    uint64_t a_lo = (uint32_t) a, a_hi = a >> 32;
+    uint64_t b_lo = (uint32_t) b, b_hi = b >> 32;
+    uint64_t p0 = a_lo * b_lo;
+    uint64_t p1 = a_lo * b_hi;
+    uint64_t p2 = a_hi * b_lo;
+    uint64_t p3 = a_hi * b_hi;
+    uint64_t mid = (p0 >> 32) + (uint32_t) p1 + (uint32_t) p2;
+    *p_low = (mid << 32) | (uint32_t) p0;
+    *p_high = p3 + (p1 >> 32) + (p2 >> 32) + (mid >> 32);
+#endif
+}
+
+
+static int leading_zeros(uint64_t x)
+{
+#if defined(__GNUC__)
+    return __builtin_clzll(x);
+#else
+    int n = 0;
+    while (!(x & 0x8000000000000000ULL)) {
+        x <<= 1;
+        ++n;
+    }
+    return n;
+#endif
+}
+
+
+/*
+ *  int eisel_lemire(int64_t q, uint64_t w, const binary_format *fmt,
+ *                   uint64_t *p_mantissa, int *p_power2)
+ *
+ *  Compute the binary floating point number closest to w * 10**q, with
+ *  w != 0.  On success, the stored mantissa bits and the biased exponent
+ *  are returned in *p_mantissa and *p_power2.  Returns 0 if the result
+ *  cannot be decided from the 128 bit approximation.
+ */
+
+static int eisel_lemire(int64_t q, uint64_t w, const binary_format *fmt,
+                        uint64_t *p_mantissa, int *p_power2)
+{
+    uint64_t high, low;
+    uint64_t precision_mask;
+    uint64_t mantissa;
+    int index, lz, upperbit, shift, power2;
+
+    if (q < fmt->smallest_power_of_ten) {
+        *p_mantissa = 0;
+        *p_power2 = 0;
+        return 1;
+    }
+    if (q > fmt->largest_power_of_ten) {
+        *p_mantissa = 0;
+        *p_power2 = fmt->infinite_power;
+        return 1;
+    }
+
+    lz = leading_zeros(w);
+    w <<= lz;
+
+    // We only need mantissa_bits + 3 bits of the product to be right; the
+    // second multiplication is needed only if the truncated bits of the
+    // first could carry into them.
+    index = 2 * (int) (q - SMALLEST_POWER_OF_FIVE);
+    full_multiplication(w, power_of_five_128[index], &high, &low);
+    precision_mask = 0xFFFFFFFFFFFFFFFFULL >> (fmt->mantissa_bits + 3);
+    if ((high & precision_mask) == precision_mask) {
+        uint64_t high2, low2;
+        full_multiplication(w, power_of_five_128[index + 1], &high2, &low2);
+        low += high2;
+        if (high2 > low) {
+            ++high;
+        }
+    }
+    if (low == 0xFFFFFFFFFFFFFFFFULL && (q < -27 || q > 55)) {
+        // The product could be slightly too small.
+        return 0;
+    }
+
+    upperbit = (int) (high >> 63);
+    shift = upperbit + 64 - fmt->mantissa_bits - 3;
+    mantissa = high >> shift;
+    // floor(log2(10**q)) = floor(q * log2(10)) = ((217706 * q) >> 16)
+    power2 = (int) (((217706 * q) >> 16) + 63 + upperbit - lz - fmt->minimum_exponent);
+
+    if (power2 <= 0) {
+        // Subnormal.
+        if (-power2 + 1 >= 64) {
+            *p_mantissa = 0;
+            *p_power2 = 0;
+            return 1;
+        }
+        mantissa >>= -power2 + 1;
+        mantissa += (mantissa & 1);
+        mantissa >>= 1;
+        *p_mantissa = mantissa;
+        *p_power2 = (mantissa < ((uint64_t) 1 << fmt->mantissa_bits)) ? 0 : 1;
+        return 1;
+    }
+
+    // Round to nearest, ties to even.  An exact tie is only possible for
+    // small q, when the product is exact.
+    if (low <= 1 && q >= fmt->min_round_to_even && q <= fmt->max_round_to_even &&
+            (mantissa & 3) == 1 && (mantissa << shift) == high) {
+        mantissa &= ~(uint64_t) 1;
+    }
+    mantissa += (mantissa & 1);
+    mantissa >>= 1;
+    if (mantissa >= ((uint64_t) 2 << fmt->mantissa_bits)) {
+        mantissa = (uint64_t) 1 << fmt->mantissa_bits;
+        ++power2;
+    }
+    mantissa &= ~((uint64_t) 1 << fmt->mantissa_bits);
+    if (power2 >= fmt->infinite_power) {
+        mantissa = 0;
+        power2 = fmt->infinite_power;
+    }
+    *p_mantissa = mantissa;
+    *p_power2 = power2;
+    return 1;
+}
+
+
+/*
+ *  Arbitrary precision decimal for the slow path.  The value is
+ *  0.d[0]d[1]...d[nd-1] * 10**dp, with the digits stored as numbers 0-9.
+ */
+
+typedef struct _big_decimal {
+    int nd;
+    int dp;
+    int truncated;
+    unsigned char d[MAX_DECIMAL_DIGITS];
+} big_decimal;
+
+
+static void big_decimal_set(big_decimal *a, const char *p, const char *p_end,
+                            char decimal, int64_t exp_number)
+{
+    int saw_decimal = 0;
+
+    a->nd = 0;
+    a->dp = 0;
+    a->truncated = 0;
+    for (; p < p_end; ++p) {
+        if (*p == decimal && !saw_decimal) {
+            saw_decimal = 1;
+            a->dp = a->nd;
+        }
+        else if (IS_DIGIT(*p)) {
+            if (*p == '0' && a->nd == 0) {
+                // Leading zero.
+                --a->dp;
+            }
+            else if (a->nd < MAX_DECIMAL_DIGITS) {
+                a->d[a->nd++] = *p - '0';
+            }
+            else if (*p != '0') {
+                a->truncated = 1;
+            }
+        }
+        else {
+            break;
+        }
+    }
+    if (!saw_decimal) {
+        a->dp = a->nd;
+    }
+    a->dp += (int) exp_number;
+}
+
+
+static void big_decimal_trim(big_decimal *a)
+{
+    while (a->nd > 0 && a->d[a->nd - 1] == 0) {
+        --a->nd;
+    }
+    if (a->nd == 0) {
+        a->dp = 0;
+    }
+}
+
+
+static void big_decimal_right_shift(big_decimal *a, int k)
+{
+    int r = 0, w = 0;
+    uint64_t n = 0;
+    uint64_t mask = ((uint64_t) 1 << k) - 1;
+
+    // Pick up enough leading digits to cover the first shift.
+    for (; (n >> k) == 0; ++r) {
+        if (r >= a->nd) {
+            if (n == 0) {
+                a->nd = 0;
+                return;
+            }
+            while ((n >> k) == 0) {
+                n *= 10;
+                ++r;
+            }
+            break;
+        }
+        n = 10 * n + a->d[r];
+    }
+    a->dp -= r - 1;
+
+    // Pick up a digit, put down a digit.
+    for (; r < a->nd; ++r) {
+        uint64_t c = a->d[r];
+        a->d[w++] = (unsigned char) (n >> k);
+        n &= mask;
+        n = 10 * n + c;
+    }
+
+    // Put down extra digits.
+    while (n > 0) {
+        uint64_t dig = n >> k;
+        n &= mask;
+        if (w < MAX_DECIMAL_DIGITS) {
+            a->d[w++] = (unsigned char) dig;
+        }
+        else if (dig > 0) {
+            a->truncated = 1;
+        }
+        n *= 10;
+    }
+    a->nd = w;
+    big_decimal_trim(a);
+}
+
+
+static void big_decimal_left_shift(big_decimal *a, int k)
+{
+    // Each digit times 2**k plus the carry is less than 10 * 2**60, and the
+    // shift adds at most 19 digits.
+    unsigned char tmp[MAX_DECIMAL_DIGITS + 20];
+    int w = MAX_DECIMAL_DIGITS + 20;
+    int r, nd;
+    uint64_t n = 0;
+
+    for (r = a->nd - 1; r >= 0; --r) {
+        n += (uint64_t) a->d[r] << k;
+        tmp[--w] = (unsigned char) (n % 10);
+        n /= 10;
+    }
+    while (n > 0) {
+        tmp[--w] = (unsigned char) (n % 10);
+        n /= 10;
+    }
+    nd = MAX_DECIMAL_DIGITS + 20 - w;
+    a->dp += nd - a->nd;
+    if (nd > MAX_DECIMAL_DIGITS) {
+        for (r = w + MAX_DECIMAL_DIGITS; r < w + nd; ++r) {
+            if (tmp[r] != 0) {
+                a->truncated = 1;
+            }
+        }
+        nd = MAX_DECIMAL_DIGITS;
+    }
+    memcpy(a->d, tmp + w, nd);
+    a->nd = nd;
+    big_decimal_trim(a);
+}
+
+
+static void big_decimal_shift(big_decimal *a, int k)
+{
+    if (a->nd == 0) {
+        return;
+    }
+    if (k > 0) {
+        while (k > MAX_SHIFT) {
+            big_decimal_left_shift(a, MAX_SHIFT);
+            k -= MAX_SHIFT;
+        }
+        big_decimal_left_shift(a, k);
+    }
+    else if (k < 0) {
+        while (k < -MAX_SHIFT) {
+            big_decimal_right_shift(a, MAX_SHIFT);
+            k += MAX_SHIFT;
+        }
+        big_decimal_right_shift(a, -k);
+    }
+}
+
+
+/*
+ *  The integer part of a, rounded to nearest, ties to even.
+ */
+
+static uint64_t big_decimal_rounded_integer(big_decimal *a)
+{
+    uint64_t n = 0;
+    int i, round_up;
+
+    if (a->dp > 20) {
+        return 0xFFFFFFFFFFFFFFFFULL;
+    }
+    for (i = 0; i < a->dp && i < a->nd; ++i) {
+        n = 10 * n + a->d[i];
+    }
+    for (; i < a->dp; ++i) {
+        n *= 10;
+    }
+    if (a->dp < 0 || a->dp >= a->nd) {
+        round_up = 0;
+    }
+    else if (a->d[a->dp] == 5 && a->dp + 1 == a->nd) {
+        // Exactly halfway, unless digits were dropped.
+        round_up = a->truncated || (a->dp > 0 && (a->d[a->dp - 1] & 1));
+    }
+    else {
+        round_up = a->d[a->dp] >= 5;
+    }
+    return n + round_up;
+}
+
+
+/*
+ *  Convert a to the binary format fmt by repeated shifts.  Returns the
+ *  stored mantissa bits and biased exponent, as eisel_lemire() does.
+ */
+
+static void big_decimal_to_binary(big_decimal *a, const binary_format *fmt,
+                                  uint64_t *p_mantissa, int *p_power2)
+{
+    static const int powtab[] = {1, 3, 6, 9, 13, 16, 19, 23, 26};
+    int num_powtab = sizeof(powtab) / sizeof(powtab[0]);
+    int bias = fmt->minimum_exponent;
+    int exp2 = 0;
+    uint64_t mantissa;
+
+    big_decimal_trim(a);
+    if (a->nd == 0 || a->dp < -330) {
+        *p_mantissa = 0;
+        *p_power2 = 0;
+        return;
+    }
+    if (a->dp > 310) {
+        goto overflow;
+    }
+
+    // Scale by powers of two until in range [0.5, 1).
+    while (a->dp > 0) {
+        int n = (a->dp >= num_powtab) ? 27 : powtab[a->dp];
+        big_decimal_shift(a, -n);
+        exp2 += n;
+    }
+    while (a->dp < 0 || (a->dp == 0 && a->d[0] < 5)) {
+        int n = (-a->dp >= num_powtab) ? 27 : powtab[-a->dp];
+        big_decimal_shift(a, n);
+        exp2 -= n;
+    }
+
+    // [0.5, 1) -> [1, 2).
+    --exp2;
+
+    if (exp2 < bias + 1) {
+        // Subnormal.
+        int n = bias + 1 - exp2;
+        big_decimal_shift(a, -n);
+        exp2 += n;
+    }
+    if (exp2 - bias >= fmt->infinite_power) {
+        goto overflow;
+    }
+
+    big_decimal_shift(a, 1 + fmt->mantissa_bits);
+    mantissa = big_decimal_rounded_integer(a);
+
+    // Rounding might have added a bit.
+    if (mantissa == ((uint64_t) 2 << fmt->mantissa_bits)) {
+        mantissa >>= 1;
+        ++exp2;
+        if (exp2 - bias >= fmt->infinite_power) {
+            goto overflow;
+        }
+    }
+    if (!(mantissa & ((uint64_t) 1 << fmt->mantissa_bits))) {
+        // Denormalized.
+        exp2 = bias;
+    }
+    *p_mantissa = mantissa & (((uint64_t) 1 << fmt->mantissa_bits) - 1);
+    *p_power2 = exp2 - bias;
+    return;
+
+overflow:
+    *p_mantissa = 0;
+    *p_power2 = fmt->infinite_power;
+}
+
+
+/*
+ *  Compute the stored mantissa bits and biased exponent of the number
+ *  parsed into num.
+ */
+
+static void to_binary(parsed_number *num, const char *str_end, char decimal,
+                      const binary_format *fmt, uint64_t *p_mantissa, int *p_power2)
+{
+    big_decimal a;
+
+    if (num->mantissa == 0) {
+        *p_mantissa = 0;
+        *p_power2 = 0;
+        return;
+    }
+    if (eisel_lemire(num->exponent, num->mantissa, fmt, p_mantissa, p_power2)) {
+        uint64_t m;
+        int e;
+
+        // If digits were dropped, the value lies between mantissa and
+        // mantissa + 1; the result is good if both round the same way.
+        if (!num->truncated ||
+                (eisel_lemire(num->exponent, num->mantissa + 1, fmt, &m, &e) &&
+                 m == *p_mantissa && e == *p_power2)) {
+            return;
+        }
+    }
+    big_decimal_set(&a, num->digits, str_end, decimal, num->exp_number);
+    big_decimal_to_binary(&a, fmt, p_mantissa, p_power2);
+}
+
+
+/*
+ *  double str_to_double(const char *str, int length, char **endptr,
+ *                       char decimal, char sci, int skip_trailing)
+ *
+ *  Convert the initial part of the length bytes at str (which need not be
+ *  nul-terminated) to the nearest double.  `decimal` is
+ *  the decimal point character and `sci` the exponent character (case is
+ *  ignored).  If skip_trailing is true, spaces after the number are
+ *  skipped.  *endptr (if endptr is not NULL) is set to the first character
+ *  not used.
+ *
+ *  If there are no digits, 0.0 is returned, *endptr is set to str and
+ *  errno is set to ERANGE.  On overflow, +/-HUGE_VAL is returned and errno
+ *  is set to ERANGE.  Underflow returns 0.0 or a subnormal number.
+ */
+
+double str_to_double(const char *str, int length, char **endptr,
+                     char decimal, char sci, int skip_trailing)
+{
+    const char *str_end = str + length;
+    parsed_number num;
+    const char *p;
+    uint64_t mantissa, bits;
+    int power2;
+    double value;
+
+    if (!parse_number(str, str_end, &p, decimal, sci, &num)) {
+        if (endptr) {
+            *endptr = (char *) str;
+        }
+        errno = ERANGE;
+        return 0.0;
+    }
+    if (skip_trailing) {
+        while (p < str_end && isspace(*p)) {
+            ++p;
+        }
+    }
+    if (endptr) {
+        *endptr = (char *) p;
+    }
+
+#ifdef HAVE_CLINGER_FAST_PATH
+    if (!num.truncated && num.mantissa <= ((uint64_t) 1 << 53) &&
+            num.exponent >= -22 && num.exponent <= 22) {
+        value = (double) num.mantissa;
+        if (num.exponent < 0) {
+            value /= exact_double_powers_of_ten[-num.exponent];
+        }
+        else {
+            value *= exact_double_powers_of_ten[num.exponent];
+        }
+        return num.negative ? -value : value;
+    }
+#endif
+
+    to_binary(&num, str_end, decimal, &binary64, &mantissa, &power2);
+    if (power2 == binary64.infinite_power) {
+        errno = ERANGE;
+        return num.negative ? -HUGE_VAL : HUGE_VAL;
+    }
+    bits = mantissa | ((uint64_t) power2 << binary64.mantissa_bits);
+    if (num.negative) {
+        bits |= (uint64_t) 1 << 63;
+    }
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+
+/*
+ *  float str_to_float(const char *str, int length, char **endptr,
+ *                     char decimal, char sci, int skip_trailing)
+ *
+ *  Like str_to_double(), but rounds directly to the nearest float.  (Doing
+ *  str_to_double() followed by a cast rounds twice, which is occasionally
+ *  off by one unit in the last place.)
+ */
+
+float str_to_float(const char *str, int length, char **endptr,
+                   char decimal, char sci, int skip_trailing)
+{
+    const char *str_end = str + length;
+    parsed_number num;
+    const char *p;
+    uint64_t mantissa;
+    uint32_t bits;
+    int power2;
+    float value;
+
+    if (!parse_number(str, str_end, &p, decimal, sci, &num)) {
+        if (endptr) {
+            *endptr = (char *) str;
+        }
+        errno = ERANGE;
+        return 0.0f;
+    }
+    if (skip_trailing) {
+        while (p < str_end && isspace(*p)) {
+            ++p;
+        }
+    }
+    if (endptr) {
+        *endptr = (char *) p;
+    }
+
+#ifdef HAVE_CLINGER_FAST_PATH
+    if (!num.truncated && num.mantissa <= ((uint64_t) 1 << 24) &&
+            num.exponent >= -10 && num.exponent <= 10) {
+        value = (float) num.mantissa;
+        if (num.exponent < 0) {
+            value /= exact_float_powers_of_ten[-num.exponent];
+        }
+        else {
+            value *= exact_float_powers_of_ten[num.exponent];
+        }
+        return num.negative ? -value : value;
+    }
+#endif
+
+    to_binary(&num, str_end, decimal, &binary32, &mantissa, &power2);
+    if (power2 == binary32.infinite_power) {
+        errno = ERANGE;
+        return num.negative ? -HUGE_VALF : HUGE_VALF;
+    }
+    bits = (uint32_t) mantissa | ((uint32_t) power2 << binary32.mantissa_bits);
+    if (num.negative) {
+        bits |= (uint32_t) 1 << 31;
+    }
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
@@ -111,6 +111,211 @@ int test2()
     return fail;
 }
 
+/*
+ *  Test next_span() and skipbytes(), mixed with fetch().
+ */
+
+int test3()
+{
+    FILE *f;
+    char *pattern = "0123456789";
+    void *fb;
+    char *span;
+    int n;
+    int count;
+    int c;
+    int k;
+    int fail = 0;
+
+    /* Create a test file. */
+    f = fopen("tmp.dat", "wb");
+    for (k = 0; k < 5; ++k) {
+        fputs(pattern, f);
+    }
+    fclose(f);
+
+    f = fopen("tmp.dat", "rb");
+    fb = new_file_buffer(f, 15);
+    count = 0;
+    while (!fail && (n = next_span(fb, &span)) > 0) {
+        for (k = 0; k < n; ++k) {
+            if (span[k] != pattern[(count + k) % 10]) {
+                printf("test3: error: count=%d, k=%d, span[k]='%c'\n", count, k, span[k]);
+                fail = 1;
+                break;
+            }
+        }
+        /* Skip half of the span, and fetch the next character. */
+        skipbytes(fb, n / 2);
+        count += n / 2;
+        c = fetch(fb);
+        if (c != pattern[count % 10]) {
+            printf("test3: error: count=%d, c='%c'\n", count, c);
+            fail = 1;
+        }
+        ++count;
+    }
+    if (!fail && count != 50) {
+        printf("test3: error: read %d characters instead of 50\n", count);
+        fail = 1;
+    }
+    del_file_buffer(fb, RESTORE_INITIAL);
+    fclose(f);
+    if (!fail) {
+        printf("test3 passed.\n");
+    }
+    unlink("tmp.dat");
+    return fail;
+}
+
+/*
+ *  Test reading from a position other than 0, with a buffer much smaller
+ *  than the file, and "\r\n" at many positions relative to the edges
+ *  of the buffer.
+ */
+
+int test4()
+{
+    FILE *f;
+    char *expected;
+    void *fb;
+    char *span;
+    int size, count;
+    int skip;
+    int n;
+    int c;
+    int k;
+    int fail = 0;
+
+    /*
+     *  Lines ending with "\r\n".  In the first 64K, each "\r\n" is split
+     *  by a 4K boundary; then the lines have varying lengths.
+     */
+    f = fopen("tmp.dat", "wb");
+    size = 0;
+    for (k = 0; k < 16; ++k) {
+        for (n = (k == 0) ? 4095 : 4094; n > 0; --n) {
+            fputc('a' + k, f);
+        }
+        fputs("\r\n", f);
+        size += (k == 0) ? 4097 : 4096;
+    }
+    for (k = 1; size < 100000; ++k) {
+        for (n = 0; n < k % 97; ++n) {
+            fputc('a' + n % 26, f);
+        }
+        fputs("\r\n", f);
+        size += k % 97 + 2;
+    }
+    fclose(f);
+
+    /* The expected characters, with "\r\n" read as '\n'. */
+    expected = malloc(size);
+    f = fopen("tmp.dat", "rb");
+    count = 0;
+    while ((c = fgetc(f)) != EOF) {
+        if (c != '\r') {
+            expected[count++] = c;
+        }
+    }
+
+    /* Start after the first skip characters (not counting '\r'). */
+    for (skip = 1000; !fail && skip < 1100; ++skip) {
+        fseek(f, 0, SEEK_SET);
+        for (k = 0; k < skip; ) {
+            if (fgetc(f) != '\r') {
+                ++k;
+            }
+        }
+        fb = new_file_buffer(f, 5000);
+        while (!fail && k < count) {
+            /* Alternate between spans and single characters. */
+            if (k % 3 == 0 && (n = next_span(fb, &span)) > 0) {
+                while (n > 0 && *span != '\r' && *span != '\n') {
+                    if (*span != expected[k]) {
+                        printf("test4: error: skip=%d, k=%d, *span='%c'\n", skip, k, *span);
+                        fail = 1;
+                        break;
+                    }
+                    skipbytes(fb, 1);
+                    ++span;
+                    --n;
+                    ++k;
+                }
+            }
+            if (k < count) {
+                c = fetch(fb);
+                if (c != expected[k]) {
+                    printf("test4: error: skip=%d, k=%d, c=%d\n", skip, k, c);
+                    fail = 1;
+                }
+                ++k;
+            }
+        }
+        if (!fail && fetch(fb) != FB_EOF) {
+            printf("test4: error: no FB_EOF at the end of the file\n");
+            fail = 1;
+        }
+        del_file_buffer(fb, RESTORE_NOT);
+    }
+    fclose(f);
+    free(expected);
+    if (!fail) {
+        printf("test4 passed.\n");
+    }
+    unlink("tmp.dat");
+    return fail;
+}
+
+
+int test5()
+{
+    FILE *f;
+    void *fb;
+    char *span;
+    int start, k, n;
+    int fail = 0;
+
+    /* The position is counted in the file, including the '\r' of "\r\n". */
+    f = fopen("tmp.dat", "wb");
+    for (k = 0; k < 1000; ++k) {
+        fputs("abc\r\n", f);
+    }
+    fclose(f);
+
+    f = fopen("tmp.dat", "rb");
+    for (start = 0; !fail && start < 12; ++start) {
+        fseek(f, start, SEEK_SET);
+        fb = new_file_buffer(f, 7);
+        if (buffer_position(fb) != start) {
+            printf("test5: error: start=%d, position=%ld\n", start, (long) buffer_position(fb));
+            fail = 1;
+        }
+        for (k = start; !fail && k < 5000; ) {
+            if (k % 5 < 3 && (n = next_span(fb, &span)) > 0) {
+                skipbytes(fb, 1);
+                k += 1;
+            }
+            else {
+                /* "\r\n" is fetched as a single '\n'. */
+                k += (fetch(fb) == '\n' && k % 5 == 3) ? 2 : 1;
+            }
+            if (buffer_position(fb) != k) {
+                printf("test5: error: start=%d, k=%d, position=%ld\n", start, k,
+                       (long) buffer_position(fb));
+                fail = 1;
+            }
+        }
+        del_file_buffer(fb, RESTORE_NOT);
+    }
+    fclose(f);
+    if (!fail) {
+        printf("test5 passed.\n");
+    }
+    unlink("tmp.dat");
+    return fail;
+}
+
 
 int main(int argc, char *argvp[])
 {
@@ -118,5 +323,8 @@ int main(int argc, char *argvp[])
 
     fail = test1();
     fail |= test2();
+    fail |= test3();
+    fail |= test4();
+    fail |= test5();
     return fail;
 }
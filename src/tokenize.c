@@ -1,12 +1,15 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 
 #include "file_buffer.h"
 #include "sizes.h"
 #include "constants.h"
 #include "tokenize.h"
 #include "error_types.h"
+#include "scan.h"
 
 
 /* Tokenization state machine states. */
@@ -15,38 +18,351 @@
 #define TOKENIZE_WHITESPACE 3
 
 
+/*
+ *  The field that is being tokenized.  As long as its bytes are the same
+ *  as the bytes in the file (no quote chars removed, no doubled quotes,
+ *  no '\r\n' translated), and the file buffer memory is stable, the field
+ *  is left in place in the file buffer (in_place is TRUE).  Otherwise it
+ *  is built in the word_buffer of the row_buffer.  A field that is not
+ *  wanted by the projection of the row_buffer (skip is TRUE) is not
+ *  stored at all.
+ */
+
+typedef struct _word_state {
+    row_buffer *rb;
+    int num_words;        /* Number of fields of the row ended so far. */
+    char *p_end;          /* Next unused byte in word_buffer. */
+    char *buffer_end;     /* End of word_buffer. */
+    int stable;           /* Result of spans_are_stable(). */
+    char *wanted;         /* Copy of rb->wanted. */
+    int num_wanted;       /* Copy of rb->num_wanted. */
+    int skip;             /* The field is not wanted. */
+    int in_place;
+    char *start;
+    int length;
+} word_state;
+
+
+/*
+ *  int init_row_buffer(row_buffer *rb)
+ *
+ *  Allocate the initial memory of rb.  Returns 0, or ERROR_OUT_OF_MEMORY.
+ */
+
+int init_row_buffer(row_buffer *rb)
+{
+    rb->max_fields = INITIAL_NUM_FIELDS;
+    rb->word_buffer_size = WORD_BUFFER_SIZE;
+    rb->num_allocations = 0;
+    rb->words = (field_span *) malloc(rb->max_fields * sizeof(field_span));
+    rb->word_buffer = (char *) malloc(rb->word_buffer_size);
+    rb->wanted = NULL;
+    rb->num_wanted = 0;
+    if (rb->words == NULL || rb->word_buffer == NULL) {
+        free_row_buffer(rb);
+        return ERROR_OUT_OF_MEMORY;
+    }
+    return 0;
+}
+
+
+void free_row_buffer(row_buffer *rb)
+{
+    free(rb->words);
+    free(rb->word_buffer);
+    free(rb->wanted);
+    rb->words = NULL;
+    rb->word_buffer = NULL;
+    rb->wanted = NULL;
+}
+
+
+/*
+ *  int set_projection(row_buffer *rb, int *columns, int num_columns,
+ *                     int num_fields)
+ *
+ *  Make tokenize() store only the fields whose indices are in columns
+ *  (which must not be negative).  With num_columns == 0, no field is
+ *  stored, which is what a caller that only counts rows wants.
+ *
+ *  num_fields is the number of fields in a row, or -1 if it is not known.
+ *  If columns has all of them, there is no projection; it would only
+ *  cost time.
+ *
+ *  Returns 0, or ERROR_OUT_OF_MEMORY; in that case rb is left without a
+ *  projection, which makes tokenize() slower but doesn't change its
+ *  result.  So a caller may ignore the error.
+ */
+
+int set_projection(row_buffer *rb, int *columns, int num_columns, int num_fields)
+{
+    int num_wanted = 0;
+    int num_distinct = 0;
+    int j;
+
+    for (j = 0; j < num_columns; ++j) {
+        if (columns[j] >= num_wanted) {
+            num_wanted = columns[j] + 1;
+        }
+    }
+    free(rb->wanted);
+    /* Never NULL, even when no field is wanted. */
+    rb->wanted = (char *) calloc(num_wanted > 0 ? num_wanted : 1, 1);
+    if (rb->wanted == NULL) {
+        return ERROR_OUT_OF_MEMORY;
+    }
+    for (j = 0; j < num_columns; ++j) {
+        if (!rb->wanted[columns[j]]) {
+            rb->wanted[columns[j]] = TRUE;
+            ++num_distinct;
+        }
+    }
+    rb->num_wanted = num_wanted;
+    if (num_distinct == num_fields) {
+        clear_projection(rb);
+    }
+    return 0;
+}
+
+
+void clear_projection(row_buffer *rb)
+{
+    free(rb->wanted);
+    rb->wanted = NULL;
+    rb->num_wanted = 0;
+}
+
+
+/*
+ *  Grow rb->words (doubling its size) until it can hold n fields.
+ *  Returns FALSE if the memory can't be allocated.
+ */
+
+static int grow_fields(row_buffer *rb, int n)
+{
+    field_span *new_words;
+    size_t new_max = rb->max_fields;
+
+    do {
+        if (new_max > INT_MAX / 2) {
+            return FALSE;
+        }
+        new_max *= 2;
+    } while (new_max < (size_t) n);
+
+    new_words = (field_span *) realloc(rb->words, new_max * sizeof(field_span));
+    if (new_words == NULL) {
+        return FALSE;
+    }
+    rb->words = new_words;
+    rb->max_fields = (int) new_max;
+    ++(rb->num_allocations);
+    return TRUE;
+}
+
+
+/*
+ *  Returns the number of fields from field k (which is not wanted) to the
+ *  next wanted field, or -1 if there is none.
+ */
+
+static int fields_to_skip(row_buffer *rb, int k)
+{
+    int j = k;
+
+    while (j < rb->num_wanted && !rb->wanted[j]) {
+        ++j;
+    }
+    return j < rb->num_wanted ? j - k : -1;
+}
+
+
+/*
+ *  Grow word_buffer (doubling its size until n more bytes fit), and move
+ *  the fields that are in it.  Returns FALSE if the memory can't be
+ *  allocated.
+ */
+
+static int grow_word_buffer(word_state *w, int n)
+{
+    row_buffer *rb = w->rb;
+    char *old_buffer = rb->word_buffer;
+    char *new_buffer;
+    size_t used = w->p_end - old_buffer;
+    size_t new_size = rb->word_buffer_size;
+    int k;
+
+    do {
+        if (new_size > INT_MAX / 2) {
+            return FALSE;
+        }
+        new_size *= 2;
+    } while (new_size - used < (size_t) n);
+
+    new_buffer = (char *) malloc(new_size);
+    if (new_buffer == NULL) {
+        return FALSE;
+    }
+    memcpy(new_buffer, old_buffer, used);
+
+    /* The fields in the file buffer stay where they are. */
+    for (k = 0; k < w->num_words; ++k) {
+        char *start;
+        if (rb->wanted != NULL && !rb->wanted[k]) {
+            /* Not stored. */
+            continue;
+        }
+        start = rb->words[k].start;
+        if (start >= old_buffer && start <= old_buffer + used) {
+            rb->words[k].start = new_buffer + (start - old_buffer);
+        }
+    }
+    if (w->start >= old_buffer && w->start <= old_buffer + used) {
+        w->start = new_buffer + (w->start - old_buffer);
+    }
+
+    free(old_buffer);
+    rb->word_buffer = new_buffer;
+    rb->word_buffer_size = (int) new_size;
+    ++(rb->num_allocations);
+    w->p_end = new_buffer + used;
+    w->buffer_end = new_buffer + new_size;
+    return TRUE;
+}
+
+
+static inline void start_word(word_state *w)
+{
+    w->skip = (w->wanted != NULL &&
+               (w->num_words >= w->num_wanted || !w->wanted[w->num_words]));
+    w->in_place = w->stable;
+    w->start = w->p_end;
+    w->length = 0;
+}
+
+
+/*
+ *  Copy the part of the field that is in the file buffer to word_buffer.
+ *  Returns FALSE if word_buffer is full and can't grow.
+ */
+
+static int spill_word(word_state *w)
+{
+    if (w->length > w->buffer_end - w->p_end && !grow_word_buffer(w, w->length)) {
+        return FALSE;
+    }
+    memcpy(w->p_end, w->start, w->length);
+    w->start = w->p_end;
+    w->p_end += w->length;
+    w->in_place = FALSE;
+    return TRUE;
+}
+
+
+/*
+ *  Append the n bytes at src (in the file buffer) to the field.
+ *  Returns FALSE if word_buffer is full and can't grow.
+ */
+
+static int append_bytes(word_state *w, char *src, int n)
+{
+    if (w->skip) {
+        return TRUE;
+    }
+    if (w->in_place) {
+        if (w->length == 0) {
+            w->start = src;
+            w->length = n;
+            return TRUE;
+        }
+        if (w->start + w->length == src) {
+            w->length += n;
+            return TRUE;
+        }
+        if (!spill_word(w)) {
+            return FALSE;
+        }
+    }
+    if (n > w->buffer_end - w->p_end && !grow_word_buffer(w, n)) {
+        return FALSE;
+    }
+    memcpy(w->p_end, src, n);
+    w->p_end += n;
+    w->length += n;
+    return TRUE;
+}
+
+
+/*
+ *  Append the char c returned by fetch() to the field.  src is where
+ *  fetch() read it.  (When fetch() translated '\r\n' to '\n', *src is
+ *  '\r', and the field can't stay in place.)
+ */
+
+static int append_char(word_state *w, char c, char *src)
+{
+    if (w->skip) {
+        return TRUE;
+    }
+    if (w->in_place && *src != c && !spill_word(w)) {
+        return FALSE;
+    }
+    if (w->in_place) {
+        return append_bytes(w, src, 1);
+    }
+    return append_bytes(w, &c, 1);
+}
+
+
+/*
+ *  Store the field in the next element of rb->words (unless it is
+ *  skipped).  The caller has checked that there is room for it.
+ */
+
+static inline void end_word(word_state *w)
+{
+    if (!w->skip) {
+        field_span *word = &(w->rb->words[w->num_words]);
+        word->start = w->start;
+        word->length = w->length;
+    }
+    w->num_words++;
+    start_word(w);
+}
+
+
 /*
  *  tokenize a row of input, with an explicit field delimiter char (sep_char).
  *
- *  The fields are stored in word_buffer, and words is an array of
- *  pointers to the starts of the words parsed so far. 
+ *  The spans of the words are stored in rb->words.  A word points into
+ *  the file buffer memory when possible (see word_state above); otherwise
+ *  it is stored in rb->word_buffer.  Both grow as needed.
  *
- *  Returns an array of char*.  Points to memory malloc'ed here so it
- *  must be freed by the caller.
+ *  When the row_buffer has a projection, the unwanted fields are only
+ *  counted: count_delimiters() goes over them to the start of the next
+ *  wanted field (or, after the last wanted field, to the end of the row)
+ *  without going through the state machine.  At a quote or comment
+ *  character, the state machine takes over again.
  *
- *  Returns NULL for several different conditions:
+ *  Returns the number of fields in the row.
+ *
+ *  Returns 0 for several different conditions:
  *  * Reached EOF before finding *any* data to parse.
- *  * The amount of text copied to word_buffer exceeded the buffer size.
- *  * Failed to parse a single field. This is the condition field_number == 0
+ *  * Out of memory: word_buffer or the array of spans could not grow.
+ *  * Failed to parse a single field. This is the condition num_words == 0
  *    that is checked after the main loop.  To do: double check exactly what
  *    can lead to this condition.
- *  * Out of memory: could not allocate the memory to hold the array of
- *    char pointer that the function returns.
- *  * The row has more fields than MAX_NUM_COLUMNS.
  */
 
-static char **tokenize_sep(void *fb, char *word_buffer, int word_buffer_size,
-                           char sep_char, char quote_char, char comment_char,
-                           int *p_num_fields, int allow_embedded_newline,
-                           int *p_error_type)
+static int tokenize_sep(void *fb, row_buffer *rb,
+                        char sep_char, char quote_char, char comment_char,
+                        int allow_embedded_newline, int *p_error_type)
 {
-    int n;
     char c;
     int state;
-    char *words[MAX_NUM_COLUMNS];
-    char *p_word_start, *p_word_end;
-    int field_number;
-    char **result;
+    word_state w;
+    char *span;
+    int span_len, run;
 
     *p_error_type = 0;
 
@@ -56,23 +372,72 @@ static char **tokenize_sep(void *fb, char *word_buffer, int word_buffer_size,
 
     if (next(fb) == FB_EOF) {
         *p_error_type = ERROR_NO_DATA;
-        return NULL;
+        return 0;
     }
 
     state = TOKENIZE_UNQUOTED;
-    field_number = 0;
-    p_word_start = word_buffer;
-    p_word_end = p_word_start;
+    w.rb = rb;
+    w.wanted = rb->wanted;
+    w.num_wanted = rb->num_wanted;
+    w.num_words = 0;
+    w.p_end = rb->word_buffer;
+    w.buffer_end = rb->word_buffer + rb->word_buffer_size;
+    w.stable = spans_are_stable(fb);
+    start_word(&w);
 
     while (TRUE) {
-        if ((p_word_end - word_buffer) >= word_buffer_size) {
-            *p_error_type = ERROR_TOO_MANY_CHARS;
+        if (w.num_words >= rb->max_fields && !w.skip && !grow_fields(rb, w.num_words + 1)) {
+            *p_error_type = ERROR_OUT_OF_MEMORY;
             break;
         }
-        if (field_number >= MAX_NUM_COLUMNS) {
-            *p_error_type = ERROR_TOO_MANY_FIELDS;
-            break;
+
+        if (w.skip && state == TOKENIZE_UNQUOTED) {
+            /*
+             *  Go to the start of the next wanted field (or to the end of
+             *  the row), counting the fields on the way.
+             */
+            int num_skip = fields_to_skip(rb, w.num_words);
+            off_t count;
+            span_len = next_span(fb, &span);
+            run = (int) count_delimiters(span, span_len, sep_char, quote_char, comment_char,
+                                         num_skip, &count);
+            skipbytes(fb, run);
+            if (count > 0) {
+                w.num_words += (int) count;
+                start_word(&w);
+            }
+            if (count == num_skip || (run == span_len && run > 0)) {
+                continue;
+            }
+        }
+
+        /*
+         *  Only the delimiter, quote, comment and end-of-line characters
+         *  change the state, so the bytes before the next one of those
+         *  are added to the word as a block.  (In the quoted state,
+         *  only the quote and end-of-line characters matter.)  The state
+         *  machine below then handles the character that stopped the scan.
+         */
+        span_len = next_span(fb, &span);
+        if (state == TOKENIZE_UNQUOTED) {
+            run = scan_for_chars(span, span_len, sep_char, quote_char, comment_char);
+        } else {
+            run = scan_for_chars(span, span_len, quote_char, quote_char, quote_char);
+        }
+        if (run > 0) {
+            if (!append_bytes(&w, span, run)) {
+                *p_error_type = ERROR_OUT_OF_MEMORY;
+                break;
+            }
+            skipbytes(fb, run);
+            if (run == span_len) {
+                /* Back to the top, to load more data. */
+                continue;
+            }
+            span += run;
         }
+
+        /* span now points to the byte that fetch() reads. */
         c = fetch(fb);
         if (state == TOKENIZE_UNQUOTED) {
             if (c == quote_char) {
@@ -80,28 +445,28 @@ static char **tokenize_sep(void *fb, char *word_buffer, int word_buffer_size,
                 state = TOKENIZE_QUOTED;
             } else if ((c == sep_char) || (c == comment_char) || (c == '\n') || (c == FB_EOF)) {
                 // End of a field.  Save the field, and remain in this state.
-                *p_word_end = '\0';
-                words[field_number] = p_word_start;
-                ++field_number;
-                ++p_word_end;
-                p_word_start = p_word_end;
+                end_word(&w);
                 if (c == '\n' || c == FB_EOF) {
                     break;
                 } else if (c == comment_char) {
                     skipline(fb);
                 }
-            } else {
-                *p_word_end = c;
-                ++p_word_end;
-            } 
+            } else if (!append_char(&w, c, span)) {
+                *p_error_type = ERROR_OUT_OF_MEMORY;
+                break;
+            }
         } else if (state == TOKENIZE_QUOTED) {
             if ((c != quote_char && c != '\n' && c != FB_EOF) || (c == '\n' && allow_embedded_newline)) {
-                *p_word_end = c;
-                ++p_word_end;
+                if (!append_char(&w, c, span)) {
+                    *p_error_type = ERROR_OUT_OF_MEMORY;
+                    break;
+                }
             } else if (c == quote_char && next(fb)==quote_char) {
                 // Repeated quote characters; treat the pair as a single quote char.
-                *p_word_end = c;
-                ++p_word_end;
+                if (!append_char(&w, c, span)) {
+                    *p_error_type = ERROR_OUT_OF_MEMORY;
+                    break;
+                }
                 // Skip the second double-quote.
                 fetch(fb);
             } else if (c == quote_char) {
@@ -114,38 +479,23 @@ static char **tokenize_sep(void *fb, char *word_buffer, int word_buffer_size,
                 // quotes and 'allow_embedded_newline' is 0.
                 // This could be treated as an error, but for now, we'll simply
                 // end the field (and the row).
-                *p_word_end = '\0';
-                words[field_number] = p_word_start;
-                ++field_number;
-                ++p_word_end;
-                p_word_start = p_word_end;
+                end_word(&w);
                 break;
             }
         }
     }
 
     if (*p_error_type) {
-        return NULL;
+        return 0;
     }
 
-    if (field_number == 0) {
+    if (w.num_words == 0) {
         /* XXX Is this the appropriate error type? */
         *p_error_type = ERROR_NO_DATA;
-        return NULL;
-    }
-
-    *p_num_fields = field_number;
-    result = (char **) malloc(sizeof(char *) * field_number);
-    if (result == NULL) {
-        *p_error_type = ERROR_OUT_OF_MEMORY;
-        return NULL;
+        return 0;
     }
 
-    for (n = 0; n < field_number; ++n) {
-        result[n] = words[n];
-    }
-
-    return result;
+    return w.num_words;
 }
 
 
@@ -160,19 +510,15 @@ static char **tokenize_sep(void *fb, char *word_buffer, int word_buffer_size,
  *      This needs to be refined.
  */
 
-static char **tokenize_ws(void *fb, char *word_buffer, int word_buffer_size,
-                          char quote_char, char comment_char,
-                          int *p_num_fields,
-                          int allow_embedded_newline,
-                          int strict_quoting, int *p_error_type)
+static int tokenize_ws(void *fb, row_buffer *rb,
+                       char quote_char, char comment_char,
+                       int allow_embedded_newline,
+                       int strict_quoting, int *p_error_type)
 {
-    int n;
     char c;
     int state;
-    char *words[MAX_NUM_COLUMNS];
-    char *p_word_start, *p_word_end;
-    int field_number;
-    char **result;
+    word_state w;
+    char *src = NULL;
 
     *p_error_type = 0;
 
@@ -182,22 +528,27 @@ static char **tokenize_ws(void *fb, char *word_buffer, int word_buffer_size,
 
     if (next(fb) == FB_EOF) {
         *p_error_type = ERROR_NO_DATA;
-        return NULL;
+        return 0;
     }
 
     state = TOKENIZE_WHITESPACE;
-    field_number = 0;
-    p_word_start = word_buffer;
-    p_word_end = p_word_start;
+    w.rb = rb;
+    w.wanted = rb->wanted;
+    w.num_wanted = rb->num_wanted;
+    w.num_words = 0;
+    w.p_end = rb->word_buffer;
+    w.buffer_end = rb->word_buffer + rb->word_buffer_size;
+    w.stable = spans_are_stable(fb);
+    start_word(&w);
 
     while (TRUE) {
-        if ((p_word_end - word_buffer) >= word_buffer_size) {
-            *p_error_type = ERROR_TOO_MANY_CHARS;
+        if (w.num_words >= rb->max_fields && !w.skip && !grow_fields(rb, w.num_words + 1)) {
+            *p_error_type = ERROR_OUT_OF_MEMORY;
             break;
         }
-        if (field_number == MAX_NUM_COLUMNS) {
-            *p_error_type = ERROR_TOO_MANY_FIELDS;
-            break;
+        if (w.stable) {
+            /* src is where fetch() reads c. */
+            next_span(fb, &src);
         }
         c = fetch(fb);
         //printf("c=%c (%d) next=%c (%d) state=%d\n", c, c, next(fb), next(fb), state);
@@ -209,8 +560,10 @@ static char **tokenize_ws(void *fb, char *word_buffer, int word_buffer_size,
             } else if (c == '\n' || c == FB_EOF) {
                 break;
             } else if (c != ' ') {
-                *p_word_end = c;
-                ++p_word_end;
+                if (!append_char(&w, c, src)) {
+                    *p_error_type = ERROR_OUT_OF_MEMORY;
+                    break;
+                }
                 state = TOKENIZE_UNQUOTED;
             }
         } else if (state == TOKENIZE_UNQUOTED) {
@@ -218,32 +571,34 @@ static char **tokenize_ws(void *fb, char *word_buffer, int word_buffer_size,
                 // Opening quote.  Switch state to TOKENIZE_QUOTED
                 state = TOKENIZE_QUOTED;
             } else if ((c == ' ') || (c == '\n') || (c == FB_EOF)) {
-                *p_word_end = '\0';
-                words[field_number] = p_word_start;
-                ++field_number;
-                ++p_word_end;
-                p_word_start = p_word_end;
+                end_word(&w);
                 if (c == '\n' || c == FB_EOF) {
                     break;
                 }
                 // Switch state to TOKENIZE_WHITESPACE.
                 state = TOKENIZE_WHITESPACE;
-            } else {
-                *p_word_end = c;
-                ++p_word_end;
-            } 
+            } else if (!append_char(&w, c, src)) {
+                *p_error_type = ERROR_OUT_OF_MEMORY;
+                break;
+            }
         } else if (state == TOKENIZE_QUOTED) {
             if ((c != quote_char && c != '\n' && c != FB_EOF) || (c == '\n' && allow_embedded_newline)) {
-                *p_word_end = c;
-                ++p_word_end;
+                if (!append_char(&w, c, src)) {
+                    *p_error_type = ERROR_OUT_OF_MEMORY;
+                    break;
+                }
             } else if (c == quote_char && next(fb)==quote_char) {
-                *p_word_end = c;
-                ++p_word_end;
+                if (!append_char(&w, c, src)) {
+                    *p_error_type = ERROR_OUT_OF_MEMORY;
+                    break;
+                }
                 // Skip the second quote char.
                 fetch(fb);
             } else if (c == quote_char && next(fb) != ' ' && next(fb) != '\n' && next(fb) != FB_EOF) {
-                *p_word_end = c;
-                ++p_word_end; 
+                if (!append_char(&w, c, src)) {
+                    *p_error_type = ERROR_OUT_OF_MEMORY;
+                    break;
+                }
             } else if (c == quote_char) {
                 // Closing quote.  Just switch to TOKENIZE_UNQUOTED.
                 // Note that this does not terminate the field.  This means
@@ -260,57 +615,38 @@ static char **tokenize_ws(void *fb, char *word_buffer, int word_buffer_size,
                 // quotes and 'allow_embedded_newline' is 0.
                 // This could be treated as an error, but for now, we'll simply
                 // end the field (and the row).
-                *p_word_end = '\0';
-                words[field_number] = p_word_start;
-                ++field_number;
-                ++p_word_end;
-                p_word_start = p_word_end;
+                end_word(&w);
                 break;
             }
         } 
     }
 
     if (*p_error_type) {
-        return NULL;
+        return 0;
     }
 
-    if (field_number == 0) {
+    if (w.num_words == 0) {
         /* XXX Is this the appropriate error type? */
         *p_error_type = ERROR_NO_DATA;
-        return NULL;
-    }
-
-    *p_num_fields = field_number;
-
-    result = (char **) malloc(sizeof(char *) * field_number);
-    if (result == NULL) {
-        *p_error_type = ERROR_OUT_OF_MEMORY;
-        return NULL;
-    }
-
-    for (n = 0; n < field_number; ++n) {
-        result[n] = words[n];
+        return 0;
     }
 
-    return result;
+    return w.num_words;
 }
 
 
-char **tokenize(void *fb, char *word_buffer, int word_buffer_size,
-                char sep_char, char quote_char, char comment_char,
-                int *p_num_fields, int allow_embedded_newline,
-                int *p_error_type)
+int tokenize(void *fb, row_buffer *rb,
+             char sep_char, char quote_char, char comment_char,
+             int allow_embedded_newline, int *p_error_type)
 {
-    char **result;
+    int num_fields;
 
     if (sep_char == 0) {
-        result = tokenize_ws(fb, word_buffer, word_buffer_size,
-                             quote_char, comment_char, p_num_fields,
-                             allow_embedded_newline, TRUE, p_error_type);
+        num_fields = tokenize_ws(fb, rb, quote_char, comment_char,
+                                 allow_embedded_newline, TRUE, p_error_type);
     } else {
-        result = tokenize_sep(fb, word_buffer, word_buffer_size,
-                              sep_char, quote_char, comment_char, p_num_fields,
-                              allow_embedded_newline, p_error_type);
+        num_fields = tokenize_sep(fb, rb, sep_char, quote_char, comment_char,
+                                  allow_embedded_newline, p_error_type);
     }
-    return result;
+    return num_fields;
 }
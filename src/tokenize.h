@@ -1,5 +1,79 @@
 
-char **tokenize(void *fb, char *word_buffer, int word_buffer_size,
-                char sep_char, char quote_char, char comment_char,
-                int *p_num_fields, int allow_embedded_newline,
-                int *p_error_type);
+#ifndef TOKENIZE_H
+#define TOKENIZE_H
+
+/*
+ *  A field of a row, as returned by tokenize().  The field is the length
+ *  bytes at start; it is not nul-terminated.  start points either into the
+ *  memory of the file buffer (when the field can be used as it is in the
+ *  file) or into the word_buffer of the row_buffer passed to tokenize().
+ */
+
+typedef struct _field_span {
+    char *start;
+    int length;
+} field_span;
+
+/*
+ *  The memory that tokenize() puts a row in: the array of field spans,
+ *  and the buffer for the fields that can't be left in the file buffer.
+ *  Both are grown by tokenize() when a row doesn't fit, so there is no
+ *  limit (other than memory) on the number of fields or the length of a
+ *  row.  They are not shrunk; a row_buffer that is reused for every row
+ *  stays the size of the largest row.
+ *
+ *  A row_buffer may also have a projection (see set_projection()): the
+ *  set of fields that the caller wants.  The other fields are counted in
+ *  the number of fields returned by tokenize(), but they are not copied,
+ *  and their spans in words are not set.
+ */
+
+typedef struct _row_buffer {
+    field_span *words;
+    int max_fields;
+    char *word_buffer;
+    int word_buffer_size;
+
+    /* Number of times words or word_buffer has been grown. */
+    int num_allocations;
+
+    /*
+     *  The projection: if wanted is not NULL, field k is wanted if
+     *  k < num_wanted and wanted[k] is TRUE.
+     */
+    char *wanted;
+    int num_wanted;
+} row_buffer;
+
+/*
+ *  init_row_buffer() allocates the initial memory of rb; it returns 0, or
+ *  ERROR_OUT_OF_MEMORY.  free_row_buffer() frees it.
+ */
+
+int init_row_buffer(row_buffer *rb);
+void free_row_buffer(row_buffer *rb);
+
+/*
+ *  set_projection() makes tokenize() store only the fields whose indices
+ *  are in columns; it returns 0, or ERROR_OUT_OF_MEMORY.  clear_projection()
+ *  makes it store all the fields again.
+ */
+
+int set_projection(row_buffer *rb, int *columns, int num_columns, int num_fields);
+void clear_projection(row_buffer *rb);
+
+/*
+ *  tokenize() reads the next row from the file buffer fb, and puts the
+ *  spans of its fields in rb->words.  The spans are valid until the next
+ *  call that uses the same row_buffer, so a caller that reuses it for
+ *  every row makes no memory allocation per row (once it has grown to
+ *  the size of the rows).  Returns the number of fields, or 0 if there is
+ *  no row (at the end of the file, or if there is an error; the error is
+ *  in *p_error_type).
+ */
+
+int tokenize(void *fb, row_buffer *rb,
+             char sep_char, char quote_char, char comment_char,
+             int allow_embedded_newline, int *p_error_type);
+
+#endif
@@ -0,0 +1,282 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "validity.h"
+
+
+/*
+ *  Missing values.  Without a validity bitmap, an empty field is stored
+ *  as 0 (NaN for floating point fields), which can't be told apart from
+ *  a real 0.  A field with a bitmap is still stored that way, but the
+ *  bitmap records which rows are missing.  Nothing is written to the
+ *  bitmap for a valid value, so a field with no missing values costs
+ *  only the test for an empty field or an NA token.
+ */
+
+/* The bitmap grows by at least this many bytes. */
+#define MIN_BITMAP_SIZE 512
+
+
+/*
+ *  na_set *new_na_set(char **tokens, int count)
+ *
+ *  Create a set of count NA tokens (nul terminated strings, which are
+ *  copied).  Returns NULL if out of memory.
+ */
+
+na_set *new_na_set(char **tokens, int count)
+{
+    na_set *s;
+    int k;
+
+    s = (na_set *) calloc(1, sizeof(na_set));
+    if (s == NULL) {
+        return NULL;
+    }
+    s->tokens = (char **) calloc(count > 0 ? count : 1, sizeof(char *));
+    s->lengths = (int *) malloc((count > 0 ? count : 1) * sizeof(int));
+    if (s->tokens == NULL || s->lengths == NULL) {
+        del_na_set(s);
+        return NULL;
+    }
+    for (k = 0; k < count; ++k) {
+        int length = (int) strlen(tokens[k]);
+        s->tokens[k] = (char *) malloc(length + 1);
+        if (s->tokens[k] == NULL) {
+            del_na_set(s);
+            return NULL;
+        }
+        memcpy(s->tokens[k], tokens[k], length + 1);
+        s->lengths[k] = length;
+        s->count = k + 1;
+        s->length_mask |= 1u << (length < 31 ? length : 31);
+        if (length > 0) {
+            s->first[(unsigned char) tokens[k][0]] = 1;
+        }
+    }
+    return s;
+}
+
+
+/*
+ *  int is_na_token(na_set *s, const char *start, int length)
+ *
+ *  Boolean: are the length bytes at start one of the tokens of s?
+ */
+
+int is_na_token(na_set *s, const char *start, int length)
+{
+    int k;
+
+    if (!(s->length_mask & (1u << (length < 31 ? length : 31))) ||
+            (length > 0 && !s->first[(unsigned char) start[0]])) {
+        return 0;
+    }
+    for (k = 0; k < s->count; ++k) {
+        if (s->lengths[k] == length && memcmp(s->tokens[k], start, length) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+void del_na_set(na_set *s)
+{
+    int k;
+
+    if (s == NULL) {
+        return;
+    }
+    for (k = 0; k < s->count; ++k) {
+        free(s->tokens[k]);
+    }
+    free(s->tokens);
+    free(s->lengths);
+    free(s);
+}
+
+
+/*
+ *  validity *new_validity(na_set *na, int64_t first_row)
+ *
+ *  Create a bitmap in which all the values are valid, for the rows from
+ *  first_row on.  na (which may be NULL) is the set of NA tokens; it
+ *  must not be deleted before the bitmap.  Returns NULL if out of memory.
+ */
+
+validity *new_validity(na_set *na, int64_t first_row)
+{
+    validity *v;
+
+    v = (validity *) malloc(sizeof(validity));
+    if (v == NULL) {
+        return NULL;
+    }
+    v->na = na;
+    v->bits = NULL;
+    v->size = 0;
+    v->null_count = 0;
+    v->first_row = first_row;
+    return v;
+}
+
+
+/*
+ *  int is_missing(validity *v, const char *start, int length)
+ *
+ *  Boolean: is the value in the length bytes at start missing (empty, or
+ *  one of the NA tokens of v)?
+ */
+
+int is_missing(validity *v, const char *start, int length)
+{
+    return length == 0 || (v->na != NULL && is_na_token(v->na, start, length));
+}
+
+
+/*
+ *  Make room in v->bits for at least size bytes.  The new bytes are all
+ *  valid.  Returns 0, or -1 if out of memory.
+ */
+
+static int grow_bitmap(validity *v, int64_t size)
+{
+    unsigned char *bits;
+    int64_t new_size = 2 * v->size;
+
+    if (size <= v->size) {
+        return 0;
+    }
+    if (new_size < size) {
+        new_size = size;
+    }
+    if (new_size < v->size + MIN_BITMAP_SIZE) {
+        new_size = v->size + MIN_BITMAP_SIZE;
+    }
+    bits = (unsigned char *) realloc(v->bits, new_size);
+    if (bits == NULL) {
+        return -1;
+    }
+    memset(bits + v->size, 0xFF, new_size - v->size);
+    v->bits = bits;
+    v->size = new_size;
+    return 0;
+}
+
+
+/*
+ *  int set_missing(validity *v, int64_t row)
+ *
+ *  Mark the value of row as missing.  Returns 0, or -1 if out of memory.
+ */
+
+int set_missing(validity *v, int64_t row)
+{
+    int64_t i = row - v->first_row;
+    unsigned char bit = (unsigned char) (1 << (i % 8));
+
+    if (grow_bitmap(v, i / 8 + 1) != 0) {
+        return -1;
+    }
+    if (v->bits[i / 8] & bit) {
+        v->bits[i / 8] &= ~bit;
+        ++(v->null_count);
+    }
+    return 0;
+}
+
+
+/*
+ *  void clear_missing(validity *v, int64_t row)
+ *
+ *  Mark the value of row as valid (for a row that is left out of the
+ *  data, and whose index is used again by the next row).
+ */
+
+void clear_missing(validity *v, int64_t row)
+{
+    int64_t i = row - v->first_row;
+    unsigned char bit = (unsigned char) (1 << (i % 8));
+
+    if (i / 8 < v->size && !(v->bits[i / 8] & bit)) {
+        v->bits[i / 8] |= bit;
+        --(v->null_count);
+    }
+}
+
+
+/*
+ *  int merge_validity(validity *v, validity *part, int64_t num_rows)
+ *
+ *  Mark the values that are missing in the first num_rows rows of part
+ *  (a bitmap of rows starting at part->first_row) as missing in v.  This
+ *  is how the bitmaps filled in by several threads are put together (see
+ *  parallel.c).  Returns 0, or -1 if out of memory.
+ */
+
+int merge_validity(validity *v, validity *part, int64_t num_rows)
+{
+    int64_t i;
+
+    if (num_rows > 8 * part->size) {
+        num_rows = 8 * part->size;
+    }
+    for (i = 0; i < num_rows; ++i) {
+        if (part->bits[i / 8] == 0xFF) {
+            // Skip the rest of the byte.
+            i += 7 - i % 8;
+        }
+        else if (!(part->bits[i / 8] & (1 << (i % 8)))) {
+            if (set_missing(v, part->first_row + i) != 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+
+/*
+ *  unsigned char *release_validity(validity *v, int64_t num_rows)
+ *
+ *  Delete the bitmap, except for its bits, which are returned (trimmed
+ *  to the (num_rows + 7) / 8 bytes of num_rows rows).  The caller must
+ *  free() them.  Returns NULL if no value is missing, or if out of
+ *  memory (check v->null_count before the call to tell these apart).
+ */
+
+unsigned char *release_validity(validity *v, int64_t num_rows)
+{
+    unsigned char *bits = NULL;
+    int64_t size = (num_rows + 7) / 8;
+
+    if (v->null_count > 0) {
+        if (size > v->size) {
+            if (grow_bitmap(v, size) != 0) {
+                del_validity(v);
+                return NULL;
+            }
+        }
+        bits = (unsigned char *) realloc(v->bits, size > 0 ? size : 1);
+        if (bits == NULL) {
+            /* Keep the untrimmed memory. */
+            bits = v->bits;
+        }
+        v->bits = NULL;
+    }
+    del_validity(v);
+    return bits;
+}
+
+
+void del_validity(validity *v)
+{
+    if (v == NULL) {
+        return;
+    }
+    free(v->bits);
+    free(v);
+}
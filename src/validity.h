@@ -0,0 +1,79 @@
+#ifndef VALIDITY_H
+#define VALIDITY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ *  A set of NA tokens: the strings (such as "NA" or "null") that mean a
+ *  value is missing.  length_mask and first are precomputed from the
+ *  tokens, so most values that are not tokens are rejected by two table
+ *  lookups, without comparing any strings.  See validity.c.
+ */
+
+typedef struct _na_set {
+
+    int count;
+    char **tokens;
+    int *lengths;
+
+    /*
+     *  Bit n (n < 31) is set if there is a token of length n; bit 31 is
+     *  set if there is a token of length 31 or more.
+     */
+    uint32_t length_mask;
+
+    /* first[c] is nonzero if there is a token that starts with c. */
+    unsigned char first[256];
+
+} na_set;
+
+
+/*
+ *  The validity bitmap of a field: bit i (bit i % 8 of byte i / 8) is 1
+ *  if the value of row i is valid, and 0 if it is missing (as in an
+ *  Arrow column).  A value is missing if its field is empty or is one of
+ *  the tokens of na.  The bitmap is only allocated when the first missing
+ *  value is found, so bits is NULL (and all the values are valid) if
+ *  there are none.  Rows are counted from first_row.
+ */
+
+typedef struct _validity {
+
+    /* The NA tokens (not owned by the bitmap; may be NULL). */
+    na_set *na;
+
+    unsigned char *bits;
+
+    /* Number of bytes allocated for bits. */
+    int64_t size;
+
+    /* Number of missing values. */
+    int64_t null_count;
+
+    int64_t first_row;
+
+} validity;
+
+
+na_set *new_na_set(char **tokens, int count);
+
+int is_na_token(na_set *s, const char *start, int length);
+
+void del_na_set(na_set *s);
+
+validity *new_validity(na_set *na, int64_t first_row);
+
+int is_missing(validity *v, const char *start, int length);
+
+int set_missing(validity *v, int64_t row);
+
+void clear_missing(validity *v, int64_t row);
+
+int merge_validity(validity *v, validity *part, int64_t num_rows);
+
+unsigned char *release_validity(validity *v, int64_t num_rows);
+
+void del_validity(validity *v);
+
+#endif